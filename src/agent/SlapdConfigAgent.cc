@@ -1,5 +1,5 @@
 #include "SlapdConfigAgent.h"
-#include <LDAPConnection.h>
+#include <LDAPAsynConnection.h>
 #include <LDAPException.h>
 #include <LdifReader.h>
 #include <LdifWriter.h>
@@ -10,6 +10,10 @@
 #include <exception>
 #include <sstream>
 #include <fstream>
+#include <iomanip>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 #define DEFAULT_PORT 389
 #define ANSWER	42
@@ -42,6 +46,157 @@ SaslExternalHandler::~SaslExternalHandler()
     }
 }
 
+class LdifEntryWriter : public OlcEntryHandler
+{
+    public:
+        LdifEntryWriter( std::ostream &output ) : m_ldif(output) {}
+        virtual bool handleEntry( const LDAPEntry &entry )
+        {
+            m_ldif.writeRecord( entry );
+            return true;
+        }
+    private:
+        LdifWriter m_ldif;
+};
+
+static long long monotonicMicros()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned long counterDelta( unsigned long before, unsigned long after )
+{
+    // "init" and "reset" replace the OlcConfig object and its counters
+    return after >= before ? after - before : after;
+}
+
+// Records the duration and the LDAP traffic of an SCR call when it goes out
+// of scope
+class TraceScope
+{
+    public:
+        TraceScope( SlapdTraceBuffer &buffer, const char *call,
+                    const YCPPath &path, const OlcConfig &olc )
+            : m_buffer(buffer), m_call(call), m_path(path), m_olc(olc),
+              m_traffic(olc.getTraffic()), m_start(monotonicMicros()) {}
+
+        ~TraceScope()
+        {
+            long long duration = monotonicMicros() - m_start;
+            const OlcTraffic &now = m_olc.getTraffic();
+            OlcTraffic traffic;
+            traffic.roundTrips = counterDelta( m_traffic.roundTrips, now.roundTrips );
+            traffic.entries = counterDelta( m_traffic.entries, now.entries );
+            traffic.bytes = counterDelta( m_traffic.bytes, now.bytes );
+            m_buffer.record( m_call, m_path->toString(), m_start, duration, traffic );
+        }
+
+    private:
+        SlapdTraceBuffer &m_buffer;
+        const char *m_call;
+        const YCPPath &m_path;
+        const OlcConfig &m_olc;
+        OlcTraffic m_traffic;
+        long long m_start;
+};
+
+static std::string jsonString( const std::string &value )
+{
+    std::ostringstream json;
+    json << '"';
+    for ( std::string::const_iterator i = value.begin(); i != value.end(); i++ )
+    {
+        if ( *i == '"' || *i == '\\' )
+        {
+            json << '\\' << *i;
+        }
+        else if ( (unsigned char) *i < 0x20 )
+        {
+            json << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                 << (int) *i << std::dec;
+        }
+        else
+        {
+            json << *i;
+        }
+    }
+    json << '"';
+    return json.str();
+}
+
+SlapdTraceBuffer::SlapdTraceBuffer( unsigned int capacity )
+        : m_spans( capacity ), m_recorded(0)
+{
+}
+
+void SlapdTraceBuffer::record( const char *call, const std::string &path,
+                               long long start, long long duration,
+                               const OlcTraffic &traffic )
+{
+    SlapdTraceSpan &s = m_spans[ m_recorded % m_spans.size() ];
+    s.call = call;
+    s.path = path;
+    s.start = start;
+    s.duration = duration;
+    s.traffic = traffic;
+    m_recorded++;
+}
+
+void SlapdTraceBuffer::clear()
+{
+    m_recorded = 0;
+}
+
+unsigned long SlapdTraceBuffer::size() const
+{
+    return std::min( m_recorded, (unsigned long) m_spans.size() );
+}
+
+const SlapdTraceSpan& SlapdTraceBuffer::span( unsigned long n ) const
+{
+    return m_spans[ ( m_recorded - this->size() + n ) % m_spans.size() ];
+}
+
+std::string SlapdTraceBuffer::toJson() const
+{
+    std::ostringstream json;
+    json << "[";
+    for ( unsigned long i = 0; i < this->size(); i++ )
+    {
+        const SlapdTraceSpan &s = this->span(i);
+        json << ( i ? ",\n" : "\n" )
+             << "{\"call\":\"" << s.call << "\",\"path\":" << jsonString( s.path )
+             << ",\"start\":" << s.start << ",\"duration\":" << s.duration
+             << ",\"roundTrips\":" << s.traffic.roundTrips
+             << ",\"entries\":" << s.traffic.entries
+             << ",\"bytes\":" << s.traffic.bytes << "}";
+    }
+    json << "\n]\n";
+    return json.str();
+}
+
+std::string SlapdTraceBuffer::toChromeTrace() const
+{
+    std::ostringstream json;
+    json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for ( unsigned long i = 0; i < this->size(); i++ )
+    {
+        const SlapdTraceSpan &s = this->span(i);
+        json << ( i ? ",\n" : "\n" )
+             << "{\"name\":" << jsonString( s.path )
+             << ",\"cat\":\"" << s.call << "\",\"ph\":\"X\""
+             << ",\"ts\":" << s.start << ",\"dur\":" << s.duration
+             << ",\"pid\":" << getpid() << ",\"tid\":1"
+             << ",\"args\":{\"roundTrips\":" << s.traffic.roundTrips
+             << ",\"entries\":" << s.traffic.entries
+             << ",\"bytes\":" << s.traffic.bytes << "}}";
+    }
+    json << "\n]}\n";
+    return json.str();
+}
+
 bool caseIgnoreCompare( char c1, char c2)
 {
     return toupper(c1) == toupper(c2);
@@ -61,29 +216,51 @@ static void y2LogCallback( int level, const std::string &msg,
     y2_logger(y2level, "libslapdconfig", file, line, function, "%s", msg.c_str());
 }
 
-SlapdConfigAgent::SlapdConfigAgent() : m_lc(0)
+SlapdConfigAgent::SlapdConfigAgent() : m_lc(0), m_lcPooled(false), dbIndexValid(false),
+        serverIdVersion(0), serverIdGlobals(0)
 {
     y2milestone("SlapdConfigAgent::SlapdConfigAgent");
     OlcConfig::setLogCallback(y2LogCallback);
+    // don't build debug messages that y2log would drop anyway
+    OlcConfig::setLogLevel( get_log_debug() ? SLAPD_LOG_DEBUG : SLAPD_LOG_INFO );
 }
 
 SlapdConfigAgent::~SlapdConfigAgent()
 {
-    if ( m_lc)
+    this->closeConnection();
+}
+
+// hands a pooled connection back for the next "init", closes the others
+void SlapdConfigAgent::closeConnection()
+{
+    if ( olc.isSyncActive() )
+    {
+        olc.stopSync();
+    }
+    olc = OlcConfig();
+    if ( m_lcPooled )
+    {
+        connections.release( m_lc );
+    }
+    else if ( m_lc )
     {
         delete(m_lc);
     }
+    m_lc = 0;
+    m_lcPooled = false;
 }
 
 YCPValue SlapdConfigAgent::Read( const YCPPath &path,
                                  const YCPValue &arg,
                                  const YCPValue &opt)
 {
+    TraceScope trace( traces, "Read", path, olc );
     y2milestone("Path %s Length %ld ", path->toString().c_str(),
                                       path->length());
     y2milestone("Component %s ", path->component_str(0).c_str());
     
     try {
+        this->processSyncChanges();
         if ( path->length() < 1 ) {
             return YCPNull();
         } 
@@ -115,6 +292,14 @@ YCPValue SlapdConfigAgent::Read( const YCPPath &path,
         {
             return ConfigToLdif();
         }
+        else if ( path->component_str(0) == "commitPlan" )
+        {
+            return CommitPlanToList();
+        }
+        else if ( path->component_str(0) == "stats" )
+        {
+            return StatisticsToMap();
+        }
     } catch ( std::runtime_error e ) {
         y2error("Error during Read: %s", e.what() );
         lastError->add(YCPString("summary"), YCPString(std::string( e.what() ) ) );
@@ -129,9 +314,11 @@ YCPBoolean SlapdConfigAgent::Write( const YCPPath &path,
                                   const YCPValue &arg,
                                   const YCPValue &arg2)
 {
+    TraceScope trace( traces, "Write", path, olc );
     y2milestone("Path %s Length %ld ", path->toString().c_str(),
                                       path->length());
     try {
+        this->processSyncChanges();
         if ( path->component_str(0) == "global" )
         {
             y2milestone("Global Write");
@@ -177,6 +364,7 @@ YCPValue SlapdConfigAgent::Execute( const YCPPath &path,
                                     const YCPValue &arg,
                                     const YCPValue &arg2)
 {
+    TraceScope trace( traces, "Execute", path, olc );
     y2milestone("Execute Path %s", path->toString().c_str() );
     if ( path->component_str(0) == "init" )
     {
@@ -194,25 +382,34 @@ YCPValue SlapdConfigAgent::Execute( const YCPPath &path,
                 target.setPort( targetMap->value(YCPString("port"))->asInteger()->value() );
                 uri = target.getURLString();
             }
-            m_lc = new LDAPConnection(uri);
             try {
                 if( arg.isNull() )
                 {
+                    m_lc = new LDAPAsynConnection(uri);
                     SaslExternalHandler sih;
-                    m_lc->saslInteractiveBind("external", 2 /* LDAP_SASL_QUIET */, (SaslInteractionHandler*)&sih);
+                    OlcConfig::waitForResult( m_lc->saslInteractiveBind("external",
+                            2 /* LDAP_SASL_QUIET */, (SaslInteractionHandler*)&sih) );
                 }
                 else
                 {
-                    TlsOptions tls = m_lc->getTlsOptions();
+                    // remote servers are often initialized again after a
+                    // "reset", their connection is kept in the pool
+                    std::string cacert;
                     if ( ! argMap->value(YCPString("cacert")).isNull() )
                     {
-                        tls.setOption( TlsOptions::CACERTFILE, argMap->value( YCPString("cacert"))->asString()->value_cstr() );
+                        cacert = argMap->value( YCPString("cacert"))->asString()->value_cstr();
                     }
-                    if ( argMap->value(YCPString("starttls"))->asBoolean()->value() )
+                    bool starttls = argMap->value(YCPString("starttls"))->asBoolean()->value();
+                    std::string configcred( argMap->value(YCPString("configcred"))->asString()->value_cstr() );
+                    OlcConnectionPool::State state;
+                    m_lc = connections.acquire( OlcConnectionPool::Key( uri, starttls, cacert ),
+                                                state );
+                    m_lcPooled = true;
+                    if ( state == OlcConnectionPool::NEW && starttls )
                     {
                         m_lc->start_tls();
                     }
-                    m_lc->bind("cn=config", std::string( argMap->value(YCPString("configcred"))->asString()->value_cstr() ));
+                    OlcConfig::waitForResult( m_lc->bind("cn=config", configcred) );
                 }
             }
             catch ( LDAPException e)
@@ -224,13 +421,50 @@ YCPValue SlapdConfigAgent::Execute( const YCPPath &path,
                         YCPString(errstring) );
                 lastError->add(YCPString("description"), YCPString( details ) );
                 y2milestone("Error connection to the LDAP Server: %s", details.c_str());
-                delete(m_lc);
+                if ( m_lcPooled )
+                {
+                    connections.discard(m_lc);
+                }
+                else
+                {
+                    delete(m_lc);
+                }
                 m_lc=0;
+                m_lcPooled = false;
                 return YCPBoolean(false);
             }
             olc = OlcConfig(m_lc);
+            // the model is dropped as a whole on "reset" and "init", build
+            // it in a few large blocks instead of many small allocations
+            int arenaBlockSize = 64 * 1024;
+            if ( ! arg.isNull() && ! argMap->value(YCPString("arenaBlockSize")).isNull() )
+            {
+                arenaBlockSize = argMap->value(YCPString("arenaBlockSize"))->asInteger()->value();
+            }
+            olc.setArenaBlockSize( arenaBlockSize > 0 ? arenaBlockSize : 0 );
+            if ( ! arg.isNull() && ! argMap->value(YCPString("localUpdates")).isNull() )
+            {
+                olc.setLocalUpdates( argMap->value(YCPString("localUpdates"))->asBoolean()->value() );
+            }
+            if ( ! arg.isNull() && ! argMap->value(YCPString("cacheFile")).isNull() )
+            {
+                olc.setCacheFile( argMap->value(YCPString("cacheFile"))->asString()->value_cstr() );
+            }
+            if ( ! arg.isNull() && ! argMap->value(YCPString("sync")).isNull() &&
+                 argMap->value(YCPString("sync"))->asBoolean()->value() )
+            {
+                try {
+                    if ( ! olc.startSync() )
+                    {
+                        y2milestone("LDAP Sync is not available on cn=config");
+                    }
+                } catch ( LDAPException e ) {
+                    y2warning("LDAP Sync failed: %s", e.what() );
+                }
+            }
         }
         databases.clear();
+        dbIndexValid = false;
         schema.clear();
         deleteableSchema.clear();
         globals.reset((OlcGlobalConfig*) 0 );
@@ -242,11 +476,9 @@ YCPValue SlapdConfigAgent::Execute( const YCPPath &path,
         {
            // olc.getLdapConnection()->unbind();
         }
-        olc = OlcConfig();
-        if ( m_lc)
-            delete m_lc;
-        m_lc=0;
+        this->closeConnection();
         databases.clear();
+        dbIndexValid = false;
         schema.clear();
         deleteableSchema.clear();
         globals.reset((OlcGlobalConfig*) 0 );
@@ -272,6 +504,7 @@ YCPValue SlapdConfigAgent::Execute( const YCPPath &path,
             {
                 boost::shared_ptr<OlcDatabase> olce(OlcDatabase::createFromLdapEntry(currentEntry));
                 databases.push_back(olce);
+                dbIndexValid = false;
             }
             else if (OlcConfigEntry::isGlobalEntry(currentEntry) )
             {
@@ -297,6 +530,7 @@ YCPValue SlapdConfigAgent::Execute( const YCPPath &path,
     {
         YCPList dbList = arg->asList();
         databases.clear();
+        dbIndexValid = false;
         for ( int i = 0; i < dbList->size(); i++ )
         {
             YCPMap dbMap = dbList->value(i)->asMap();
@@ -358,39 +592,16 @@ YCPValue SlapdConfigAgent::Execute( const YCPPath &path,
                 }
             }
             databases.push_back(db);
+            dbIndexValid = false;
         }
     }
     else if ( path->component_str(0) == "commitChanges" )
     {
         try {
-            if ( globals )
-                olc.updateEntry( *globals );
-
-            OlcSchemaList::iterator j;
-            for ( j = schema.begin(); j != schema.end() ; j++ )
-            {
-                olc.updateEntry(**j);
-            }
+            // rebase the changes onto the latest state of the server
+            this->processSyncChanges();
+            olc.updateEntries( this->pendingEntries() );
             deleteableSchema.clear();
-            OlcDatabaseList::iterator i;
-            for ( i = databases.begin(); i != databases.end() ; i++ )
-            {
-                if ( ! (*i)->isDeletedEntry() )
-                {
-                    olc.updateEntry(**i);
-                }
-                OlcOverlayList overlays = (*i)->getOverlays();
-                OlcOverlayList::iterator k;
-                for ( k = overlays.begin(); k != overlays.end(); k++ )
-                {
-                    y2milestone("Update overlay: %s", (*k)->getDn().c_str() );
-                    olc.updateEntry(**k);
-                }
-                if ( (*i)->isDeletedEntry() )
-                {
-                    olc.updateEntry(**i);
-                }
-            }
         } catch ( LDAPException e ) {
             std::string errstring = "Error while committing changes to config database";
             std::string details = e.getResultMsg() + ": " + e.getServerMsg();
@@ -420,14 +631,10 @@ YCPValue SlapdConfigAgent::Execute( const YCPPath &path,
             attrs.add("modifiersName");
             attrs.add("modifyTimestamp");
             attrs.add("contextCSN");
-            LDAPSearchResults *sr = m_lc->search( "cn=config", LDAPConnection::SEARCH_SUB,
-                                                  "objectclass=*", attrs );
             std::ostringstream ldifStream;
-            LdifWriter ldif(ldifStream);
-            while ( LDAPEntry *e = sr->getNext() )
-            {
-                ldif.writeRecord( *e );
-            }
+            LdifEntryWriter ldif(ldifStream);
+            olc.searchEntries( "cn=config", LDAPAsynConnection::SEARCH_SUB,
+                               "objectclass=*", ldif, attrs, 100 );
             return YCPString( ldifStream.str() );
         } catch ( LDAPException e ) {
             std::string errstring = "Error while reading remote Database";
@@ -498,6 +705,35 @@ YCPValue SlapdConfigAgent::Execute( const YCPPath &path,
     {
         return YCPBoolean(remoteSyncCheck(arg));
     }
+    else if ( path->component_str(0) == "dumpTrace" )
+    {
+        // the spans of the latest SCR calls as a JSON array or, with format
+        // "chrome", in Chrome's trace format. If "file" is given the trace
+        // is written to that file.
+        std::string format = "json";
+        std::string file;
+        if ( ! arg.isNull() )
+        {
+            YCPMap argMap = arg->asMap();
+            if ( ! argMap->value(YCPString("format")).isNull() )
+            {
+                format = argMap->value(YCPString("format"))->asString()->value_cstr();
+            }
+            if ( ! argMap->value(YCPString("file")).isNull() )
+            {
+                file = argMap->value(YCPString("file"))->asString()->value_cstr();
+            }
+        }
+        std::string trace = ( format == "chrome" ) ? traces.toChromeTrace() : traces.toJson();
+        if ( file.empty() )
+        {
+            return YCPString( trace );
+        }
+        std::ofstream traceFile( file.c_str(), std::ios::out|std::ios::trunc );
+        traceFile << trace;
+        traceFile.close();
+        return YCPBoolean( ! traceFile.fail() );
+    }
     return YCPBoolean(true);
 }
 
@@ -520,6 +756,272 @@ YCPValue SlapdConfigAgent::otherCommand( const YCPTerm& term)
 
 }
 
+// Fetch globals, databases and schema in one go, if nothing has been
+// read from the server so far
+void SlapdConfigAgent::readConfig()
+{
+    if ( olc.hasConnection() && !globals && databases.empty() && schema.empty() )
+    {
+        y2milestone("Reading complete configuration");
+        olc.getConfig( globals, databases, schema );
+        dbIndexValid = false;
+    }
+}
+
+static bool sameDn( const std::string &dn1, const std::string &dn2 )
+{
+    return dn1.size() == dn2.size() && strcasecmp( dn1.c_str(), dn2.c_str() ) == 0;
+}
+
+// the entries of "list" are kept in the order of their index, returns the
+// position of the inserted entry
+template <class List>
+static std::size_t insertByIndex( List &list, const typename List::value_type &entry )
+{
+    typename List::iterator i = list.begin();
+    while ( i != list.end() && (*i)->getEntryIndex() <= entry->getEntryIndex() )
+    {
+        i++;
+    }
+    return list.insert( i, entry ) - list.begin();
+}
+
+static std::string dnKey( const std::string &dn )
+{
+    std::string key( dn );
+    std::transform( key.begin(), key.end(), key.begin(), ::tolower );
+    return key;
+}
+
+// Builds the indexes of all databases, they are kept up to date from then on
+// until the list is replaced
+void SlapdConfigAgent::indexDatabases()
+{
+    dbByIndex.clear();
+    dbByDn.clear();
+    dbIndexValid = true;
+    this->indexDatabases( 0 );
+}
+
+// Adds the databases from position "from" on to the indexes. The first one
+// wins, like with the linear search. Deleted databases are skipped, the next
+// one took over their index.
+void SlapdConfigAgent::indexDatabases( std::size_t from )
+{
+    if ( ! dbIndexValid )
+    {
+        return;
+    }
+    for ( std::size_t pos = from; pos < databases.size(); pos++ )
+    {
+        const OlcDatabase &db = *databases[pos];
+        if ( db.isDeletedEntry() )
+        {
+            continue;
+        }
+        dbByIndex.insert( std::make_pair( db.getEntryIndex(), pos ) );
+        if ( ! db.getDn().empty() )
+        {
+            dbByDn.insert( std::make_pair( dnKey( db.getDn() ), pos ) );
+        }
+    }
+}
+
+// Removes the databases from position "from" on from the indexes, before
+// they are moved or renumbered. Their positions may be stale already, e.g.
+// after an insert, every entry pointing at "from" or behind is dropped.
+void SlapdConfigAgent::unindexDatabases( std::size_t from )
+{
+    if ( ! dbIndexValid )
+    {
+        return;
+    }
+    for ( std::size_t pos = from; pos < databases.size(); pos++ )
+    {
+        const OlcDatabase &db = *databases[pos];
+        DatabasePositions::iterator i = dbByIndex.find( db.getEntryIndex() );
+        if ( i != dbByIndex.end() && i->second >= from )
+        {
+            dbByIndex.erase( i );
+        }
+        DatabaseNames::iterator j = dbByDn.find( dnKey( db.getDn() ) );
+        if ( j != dbByDn.end() && j->second >= from )
+        {
+            dbByDn.erase( j );
+        }
+    }
+}
+
+OlcDatabaseList::iterator SlapdConfigAgent::findDatabase( int index )
+{
+    if ( ! dbIndexValid )
+    {
+        this->indexDatabases();
+    }
+    DatabasePositions::const_iterator i = dbByIndex.find( index );
+    return ( i != dbByIndex.end() ) ? databases.begin() + i->second : databases.end();
+}
+
+OlcDatabaseList::iterator SlapdConfigAgent::findDatabaseByDn( const std::string &dn )
+{
+    if ( ! dbIndexValid )
+    {
+        this->indexDatabases();
+    }
+    DatabaseNames::const_iterator i = dbByDn.find( dnKey( dn ) );
+    return ( i != dbByDn.end() ) ? databases.begin() + i->second : databases.end();
+}
+
+// Applies the changes other clients made to cn=config since the last SCR
+// call, if "init" was asked to keep an LDAP Sync session open
+void SlapdConfigAgent::processSyncChanges()
+{
+    if ( ! olc.isSyncActive() || olc.pollSync( *this ) )
+    {
+        return;
+    }
+    if ( OlcCommitPlan( this->pendingEntries() ).getWaves().empty() )
+    {
+        y2milestone("LDAP Sync ended, re-reading the configuration");
+        databases.clear();
+        dbIndexValid = false;
+        schema.clear();
+        globals.reset((OlcGlobalConfig*) 0 );
+    }
+    else
+    {
+        y2warning("LDAP Sync ended, keeping the configuration with pending changes");
+    }
+    try {
+        olc.startSync();
+    } catch ( LDAPException e ) {
+        y2warning("LDAP Sync failed: %s", e.what() );
+    }
+}
+
+void SlapdConfigAgent::entryChanged( const LDAPEntry &entry )
+{
+    const std::string &dn = entry.getDN();
+    OlcConfigEntry *known = 0;
+    if ( globals && sameDn( globals->getDn(), dn ) )
+    {
+        known = globals.get();
+    }
+    OlcDatabaseList::iterator i = this->findDatabaseByDn( dn );
+    if ( ! known && i != databases.end() )
+    {
+        known = i->get();
+    }
+    // overlays are looked up below their database
+    OlcDatabaseList::iterator parent = this->findDatabaseByDn( dn.substr( dn.find(',') + 1 ) );
+    if ( ! known && parent != databases.end() )
+    {
+        OlcOverlayList &overlays = (*parent)->getOverlays();
+        OlcOverlayList::iterator k;
+        for ( k = overlays.begin(); ! known && k != overlays.end(); k++ )
+        {
+            if ( sameDn( (*k)->getDn(), dn ) )
+            {
+                known = k->get();
+            }
+        }
+    }
+    OlcSchemaList::iterator j;
+    for ( j = schema.begin(); ! known && j != schema.end(); j++ )
+    {
+        if ( sameDn( (*j)->getDn(), dn ) )
+        {
+            known = j->get();
+        }
+    }
+
+    // an entry added locally has no DN on the server yet
+    if ( ! known )
+    {
+        OlcConfigEntryList pending = this->pendingEntries();
+        OlcConfigEntryList::const_iterator k;
+        for ( k = pending.begin(); ! known && k != pending.end(); k++ )
+        {
+            if ( (*k)->isNewEntry() && sameDn( (*k)->getUpdatedDn(), dn ) )
+            {
+                known = *k;
+            }
+        }
+    }
+
+    if ( known && known->isNewEntry() )
+    {
+        known->rebase( entry );
+        y2warning("%s was added on the server as well, the local entry wins", dn.c_str() );
+    }
+    else if ( known )
+    {
+        y2milestone("Changed on the server: %s", dn.c_str() );
+        if ( ! known->rebase( entry ) )
+        {
+            y2warning("%s was changed on the server, the local changes win", dn.c_str() );
+        }
+    }
+    // new entries are only added to the parts of the configuration read
+    // already, the others are read completely when needed
+    else if ( OlcConfigEntry::isDatabaseEntry( entry ) && ! databases.empty() )
+    {
+        y2milestone("Database added on the server: %s", dn.c_str() );
+        std::size_t pos = insertByIndex( databases,
+                boost::shared_ptr<OlcDatabase>( OlcDatabase::createFromLdapEntry( entry ) ) );
+        this->unindexDatabases( pos );
+        this->indexDatabases( pos );
+    }
+    else if ( OlcConfigEntry::isOverlayEntry( entry ) && parent != databases.end() )
+    {
+        y2milestone("Overlay added on the server: %s", dn.c_str() );
+        insertByIndex( (*parent)->getOverlays(),
+                boost::shared_ptr<OlcOverlay>( OlcOverlay::createFromLdapEntry( entry ) ) );
+    }
+    else if ( OlcConfigEntry::isScheamEntry( entry ) && ! schema.empty() )
+    {
+        y2milestone("Schema added on the server: %s", dn.c_str() );
+        insertByIndex( schema, boost::shared_ptr<OlcSchemaConfig>( new OlcSchemaConfig( entry ) ) );
+    }
+}
+
+void SlapdConfigAgent::entryDeleted( const std::string &dn )
+{
+    y2milestone("Deleted on the server: %s", dn.c_str() );
+    OlcDatabaseList::iterator i = this->findDatabaseByDn( dn );
+    if ( i != databases.end() )
+    {
+        std::size_t pos = i - databases.begin();
+        this->unindexDatabases( pos );
+        databases.erase( i );
+        this->indexDatabases( pos );
+        return;
+    }
+    i = this->findDatabaseByDn( dn.substr( dn.find(',') + 1 ) );
+    if ( i != databases.end() )
+    {
+        OlcOverlayList &overlays = (*i)->getOverlays();
+        OlcOverlayList::iterator k;
+        for ( k = overlays.begin(); k != overlays.end(); k++ )
+        {
+            if ( sameDn( (*k)->getDn(), dn ) )
+            {
+                overlays.erase( k );
+                return;
+            }
+        }
+    }
+    OlcSchemaList::iterator j;
+    for ( j = schema.begin(); j != schema.end(); j++ )
+    {
+        if ( sameDn( (*j)->getDn(), dn ) )
+        {
+            schema.erase( j );
+            return;
+        }
+    }
+}
+
 YCPValue SlapdConfigAgent::ReadGlobal( const YCPPath &path,
                                     const YCPValue &arg,
                                     const YCPValue &opt)
@@ -533,6 +1035,7 @@ YCPValue SlapdConfigAgent::ReadGlobal( const YCPPath &path,
     } 
     else
     {
+        this->readConfig();
         if ( globals == 0 )
         {
             globals = olc.getGlobals();
@@ -610,9 +1113,11 @@ YCPValue SlapdConfigAgent::ReadDatabases( const YCPPath &path,
 {
     y2milestone("Path %s Length %ld ", path->toString().c_str(),
                                       path->length());
+    this->readConfig();
     if ( databases.size() == 0 )
     {
         databases = olc.getDatabases();
+        dbIndexValid = false;
     }
     OlcDatabaseList::const_iterator i;
     YCPList dbList;
@@ -663,12 +1168,15 @@ YCPValue SlapdConfigAgent::ReadDatabase( const YCPPath &path,
     }
 
     y2milestone("Database to read: %d", dbIndex);
+    this->readConfig();
     if ( databases.size() == 0 )
     {
         databases = olc.getDatabases();
+        dbIndexValid = false;
     }
     OlcDatabaseList::const_iterator i;
-    for ( i = databases.begin(); i != databases.end() ; i++ )
+    // the index finds the first database with that index, like the scan did
+    for ( i = this->findDatabase( dbIndex ); i != databases.end() ; i++ )
     {
         if ( (*i)->getEntryIndex() == dbIndex ) 
         {
@@ -1017,6 +1525,7 @@ YCPValue SlapdConfigAgent::ReadSchema( const YCPPath &path,
 {
     if ( path->component_str(0) == "attributeTypes" )
     {
+        this->readConfig();
         if ( schema.size() == 0 )
         {
             schema = olc.getSchemaNames();
@@ -1101,6 +1610,7 @@ YCPValue SlapdConfigAgent::ReadSchema( const YCPPath &path,
     else if ( path->component_str(0) == "ldif" )
     {
         std::string name = path->component_str(1);
+        this->readConfig();
         if ( schema.size() == 0 )
         {
             schema = olc.getSchemaNames();
@@ -1141,6 +1651,7 @@ YCPValue SlapdConfigAgent::ReadSchemaList( const YCPPath &path,
 {
     y2milestone("Path %s Length %ld ", path->toString().c_str(),
                                       path->length());
+    this->readConfig();
     if ( schema.size() == 0 )
     {
         schema = olc.getSchemaNames();
@@ -1293,9 +1804,11 @@ YCPBoolean SlapdConfigAgent::WriteDatabase( const YCPPath &path,
     bool databaseAdd = false;
     std::string dbIndexStr = path->component_str(component);
 
+    this->readConfig();
     if ( databases.size() == 0 && olc.hasConnection() )
     {
         databases =  olc.getDatabases();
+        dbIndexValid = false;
     }
     if ( dbIndexStr == "new" )
     {
@@ -1334,11 +1847,22 @@ YCPBoolean SlapdConfigAgent::WriteDatabase( const YCPPath &path,
     {
         YCPMap dbMap= arg->asMap();
         y2milestone("creating new Database");
+        // deleted databases stay in the list until the commit, but the
+        // following ones already took over their indexes
+        int dbCount = 0;
+        OlcDatabaseList::const_iterator d;
+        for ( d = databases.begin(); d != databases.end(); d++ )
+        {
+            if ( ! (*d)->isDeletedEntry() )
+            {
+                dbCount++;
+            }
+        }
         if ( dbIndex == -2 )
         {
-            dbIndex = databases.size()-1; //Database indexes start counting from -1
+            dbIndex = dbCount-1; //Database indexes start counting from -1
         }
-        else if ( (dbIndex <=0) || (dbIndex > (int)databases.size()-1) ) 
+        else if ( (dbIndex <=0) || (dbIndex > dbCount-1) ) 
         {
             lastError->add(YCPString("summary"), YCPString("Adding Database Failed") );
             std::string msg = "Invalid Index for new Database";
@@ -1405,44 +1929,35 @@ YCPBoolean SlapdConfigAgent::WriteDatabase( const YCPPath &path,
         // find insert position
         OlcDatabaseList::iterator i,k;
         bool inserted = false;
-        for ( i = databases.begin(); i != databases.end() ; i++ )
+        for ( i = this->findDatabase( dbIndex ); i != databases.end() ; i++ )
         {
             if ( (*i)->getEntryIndex() == dbIndex )
             {
+                this->unindexDatabases( i - databases.begin() );
                 k = databases.insert(i, db ); 
                 inserted=true;
+                break;
             }
         }
         if ( inserted )
         {
-            k++;
             // renumber remaining databases
-            for( ; k != databases.end(); k++ )
-            {
-                y2milestone("%s needs to be renumbered", (*k)->getSuffix().c_str() );
-                (*k)->setIndex( (*k)->getEntryIndex() + 1, true );
-
-                // update the overlays' DNs accordingly
-                OlcOverlayList overlays = (*k)->getOverlays();
-                OlcOverlayList::const_iterator l = overlays.begin();
-                for (; l != overlays.end(); l++ )
-                {
-                    (*l)->newParentDn( (*k)->getUpdatedDn() );
-                }
-            }
+            OlcDatabase::renumber( k + 1, databases.end(), 1 );
+            this->indexDatabases( k - databases.begin() );
         }
         else
         {
             databases.push_back(db);
+            this->indexDatabases( databases.size() - 1 );
         }
         ret = true;
     }
     else
     {
         y2milestone("Database to write: %d", dbIndex);
-        OlcDatabaseList::const_iterator i;
+        OlcDatabaseList::iterator i;
         bool dbDeleted=false;
-        for ( i = databases.begin(); i != databases.end() ; i++ )
+        for ( i = this->findDatabase( dbIndex ); i != databases.end() ; i++ )
         {
             if ( (*i)->getEntryIndex() == dbIndex ) 
             {
@@ -1451,6 +1966,7 @@ YCPBoolean SlapdConfigAgent::WriteDatabase( const YCPPath &path,
                     YCPMap dbMap= arg->asMap();
                     if ( dbMap.size() == 0 ) // database delete
                     {
+                        this->unindexDatabases( i - databases.begin() );
                         (*i)->clearChangedEntry();
                         // delete the overlays' DNs  as well
                         OlcOverlayList overlays = (*i)->getOverlays();
@@ -1912,21 +2428,10 @@ YCPBoolean SlapdConfigAgent::WriteDatabase( const YCPPath &path,
         }
         if ( dbDeleted ) // renumber other dbs
         {
-            i++;
-            // renumber remaining databases
-            for( ; i != databases.end(); i++ )
-            {
-                y2milestone("%s needs to be renumbered", (*i)->getSuffix().c_str() );
-                (*i)->setIndex( (*i)->getEntryIndex() + 1, true );
-
-                // update the overlays' DNs accordingly
-                OlcOverlayList overlays = (*i)->getOverlays();
-                OlcOverlayList::const_iterator l = overlays.begin();
-                for (; l != overlays.end(); l++ )
-                {
-                    (*l)->newParentDn( (*i)->getUpdatedDn() );
-                }
-            }
+            // renumber remaining databases, slapd moves them down into the
+            // index of the deleted one
+            OlcDatabase::renumber( i + 1, databases.end(), -1 );
+            this->indexDatabases( i - databases.begin() );
         }
     }
 
@@ -1960,6 +2465,7 @@ YCPBoolean SlapdConfigAgent::WriteSchema( const YCPPath &path,
                                       path->length());
 
     y2milestone("WriteSchema");
+    this->readConfig();
     if ( schema.size() == 0 && olc.hasConnection() )
     {
         schema =  olc.getSchemaNames();
@@ -2138,6 +2644,114 @@ YCPBoolean SlapdConfigAgent::WriteSchema( const YCPPath &path,
     return YCPBoolean(false);
 }
 
+OlcConfigEntryList SlapdConfigAgent::pendingEntries() const
+{
+    OlcConfigEntryList entries;
+    if ( globals )
+        entries.push_back( globals.get() );
+
+    OlcSchemaList::const_iterator j;
+    for ( j = schema.begin(); j != schema.end() ; j++ )
+    {
+        entries.push_back( j->get() );
+    }
+    OlcDatabaseList::const_iterator i;
+    for ( i = databases.begin(); i != databases.end() ; i++ )
+    {
+        if ( ! (*i)->isDeletedEntry() )
+        {
+            entries.push_back( i->get() );
+        }
+        OlcOverlayList overlays = (*i)->getOverlays();
+        OlcOverlayList::iterator k;
+        for ( k = overlays.begin(); k != overlays.end(); k++ )
+        {
+            entries.push_back( k->get() );
+        }
+        if ( (*i)->isDeletedEntry() )
+        {
+            entries.push_back( i->get() );
+        }
+    }
+    return entries;
+}
+
+YCPList SlapdConfigAgent::CommitPlanToList() const
+{
+    y2milestone("CommitPlanToList");
+    static const char *opNames[] = { "add", "modify", "delete" };
+    OlcCommitPlan plan( this->pendingEntries() );
+    YCPList waveList;
+    const std::vector<OlcCommitPlan::Wave> &waves = plan.getWaves();
+    for ( unsigned int i = 0; i < waves.size(); i++ )
+    {
+        YCPList stepList;
+        for ( unsigned int j = 0; j < waves[i].size(); j++ )
+        {
+            YCPMap step;
+            step.add( YCPString("operation"), YCPString( opNames[waves[i][j].op] ) );
+            step.add( YCPString("dn"), YCPString( waves[i][j].dn ) );
+            stepList.add( step );
+        }
+        waveList.add( stepList );
+    }
+    return waveList;
+}
+
+YCPMap SlapdConfigAgent::StatisticsToMap() const
+{
+    const OlcTraffic &traffic = olc.getTraffic();
+    YCPMap trafficMap;
+    trafficMap.add( YCPString("roundTrips"), YCPInteger( traffic.roundTrips ) );
+    trafficMap.add( YCPString("entries"), YCPInteger( traffic.entries ) );
+    trafficMap.add( YCPString("bytes"), YCPInteger( traffic.bytes ) );
+
+    YCPList bounds;
+    for ( int i = 0; i < OlcOperationStats::HISTOGRAM_BUCKETS - 1; i++ )
+    {
+        bounds.add( YCPInteger( OlcOperationStats::histogramBounds[i] ) );
+    }
+
+    // only the combinations of operation and DN class that occurred
+    const OlcStatistics &stats = olc.getStatistics();
+    YCPMap operations;
+    for ( int op = 0; op < OlcStatistics::OPERATIONS; op++ )
+    {
+        YCPMap classes;
+        for ( int dc = 0; dc < OlcStatistics::DN_CLASSES; dc++ )
+        {
+            const OlcOperationStats &s = stats.get( (OlcStatistics::Operation) op,
+                                                    (OlcStatistics::DnClass) dc );
+            if ( s.count == 0 )
+            {
+                continue;
+            }
+            YCPList histogram;
+            for ( int i = 0; i < OlcOperationStats::HISTOGRAM_BUCKETS; i++ )
+            {
+                histogram.add( YCPInteger( s.histogram[i] ) );
+            }
+            YCPMap opStats;
+            opStats.add( YCPString("count"), YCPInteger( s.count ) );
+            opStats.add( YCPString("failed"), YCPInteger( s.failed ) );
+            opStats.add( YCPString("totalMicros"), YCPInteger( s.totalMicros ) );
+            opStats.add( YCPString("maxMicros"), YCPInteger( s.maxMicros ) );
+            opStats.add( YCPString("histogram"), histogram );
+            classes.add( YCPString( OlcStatistics::dnClassName( (OlcStatistics::DnClass) dc ) ), opStats );
+        }
+        if ( classes.size() > 0 )
+        {
+            operations.add( YCPString( OlcStatistics::operationName( (OlcStatistics::Operation) op ) ), classes );
+        }
+    }
+
+    YCPMap res;
+    res.add( YCPString("traffic"), trafficMap );
+    res.add( YCPString("histogramBounds"), bounds );
+    res.add( YCPString("operations"), operations );
+    return res;
+}
+
 YCPString SlapdConfigAgent::ConfigToLdif() const
 {
     y2milestone("ConfigToLdif");
@@ -2175,68 +2789,84 @@ static void initLdapParameters( const YCPValue &arg, std::string &targetUrl,
 bool SlapdConfigAgent::remoteBindCheck( const YCPValue &arg )
 {
     y2milestone("remoteBindCheck");
-    std::string targetUrl, binddn, bindpw, basedn;
-    bool starttls;
-    initLdapParameters(arg, targetUrl ,starttls, binddn, bindpw, basedn);
-    try 
-    {
-        LDAPConnection c( targetUrl );
-        if (starttls)
-        {
-            startTlsCheck(c);
-        }
-        bindCheck(c, binddn, bindpw);
-    }
-    catch( LDAPException e )
-    {
-        std::string details = e.getResultMsg();
-        if (! e.getServerMsg().empty() )
-        {
-            details += ": ";
-            details += e.getServerMsg();
-        }
-        lastError->add(YCPString("description"), YCPString( details ) );
-        y2milestone("Error connecting to the LDAP Server \"%s\". %s: %s", 
-                targetUrl.c_str(), 
-                lastError->value(YCPString("summary"))->asString()->value_cstr(),
-                details.c_str());
-        return false;
-    }
-    return true; 
+    return this->remoteCheck( arg, false );
 }
 
 bool SlapdConfigAgent::remoteSyncCheck( const YCPValue &arg )
 {
-    y2milestone("remoteBindCheck");
+    y2milestone("remoteSyncCheck");
+    return this->remoteCheck( arg, true );
+}
+
+/*
+ * Connects to the server (reusing a pooled connection if possible), does
+ * StartTLS on new connections, binds unless the connection is bound with
+ * the same credentials already and, if "checkSync" is set, tries an LDAPsync
+ * search. The connection goes back to the pool unless StartTLS failed, so
+ * that checking a corrected password doesn't need another TLS handshake.
+ */
+bool SlapdConfigAgent::remoteCheck( const YCPValue &arg, bool checkSync )
+{
     std::string targetUrl, binddn, bindpw, basedn;
     bool starttls;
     initLdapParameters(arg, targetUrl ,starttls, binddn, bindpw, basedn);
-    try 
+    OlcConnectionPool::Key key( targetUrl, starttls );
+    for ( int attempt = 0; ; attempt++ )
     {
-        LDAPConnection c( targetUrl );
-        if (starttls)
-        {
-            startTlsCheck(c);
+        LDAPAsynConnection *c = 0;
+        OlcConnectionPool::State state = OlcConnectionPool::NEW;
+        bool bound = false;
+        try 
+        {
+            // the credentials are checked by a bind every time, only the
+            // connection (with StartTLS done) is reused
+            c = connections.acquire( key, state );
+            if ( state == OlcConnectionPool::NEW && starttls )
+            {
+                startTlsCheck(*c);
+            }
+            bindCheck(*c, binddn, bindpw);
+            bound = true;
+            if ( checkSync )
+            {
+                syncCheck(*c, basedn );
+            }
+            connections.release( c );
         }
-        bindCheck(c, binddn, bindpw);
-        syncCheck(c, basedn );
-    }
-    catch( LDAPException e )
-    {
-        std::string details = e.getResultMsg();
-        if (! e.getServerMsg().empty() )
+        catch( LDAPException e )
         {
-            details += ": ";
-            details += e.getServerMsg();
+            int rc = e.getResultCode();
+            if ( state != OlcConnectionPool::NEW && attempt == 0 &&
+                 ( rc == LDAP_SERVER_DOWN || rc == LDAP_CONNECT_ERROR ) )
+            {
+                // closed by the server while it was in the pool
+                y2milestone("Pooled connection to \"%s\" lost, reconnecting", targetUrl.c_str() );
+                connections.discard( c );
+                continue;
+            }
+            if ( bound || rc == LDAP_INVALID_CREDENTIALS )
+            {
+                connections.release( c );
+            }
+            else
+            {
+                connections.discard( c );
+            }
+            std::string details = e.getResultMsg();
+            if (! e.getServerMsg().empty() )
+            {
+                details += ": ";
+                details += e.getServerMsg();
+            }
+            lastError->add(YCPString("description"), YCPString( details ) );
+            y2milestone("Error connecting to the LDAP Server \"%s\". %s: %s", 
+                    targetUrl.c_str(), 
+                    lastError->value(YCPString("summary"))->asString()->value_cstr(),
+                    details.c_str());
+            return false;
         }
-        lastError->add(YCPString("description"), YCPString( details ) );
-        y2milestone("Error connection to the LDAP Server \"%s\". %s: %s", 
-                targetUrl.c_str(), 
-                lastError->value(YCPString("summary"))->asString()->value_cstr(),
-                details.c_str());
-        return false;
+        return true; 
     }
-    return true; 
 }
 
 void initLdapParameters( const YCPValue &arg, 
@@ -2263,7 +2893,7 @@ void initLdapParameters( const YCPValue &arg,
 // Until the TLS parameters can't be setup correctly with LDAPC++
 // the start_tls check might return false positives
 // 
-void SlapdConfigAgent::startTlsCheck( LDAPConnection &c)
+void SlapdConfigAgent::startTlsCheck( LDAPAsynConnection &c)
 {
     try {
         c.start_tls();
@@ -2275,10 +2905,10 @@ void SlapdConfigAgent::startTlsCheck( LDAPConnection &c)
     }
 }
 
-void SlapdConfigAgent::bindCheck( LDAPConnection &c, const std::string &binddn, const std::string &bindpw)
+void SlapdConfigAgent::bindCheck( LDAPAsynConnection &c, const std::string &binddn, const std::string &bindpw)
 {
     try {
-        c.bind(binddn, bindpw);
+        OlcConfig::waitForResult( c.bind(binddn, bindpw) );
     }
     catch( LDAPException e )
     {
@@ -2287,7 +2917,7 @@ void SlapdConfigAgent::bindCheck( LDAPConnection &c, const std::string &binddn,
     }
 }
 
-void SlapdConfigAgent::syncCheck( LDAPConnection &c, const std::string &basedn )
+void SlapdConfigAgent::syncCheck( LDAPAsynConnection &c, const std::string &basedn )
 {
     try{
         // Simple LDAPSync Request Control (refreshOnly, no cookie)
@@ -2298,8 +2928,8 @@ void SlapdConfigAgent::syncCheck( LDAPConnection &c, const std::string &basedn )
         cs.add(syncCtrl);
         LDAPConstraints searchCons;
         searchCons.setServerControls( &cs );
-        c.search(basedn, LDAPConnection::SEARCH_BASE, "(objectclass=*)", 
-            StringList(), false, &searchCons );
+        OlcConfig::waitForResult( c.search(basedn, LDAPAsynConnection::SEARCH_BASE, "(objectclass=*)",
+            StringList(), false, &searchCons ) );
     }
     catch( LDAPException e )
     {
@@ -2322,19 +2952,23 @@ class CompareUri
         }
 };
 
-class CompareId
+void SlapdConfigAgent::updateServerIdAllocator()
 {
-    private:
-        int theId;
-
-    public:
-        CompareId( int val ) : theId(val) {}
-
-        bool operator() ( const OlcServerId &id ) const
-        {
-            return theId == id.getServerId();
-        }
-};
+    unsigned long version = globals->getAttributeVersion("olcServerID");
+    if ( serverIdGlobals == globals.get() && serverIdVersion == version )
+    {
+        return;
+    }
+    serverIdAllocator.clear();
+    std::vector<OlcServerId> serverIds = globals->getServerIds();
+    std::vector<OlcServerId>::const_iterator i;
+    for ( i = serverIds.begin(); i != serverIds.end(); i++ )
+    {
+        serverIdAllocator.markUsed( i->getServerId() );
+    }
+    serverIdGlobals = globals.get();
+    serverIdVersion = version;
+}
 
 void SlapdConfigAgent::assignServerId( const std::string &uri )
 {
@@ -2349,57 +2983,82 @@ void SlapdConfigAgent::assignServerId( const std::string &uri )
         return;
     }
 
-    for ( int j=1; j < 999; j++ )
+    this->updateServerIdAllocator();
+    int id = serverIdAllocator.getFreeId();
+    if ( id )
     {
-        found = find_if(serverIds.begin(), serverIds.end(), CompareId(j) );
-        if ( found == serverIds.end() )
-        {
-            y2milestone( "Free ServerId %d", j);
-            globals->addServerId( OlcServerId( j, uri ) );
-            return;
-        }
+        y2milestone( "Free ServerId %d", id );
+        globals->addServerId( OlcServerId( id, uri ) );
     }
 }
 
-class CompareRid
+/*
+ * Brings the rid allocator in sync with the syncrepl configuration. Only
+ * the databases that were added or removed, or whose olcSyncrepl attribute
+ * changed since the last call are looked at again.
+ */
+void SlapdConfigAgent::updateRidAllocator() const
 {
-    private:
-        int theRid;
+    std::map<const OlcDatabase*, UsedRids>::iterator j;
+    for ( j = usedRids.begin(); j != usedRids.end(); j++ )
+    {
+        j->second.seen = false;
+    }
 
-    public:
-        CompareRid( int val ) : theRid(val) {}
+    OlcDatabaseList::const_iterator i;
+    for ( i = databases.begin(); i != databases.end() ; i++ )
+    {
+        unsigned long version = (*i)->getAttributeVersion("olcSyncrepl");
+        j = usedRids.find( i->get() );
+        if ( j == usedRids.end() )
+        {
+            j = usedRids.insert( std::make_pair( i->get(), UsedRids() ) ).first;
+            j->second.version = 0;
+        }
+        else if ( j->second.version == version )
+        {
+            j->second.seen = true;
+            continue;
+        }
+        std::vector<int>::const_iterator k;
+        for ( k = j->second.rids.begin(); k != j->second.rids.end(); k++ )
+        {
+            ridAllocator.release( *k );
+        }
+        j->second.rids.clear();
+        j->second.seen = true;
 
-        bool operator() ( const boost::shared_ptr<OlcSyncRepl> sr ) const
+        OlcSyncReplList srl = (*i)->getSyncRepl();
+        OlcSyncReplList::const_iterator l;
+        for ( l = srl.begin(); l != srl.end(); l++ )
         {
-            return theRid == sr->getRid();
+            j->second.rids.push_back( (*l)->getRid() );
+            ridAllocator.markUsed( (*l)->getRid() );
         }
-};
+        j->second.version = version;
+    }
 
-int SlapdConfigAgent::getNextRid() const
-{
-    OlcDatabaseList::const_iterator i;
-    int rid;
-    for ( rid = 1; rid < 999; rid++ )
+    // forget about the databases that are gone
+    for ( j = usedRids.begin(); j != usedRids.end(); )
     {
-        bool isFree = true;
-
-        for ( i = databases.begin(); i != databases.end() ; i++ )
+        if ( j->second.seen )
         {
-            OlcSyncReplList::const_iterator found;
-            OlcSyncReplList srl = (*i)->getSyncRepl();
-            found = find_if( srl.begin(), srl.end(), CompareRid(rid) );
-            if ( found != srl.end() )
-            {
-                isFree = false;
-                break;
-            }
+            j++;
+            continue;
         }
-        if ( isFree )
+        std::vector<int>::const_iterator k;
+        for ( k = j->second.rids.begin(); k != j->second.rids.end(); k++ )
         {
-            return rid;
+            ridAllocator.release( *k );
         }
+        usedRids.erase( j++ );
     }
-    return 0;
+}
+
+int SlapdConfigAgent::getNextRid() const
+{
+    this->updateRidAllocator();
+    return ridAllocator.getFreeId();
 }
 
 bool SlapdConfigAgent::ycpMap2SyncRepl( const YCPMap &srMap, boost::shared_ptr<OlcSyncRepl> sr )
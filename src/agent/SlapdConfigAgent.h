@@ -12,10 +12,47 @@
 #include <scr/SCRAgent.h>
 #include <boost/shared_ptr.hpp>
 #include "slapd-config.h"
+
+// A traced SCR call, times are in microseconds of the monotonic clock
+struct SlapdTraceSpan
+{
+    const char *call;
+    std::string path;
+    long long start;
+    long long duration;
+    OlcTraffic traffic;
+};
+
+// Keeps the most recent spans in a ring buffer of fixed size. Recording a
+// span takes no lock and, once the path strings have grown, allocates
+// nothing. The SCR calls of an agent never run concurrently.
+class SlapdTraceBuffer
+{
+    public:
+        SlapdTraceBuffer( unsigned int capacity = 4096 );
+
+        void record( const char *call, const std::string &path,
+                     long long start, long long duration,
+                     const OlcTraffic &traffic );
+        void clear();
+
+        // the spans, oldest first, as a JSON array
+        std::string toJson() const;
+        // the spans in the Trace Event Format read by chrome://tracing
+        std::string toChromeTrace() const;
+
+    private:
+        const SlapdTraceSpan& span( unsigned long n ) const;
+        unsigned long size() const;
+
+        std::vector<SlapdTraceSpan> m_spans;
+        unsigned long m_recorded;
+};
+
 /**
  * @short An interface class between YaST2 and Ldap Agent
  */
-class SlapdConfigAgent : public SCRAgent {
+class SlapdConfigAgent : public SCRAgent, public OlcSyncHandler {
     public :
         SlapdConfigAgent();
         virtual ~SlapdConfigAgent();
@@ -37,6 +74,11 @@ class SlapdConfigAgent : public SCRAgent {
 
         virtual YCPValue otherCommand( const YCPTerm& term);
 
+        // OlcSyncHandler, applies the changes made by other clients to the
+        // configuration read so far
+        virtual void entryChanged( const LDAPEntry &entry );
+        virtual void entryDeleted( const std::string &dn );
+
     protected:
         YCPValue ReadGlobal( const YCPPath &path,
                             const YCPValue &arg = YCPNull(),
@@ -68,27 +110,69 @@ class SlapdConfigAgent : public SCRAgent {
                              const YCPValue &arg = YCPNull(),
                              const YCPValue &opt = YCPNull());
         YCPString ConfigToLdif() const;
+        OlcConfigEntryList pendingEntries() const;
+        YCPList CommitPlanToList() const;
+        YCPMap StatisticsToMap() const;
+        void readConfig();
+        OlcDatabaseList::iterator findDatabase( int index );
+        OlcDatabaseList::iterator findDatabaseByDn( const std::string &dn );
+        void indexDatabases();
+        void indexDatabases( std::size_t from );
+        void unindexDatabases( std::size_t from );
+        void processSyncChanges();
         bool remoteBindCheck( const YCPValue &arg );
         bool remoteSyncCheck( const YCPValue &arg );
-        void startTlsCheck( LDAPConnection &c);
-        void bindCheck( LDAPConnection &c, 
+        bool remoteCheck( const YCPValue &arg, bool checkSync );
+        void closeConnection();
+        void startTlsCheck( LDAPAsynConnection &c);
+        void bindCheck( LDAPAsynConnection &c, 
                         const std::string &binddn, 
                         const std::string &bindpw);
-        void syncCheck( LDAPConnection &c,
+        void syncCheck( LDAPAsynConnection &c,
                         const std::string &basedn );
         void assignServerId( const std::string &uri );
         int getNextRid() const;
+        void updateRidAllocator() const;
+        void updateServerIdAllocator();
         bool ycpMap2SyncRepl( const YCPMap &srMap, boost::shared_ptr<OlcSyncRepl> sr );
 
     private:
         YCPMap lastError;
-        LDAPConnection *m_lc;
+        LDAPAsynConnection *m_lc;
+        // m_lc is borrowed from the pool
+        bool m_lcPooled;
+        OlcConnectionPool connections;
         OlcConfig olc;
         OlcDatabaseList databases;
+        // positions in "databases" by entry index and (lowercased) DN. They
+        // are built on the first lookup after the list was replaced and
+        // reset dbIndexValid, databases that are added, removed or
+        // renumbered afterwards are updated in place with
+        // unindexDatabases() and indexDatabases().
+        typedef boost::unordered_map<int, std::size_t> DatabasePositions;
+        typedef boost::unordered_map<std::string, std::size_t> DatabaseNames;
+        DatabasePositions dbByIndex;
+        DatabaseNames dbByDn;
+        bool dbIndexValid;
         OlcSchemaList schema;
         std::list<std::string> deleteableSchema; 
         boost::shared_ptr<OlcGlobalConfig> globals;
         boost::shared_ptr<OlcSchemaConfig> schemaBase;
+
+        // the rids used by each database, with the version of the
+        // olcSyncrepl attribute they were taken from
+        struct UsedRids {
+            unsigned long version;
+            std::vector<int> rids;
+            bool seen;
+        };
+        mutable std::map<const OlcDatabase*, UsedRids> usedRids;
+        mutable OlcIdAllocator ridAllocator;
+        // version of olcServerID in "globals" the allocator was built from
+        unsigned long serverIdVersion;
+        const OlcGlobalConfig *serverIdGlobals;
+        OlcIdAllocator serverIdAllocator;
+        SlapdTraceBuffer traces;
 };
 
 #endif /* _SlapdConfigAgent_h */
@@ -0,0 +1,115 @@
+/*
+ * mock-ldap-server-main.cpp
+ *
+ * Runs MockLdapServer until SIGINT or SIGTERM.
+ *
+ * Usage: mock-ldap-server -s socket -f fixture.ldif [-l micros]
+ *                         [-L operation=micros]... [-w result.ldif]
+ *
+ * -l sets the latency of all operations, -L the one of a single operation
+ * (bind, search, modify, add, delete, extended or other). With -w the final
+ * state of the tree is written to an LDIF file on exit.
+ *
+ * $Id$
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <signal.h>
+#include <unistd.h>
+#include "mock-ldap-server.h"
+
+static int usage( const char *name )
+{
+    std::cerr << "usage: " << name << " -s socket -f fixture.ldif [-l micros]"
+              << " [-L operation=micros]... [-w result.ldif]" << std::endl;
+    return 1;
+}
+
+int main( int argc, char **argv )
+{
+    MockLdapServer server;
+    std::string socketPath, fixture, result;
+    int opt;
+    while ( ( opt = getopt( argc, argv, "s:f:l:L:w:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 's':
+                socketPath = optarg;
+                break;
+            case 'f':
+                fixture = optarg;
+                break;
+            case 'l':
+                server.setLatency( atoi( optarg ) );
+                break;
+            case 'L':
+            {
+                std::string arg( optarg );
+                size_t eq = arg.find( '=' );
+                MockLdapServer::Operation op;
+                if ( eq == std::string::npos ||
+                        ! MockLdapServer::operationByName( arg.substr( 0, eq ), op ) )
+                {
+                    return usage( argv[0] );
+                }
+                server.setLatency( op, atoi( arg.c_str() + eq + 1 ) );
+                break;
+            }
+            case 'w':
+                result = optarg;
+                break;
+            default:
+                return usage( argv[0] );
+        }
+    }
+    if ( socketPath.empty() || fixture.empty() )
+    {
+        return usage( argv[0] );
+    }
+
+    // the server threads inherit the mask, only sigwait() sees the signals
+    sigset_t signals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGTERM );
+    pthread_sigmask( SIG_BLOCK, &signals, 0 );
+
+    try
+    {
+        std::ifstream ldif( fixture.c_str() );
+        if ( ! ldif )
+        {
+            std::cerr << "cannot open " << fixture << std::endl;
+            return 1;
+        }
+        std::cerr << server.load( ldif ) << " entries loaded" << std::endl;
+        server.start( socketPath );
+    }
+    catch ( const std::runtime_error &e )
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << server.getUri() << std::endl;
+
+    int sig;
+    sigwait( &signals, &sig );
+    server.stop();
+
+    for ( int i = 0; i < MockLdapServer::OPERATIONS; i++ )
+    {
+        MockLdapServer::Operation op = (MockLdapServer::Operation) i;
+        std::cerr << MockLdapServer::operationName( op ) << ": "
+                  << server.getRequests( op ) << " requests" << std::endl;
+    }
+    if ( ! result.empty() )
+    {
+        std::ofstream out( result.c_str() );
+        server.dump( out );
+    }
+    return 0;
+}
@@ -0,0 +1,1723 @@
+/*
+ * mock-ldap-server.cpp
+ *
+ * See mock-ldap-server.h. Only the subset of LDAPv3 that libslapdconfig uses
+ * is implemented: Bind (every credential is accepted), Search, Modify, Add,
+ * Delete, Abandon and Unbind. Other requests fail with unwillingToPerform,
+ * matching of assertion values is case-insensitive for all attributes.
+ * Searches with the LDAP Sync control run a refresh phase (with a present
+ * phase if the cookie has a CSN) and, in refreshAndPersist mode, stay open
+ * to report later changes.
+ *
+ * $Id$
+ */
+
+#include <LdifReader.h>
+#include <LdifWriter.h>
+#include <LDAPEntry.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <stdexcept>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "mock-ldap-server.h"
+#include "slapd-config-ldap.h"
+
+// BER tags of the protocol operations
+#define LDAP_TAG_BIND_REQUEST       0x60
+#define LDAP_TAG_BIND_RESPONSE      0x61
+#define LDAP_TAG_UNBIND_REQUEST     0x42
+#define LDAP_TAG_SEARCH_REQUEST     0x63
+#define LDAP_TAG_SEARCH_ENTRY       0x64
+#define LDAP_TAG_SEARCH_DONE        0x65
+#define LDAP_TAG_MODIFY_REQUEST     0x66
+#define LDAP_TAG_MODIFY_RESPONSE    0x67
+#define LDAP_TAG_ADD_REQUEST        0x68
+#define LDAP_TAG_ADD_RESPONSE       0x69
+#define LDAP_TAG_DELETE_REQUEST     0x4a
+#define LDAP_TAG_DELETE_RESPONSE    0x6b
+#define LDAP_TAG_MODDN_REQUEST      0x6c
+#define LDAP_TAG_MODDN_RESPONSE     0x6d
+#define LDAP_TAG_COMPARE_REQUEST    0x6e
+#define LDAP_TAG_COMPARE_RESPONSE   0x6f
+#define LDAP_TAG_ABANDON_REQUEST    0x50
+#define LDAP_TAG_EXTENDED_REQUEST   0x77
+#define LDAP_TAG_EXTENDED_RESPONSE  0x78
+#define LDAP_TAG_INTERMEDIATE       0x79
+
+// LDAP Content Synchronization (RFC 4533)
+#define SYNC_REQUEST_OID "1.3.6.1.4.1.4203.1.9.1.1"
+#define SYNC_STATE_OID   "1.3.6.1.4.1.4203.1.9.1.2"
+#define SYNC_DONE_OID    "1.3.6.1.4.1.4203.1.9.1.3"
+#define SYNC_INFO_OID    "1.3.6.1.4.1.4203.1.9.1.4"
+#define SYNC_PRESENT 0
+#define SYNC_ADD     1
+#define SYNC_MODIFY  2
+#define SYNC_DELETE  3
+
+// result codes
+#define RC_SUCCESS                  0
+#define RC_PROTOCOL_ERROR           2
+#define RC_SIZELIMIT_EXCEEDED       4
+#define RC_UNAVAILABLE_CRITICAL_EXT 12
+#define RC_NO_SUCH_ATTRIBUTE        16
+#define RC_ATTRIBUTE_OR_VALUE_EXISTS 20
+#define RC_NO_SUCH_OBJECT           32
+#define RC_UNWILLING_TO_PERFORM     53
+#define RC_OBJECT_CLASS_VIOLATION   65
+#define RC_NOT_ALLOWED_ON_NONLEAF   66
+#define RC_ALREADY_EXISTS           68
+
+// Attributes only returned when requested by name or by "+"
+static const char *operational_attrs[] = { "structuralObjectClass", "entryUUID",
+        "entryCSN", "contextCSN", "creatorsName", "createTimestamp",
+        "modifiersName", "modifyTimestamp", "entryDN", "hasSubordinates",
+        "subschemaSubentry" };
+
+static std::string lower( const std::string &s )
+{
+    std::string l( s );
+    for ( std::string::iterator i = l.begin(); i != l.end(); i++ )
+    {
+        *i = tolower( *i );
+    }
+    return l;
+}
+
+static bool inList( const char **list, size_t size, const std::string &name )
+{
+    for ( size_t i = 0; i < size; i++ )
+    {
+        if ( strcasecmp( list[i], name.c_str() ) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isOperationalAttr( const std::string &name )
+{
+    return inList( operational_attrs,
+            sizeof(operational_attrs) / sizeof(const char*), name );
+}
+
+static long long monotonicMicros()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static std::string ldapMessage( int msgid, unsigned char tag, const std::string &op,
+        const std::string &controls = "" )
+{
+    return berElement( BER_SEQUENCE, berInteger( msgid ) + berElement( tag, op ) +
+            ( controls.empty() ? "" : berElement( BER_CONTROLS, controls ) ) );
+}
+
+static std::string control( const std::string &oid, const std::string &value )
+{
+    return berElement( BER_SEQUENCE, berElement( BER_OCTETSTRING, oid ) +
+            berElement( BER_OCTETSTRING, value ) );
+}
+
+static std::string ldapResult( int rc, const std::string &diag )
+{
+    return berInteger( rc, BER_ENUMERATED ) + berElement( BER_OCTETSTRING, "" )
+            + berElement( BER_OCTETSTRING, diag );
+}
+
+static unsigned char responseTag( unsigned char requestTag )
+{
+    switch ( requestTag )
+    {
+        case LDAP_TAG_BIND_REQUEST:     return LDAP_TAG_BIND_RESPONSE;
+        case LDAP_TAG_SEARCH_REQUEST:   return LDAP_TAG_SEARCH_DONE;
+        case LDAP_TAG_MODIFY_REQUEST:   return LDAP_TAG_MODIFY_RESPONSE;
+        case LDAP_TAG_ADD_REQUEST:      return LDAP_TAG_ADD_RESPONSE;
+        case LDAP_TAG_DELETE_REQUEST:   return LDAP_TAG_DELETE_RESPONSE;
+        case LDAP_TAG_MODDN_REQUEST:    return LDAP_TAG_MODDN_RESPONSE;
+        case LDAP_TAG_COMPARE_REQUEST:  return LDAP_TAG_COMPARE_RESPONSE;
+        default:                        return LDAP_TAG_EXTENDED_RESPONSE;
+    }
+}
+
+static MockLdapServer::Operation operationOf( unsigned char requestTag )
+{
+    switch ( requestTag )
+    {
+        case LDAP_TAG_BIND_REQUEST:     return MockLdapServer::BIND;
+        case LDAP_TAG_SEARCH_REQUEST:   return MockLdapServer::SEARCH;
+        case LDAP_TAG_MODIFY_REQUEST:   return MockLdapServer::MODIFY;
+        case LDAP_TAG_ADD_REQUEST:      return MockLdapServer::ADD;
+        case LDAP_TAG_DELETE_REQUEST:   return MockLdapServer::DELETE;
+        case LDAP_TAG_EXTENDED_REQUEST: return MockLdapServer::EXTENDED;
+        default:                        return MockLdapServer::OTHER;
+    }
+}
+
+/*
+ * DN and "{n}" index handling
+ */
+
+// lower cased, without the spaces around the separators
+static std::string normalizeDn( const std::string &dn )
+{
+    std::string n;
+    n.reserve( dn.size() );
+    bool escaped = false;
+    for ( std::string::const_iterator i = dn.begin(); i != dn.end(); i++ )
+    {
+        if ( ! escaped && *i == ' ' &&
+                ( n.empty() || *n.rbegin() == ',' || *n.rbegin() == '=' ) )
+        {
+            continue;
+        }
+        if ( ! escaped && *i == ' ' )
+        {
+            std::string::const_iterator j = i;
+            while ( j != dn.end() && *j == ' ' )
+            {
+                j++;
+            }
+            if ( j == dn.end() || *j == ',' || *j == '=' )
+            {
+                i = j - 1;
+                continue;
+            }
+        }
+        n += tolower( *i );
+        escaped = ! escaped && *i == '\\';
+    }
+    return n;
+}
+
+// position of the ',' ending the first RDN, npos for a single RDN
+static size_t rdnEnd( const std::string &dn )
+{
+    for ( size_t i = 0; i < dn.size(); i++ )
+    {
+        if ( dn[i] == '\\' )
+        {
+            i++;
+        }
+        else if ( dn[i] == ',' )
+        {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+static std::string parentDn( const std::string &dn )
+{
+    size_t end = rdnEnd( dn );
+    return end == std::string::npos ? std::string() : dn.substr( end + 1 );
+}
+
+static void splitRdn( const std::string &dn, std::string &type, std::string &value )
+{
+    std::string rdn = dn.substr( 0, rdnEnd( dn ) );
+    size_t eq = rdn.find( '=' );
+    type = rdn.substr( 0, eq );
+    value = eq == std::string::npos ? std::string() : rdn.substr( eq + 1 );
+}
+
+static bool isBelow( const std::string &ndn, const std::string &nbase )
+{
+    return nbase.empty() || ( ndn.size() > nbase.size() &&
+            ndn[ndn.size() - nbase.size() - 1] == ',' &&
+            ndn.compare( ndn.size() - nbase.size(), nbase.size(), nbase ) == 0 );
+}
+
+// splits "{n}rest", returns false if there is no index
+static bool splitIndex( const std::string &value, int &index, std::string &rest )
+{
+    if ( value.empty() || value[0] != '{' )
+    {
+        rest = value;
+        return false;
+    }
+    size_t close = value.find( '}' );
+    if ( close == std::string::npos || close == 1 )
+    {
+        rest = value;
+        return false;
+    }
+    char *end;
+    long n = strtol( value.c_str() + 1, &end, 10 );
+    if ( end != value.c_str() + close )
+    {
+        rest = value;
+        return false;
+    }
+    index = n;
+    rest = value.substr( close + 1 );
+    return true;
+}
+
+static std::string indexed( int index, const std::string &value )
+{
+    std::ostringstream s;
+    s << "{" << index << "}" << value;
+    return s.str();
+}
+
+static std::string stripIndex( const std::string &value )
+{
+    int index;
+    std::string rest;
+    splitIndex( value, index, rest );
+    return rest;
+}
+
+static void renumber( MockEntry::Values &values )
+{
+    for ( size_t i = 0; i < values.size(); i++ )
+    {
+        values[i] = indexed( i, stripIndex( values[i] ) );
+    }
+}
+
+// RDNs of entries using the X-ORDERED 'SIBLINGS' extension
+static bool isOrderedRdn( const std::string &ndn )
+{
+    std::string type, value;
+    splitRdn( ndn, type, value );
+    return type == "olcdatabase" || type == "olcoverlay" ||
+            ( type == "cn" && parentDn( ndn ) == "cn=schema,cn=config" );
+}
+
+static bool rdnLess( const std::string &a, const std::string &b )
+{
+    std::string typeA, valueA, typeB, valueB, restA, restB;
+    splitRdn( a, typeA, valueA );
+    splitRdn( b, typeB, valueB );
+    int indexA, indexB;
+    if ( typeA == typeB && splitIndex( valueA, indexA, restA ) &&
+            splitIndex( valueB, indexB, restB ) && indexA != indexB )
+    {
+        return indexA < indexB;
+    }
+    return a < b;
+}
+
+static void dnPath( const std::string &ndn, std::vector<std::string> &path )
+{
+    path.clear();
+    for ( std::string dn = ndn; ! dn.empty(); dn = parentDn( dn ) )
+    {
+        path.insert( path.begin(), dn.substr( 0, rdnEnd( dn ) ) );
+    }
+}
+
+// parents before their children, ordered siblings by their index
+static bool treeOrder( const MockEntry &a, const MockEntry &b )
+{
+    std::vector<std::string> pathA, pathB;
+    dnPath( normalizeDn( a.dn ), pathA );
+    dnPath( normalizeDn( b.dn ), pathB );
+    for ( size_t i = 0; i < pathA.size() && i < pathB.size(); i++ )
+    {
+        if ( pathA[i] != pathB[i] )
+        {
+            return rdnLess( pathA[i], pathB[i] );
+        }
+    }
+    return pathA.size() < pathB.size();
+}
+
+/*
+ * MockEntry
+ */
+MockEntry::Values* MockEntry::find( const std::string &type )
+{
+    for ( Attributes::iterator i = attrs.begin(); i != attrs.end(); i++ )
+    {
+        if ( strcasecmp( i->first.c_str(), type.c_str() ) == 0 )
+        {
+            return &i->second;
+        }
+    }
+    return 0;
+}
+
+const MockEntry::Values* MockEntry::find( const std::string &type ) const
+{
+    return const_cast<MockEntry*>( this )->find( type );
+}
+
+MockEntry::Values& MockEntry::get( const std::string &type )
+{
+    Values *values = this->find( type );
+    if ( ! values )
+    {
+        attrs.push_back( std::make_pair( type, Values() ) );
+        values = &attrs.back().second;
+    }
+    return *values;
+}
+
+void MockEntry::remove( const std::string &type )
+{
+    for ( Attributes::iterator i = attrs.begin(); i != attrs.end(); i++ )
+    {
+        if ( strcasecmp( i->first.c_str(), type.c_str() ) == 0 )
+        {
+            attrs.erase( i );
+            return;
+        }
+    }
+}
+
+static int findValue( const MockEntry::Values &values, const std::string &value )
+{
+    for ( size_t i = 0; i < values.size(); i++ )
+    {
+        if ( strcasecmp( values[i].c_str(), value.c_str() ) == 0 )
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Search filters
+ */
+static bool matchSubstrings( const std::string &value, const std::string &substrings )
+{
+    std::string v = lower( value );
+    size_t pos = 0;
+    BerReader r( substrings );
+    while ( ! r.atEnd() )
+    {
+        std::string part;
+        unsigned char tag = r.next( part );
+        part = lower( part );
+        if ( tag == 0x80 ) // initial
+        {
+            if ( v.compare( 0, part.size(), part ) != 0 )
+            {
+                return false;
+            }
+            pos = part.size();
+        }
+        else if ( tag == 0x81 ) // any
+        {
+            pos = v.find( part, pos );
+            if ( pos == std::string::npos )
+            {
+                return false;
+            }
+            pos += part.size();
+        }
+        else // final
+        {
+            return v.size() >= pos + part.size() &&
+                    v.compare( v.size() - part.size(), part.size(), part ) == 0;
+        }
+    }
+    return true;
+}
+
+static bool matchFilter( const MockEntry &e, const std::string &filter )
+{
+    BerReader r( filter );
+    std::string value;
+    unsigned char tag = r.next( value );
+    switch ( tag )
+    {
+        case 0xa0: // and
+        case 0xa1: // or
+        {
+            BerReader set( value );
+            while ( ! set.atEnd() )
+            {
+                if ( matchFilter( e, set.element() ) != ( tag == 0xa0 ) )
+                {
+                    return tag != 0xa0;
+                }
+            }
+            return tag == 0xa0;
+        }
+        case 0xa2: // not
+            return ! matchFilter( e, value );
+        case 0x87: // present
+            return strcasecmp( value.c_str(), "objectClass" ) == 0 || e.find( value );
+        case 0xa3: // equalityMatch
+        case 0xa5: // greaterOrEqual
+        case 0xa6: // lessOrEqual
+        case 0xa8: // approxMatch
+        case 0xa4: // substrings
+        {
+            BerReader ava( value );
+            std::string type = ava.next( BER_OCTETSTRING );
+            const MockEntry::Values *values = e.find( type );
+            std::string assertion = ava.element();
+            if ( tag != 0xa4 )
+            {
+                assertion = lower( BerReader( assertion ).next( BER_OCTETSTRING ) );
+            }
+            // entryDN (RFC 5020) is not stored with the entry
+            MockEntry::Values entryDn;
+            if ( strcasecmp( type.c_str(), "entryDN" ) == 0 )
+            {
+                entryDn.push_back( normalizeDn( e.dn ) );
+                values = &entryDn;
+                assertion = tag == 0xa4 ? assertion : normalizeDn( assertion );
+            }
+            for ( size_t i = 0; values && i < values->size(); i++ )
+            {
+                int cmp = lower( (*values)[i] ).compare( assertion );
+                if ( ( tag == 0xa4 && matchSubstrings( (*values)[i],
+                                BerReader( assertion ).next( BER_SEQUENCE ) ) ) ||
+                        ( ( tag == 0xa3 || tag == 0xa8 ) && cmp == 0 ) ||
+                        ( tag == 0xa5 && cmp >= 0 ) || ( tag == 0xa6 && cmp <= 0 ) )
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        default: // extensibleMatch is Undefined
+            return false;
+    }
+}
+
+static std::string encodeEntry( const MockEntry &e, const std::set<std::string> &attrs,
+        bool typesOnly );
+
+struct SearchRequest
+{
+    std::string base; // normalized
+    int scope;
+    long sizeLimit;
+    bool typesOnly;
+    std::string filter;
+    std::set<std::string> attrs;
+};
+
+static SearchRequest parseSearch( const std::string &request )
+{
+    SearchRequest s;
+    BerReader r( request );
+    s.base = normalizeDn( r.next( BER_OCTETSTRING ) );
+    s.scope = r.integer( BER_ENUMERATED );
+    r.integer( BER_ENUMERATED ); // derefAliases
+    s.sizeLimit = r.integer();
+    r.integer(); // timeLimit
+    s.typesOnly = r.integer( BER_BOOLEAN );
+    s.filter = r.element();
+    BerReader attrList( r.next( BER_SEQUENCE ) );
+    while ( ! attrList.atEnd() )
+    {
+        s.attrs.insert( lower( attrList.next( BER_OCTETSTRING ) ) );
+    }
+    return s;
+}
+
+static bool inScope( const std::string &ndn, const std::string &base, int scope )
+{
+    return scope == 0 ? ndn == base
+         : scope == 1 ? parentDn( ndn ) == base
+         : ndn == base || isBelow( ndn, base );
+}
+
+// the 16 octets of the string form of an entryUUID
+static std::string uuidOctets( const std::string &uuid )
+{
+    std::string octets, digits;
+    for ( size_t i = 0; i < uuid.size(); i++ )
+    {
+        if ( isxdigit( uuid[i] ) )
+        {
+            digits += uuid[i];
+        }
+        if ( digits.size() == 2 )
+        {
+            octets += (char) strtol( digits.c_str(), 0, 16 );
+            digits.clear();
+        }
+    }
+    return octets;
+}
+
+static std::string entryUuid( const MockEntry &e )
+{
+    const MockEntry::Values *uuid = e.find( "entryUUID" );
+    return uuid && ! uuid->empty() ? (*uuid)[0] : "";
+}
+
+// a SearchResultEntry with a Sync State control
+static std::string syncEntry( int msgid, const MockEntry &e, int state,
+        const std::set<std::string> &attrs, const std::string &cookie )
+{
+    std::set<std::string> none;
+    none.insert( "1.1" );
+    std::string value = berInteger( state, BER_ENUMERATED ) +
+            berElement( BER_OCTETSTRING, uuidOctets( entryUuid( e ) ) );
+    if ( ! cookie.empty() )
+    {
+        value += berElement( BER_OCTETSTRING, cookie );
+    }
+    bool content = state == SYNC_ADD || state == SYNC_MODIFY;
+    return ldapMessage( msgid, LDAP_TAG_SEARCH_ENTRY,
+            encodeEntry( e, content ? attrs : none, false ),
+            control( SYNC_STATE_OID, berElement( BER_SEQUENCE, value ) ) );
+}
+
+static std::string encodeEntry( const MockEntry &e, const std::set<std::string> &attrs,
+        bool typesOnly )
+{
+    bool all = attrs.empty() || attrs.count( "*" );
+    bool operational = attrs.count( "+" );
+    std::string list;
+    for ( MockEntry::Attributes::const_iterator i = e.attrs.begin();
+            i != e.attrs.end(); i++ )
+    {
+        bool op = isOperationalAttr( i->first );
+        if ( ! attrs.count( lower( i->first ) ) && ( op ? ! operational : ! all ) )
+        {
+            continue;
+        }
+        std::string values;
+        for ( size_t j = 0; ! typesOnly && j < i->second.size(); j++ )
+        {
+            values += berElement( BER_OCTETSTRING, i->second[j] );
+        }
+        list += berElement( BER_SEQUENCE, berElement( BER_OCTETSTRING, i->first )
+                + berElement( BER_SET, values ) );
+    }
+    return berElement( BER_OCTETSTRING, e.dn ) + berElement( BER_SEQUENCE, list );
+}
+
+static int applyModification( MockEntry &e, int op, const std::string &type,
+        const MockEntry::Values &values, std::string &diag )
+{
+    bool ordered = isXOrderedAttr( type );
+    switch ( op )
+    {
+        case 0: // add
+        {
+            if ( values.empty() )
+            {
+                diag = "modify/add: " + type + ": no values given";
+                return RC_PROTOCOL_ERROR;
+            }
+            MockEntry::Values &current = e.get( type );
+            for ( size_t i = 0; i < values.size(); i++ )
+            {
+                int index;
+                std::string value;
+                if ( ordered )
+                {
+                    if ( ! splitIndex( values[i], index, value ) ||
+                            index < 0 || index > (int) current.size() )
+                    {
+                        index = current.size();
+                    }
+                    current.insert( current.begin() + index, value );
+                    renumber( current );
+                }
+                else if ( findValue( current, values[i] ) >= 0 )
+                {
+                    diag = "modify/add: " + type + ": value #0 already exists";
+                    return RC_ATTRIBUTE_OR_VALUE_EXISTS;
+                }
+                else
+                {
+                    current.push_back( values[i] );
+                }
+            }
+            return RC_SUCCESS;
+        }
+        case 1: // delete
+        {
+            MockEntry::Values *current = e.find( type );
+            if ( ! current )
+            {
+                diag = "modify/delete: " + type + ": no such attribute";
+                return RC_NO_SUCH_ATTRIBUTE;
+            }
+            for ( size_t i = 0; i < values.size(); i++ )
+            {
+                int index = -1;
+                std::string value;
+                if ( ordered && splitIndex( values[i], index, value ) )
+                {
+                    if ( index < 0 || index >= (int) current->size() ||
+                            ( ! value.empty() && strcasecmp( value.c_str(),
+                                    stripIndex( (*current)[index] ).c_str() ) ) )
+                    {
+                        index = -1;
+                    }
+                }
+                else
+                {
+                    index = findValue( *current, values[i] );
+                    for ( size_t j = 0; ordered && index < 0 && j < current->size(); j++ )
+                    {
+                        if ( strcasecmp( stripIndex( (*current)[j] ).c_str(),
+                                    values[i].c_str() ) == 0 )
+                        {
+                            index = j;
+                        }
+                    }
+                }
+                if ( index < 0 )
+                {
+                    diag = "modify/delete: " + type + ": no such value";
+                    return RC_NO_SUCH_ATTRIBUTE;
+                }
+                current->erase( current->begin() + index );
+                if ( ordered )
+                {
+                    renumber( *current );
+                }
+            }
+            if ( values.empty() || current->empty() )
+            {
+                e.remove( type );
+            }
+            return RC_SUCCESS;
+        }
+        case 2: // replace
+        {
+            if ( values.empty() )
+            {
+                e.remove( type );
+                return RC_SUCCESS;
+            }
+            MockEntry::Values &current = e.get( type );
+            current = values;
+            if ( ordered )
+            {
+                std::vector<std::pair<int, std::string> > sorted;
+                for ( size_t i = 0; i < values.size(); i++ )
+                {
+                    int index;
+                    std::string value;
+                    if ( ! splitIndex( values[i], index, value ) )
+                    {
+                        index = i;
+                    }
+                    sorted.push_back( std::make_pair( index, value ) );
+                }
+                std::stable_sort( sorted.begin(), sorted.end() );
+                for ( size_t i = 0; i < sorted.size(); i++ )
+                {
+                    current[i] = sorted[i].second;
+                }
+                renumber( current );
+            }
+            return RC_SUCCESS;
+        }
+        default:
+            diag = "modify: unsupported modification type";
+            return RC_UNWILLING_TO_PERFORM;
+    }
+}
+
+/*
+ * MockLdapServer
+ */
+struct MockLdapServer::Connection
+{
+    MockLdapServer *server;
+    int fd;
+    pthread_t thread;
+    // responses and the messages of sync searches are sent by different
+    // threads
+    pthread_mutex_t writeMutex;
+};
+
+class MockLock
+{
+    public:
+        MockLock( pthread_mutex_t &mutex ) : m_mutex(mutex)
+        {
+            pthread_mutex_lock( &m_mutex );
+        }
+        ~MockLock()
+        {
+            pthread_mutex_unlock( &m_mutex );
+        }
+    private:
+        pthread_mutex_t &m_mutex;
+};
+
+MockLdapServer::MockLdapServer() : m_csnCount(0), m_uuidCount(0), m_listenFd(-1),
+        m_running(false)
+{
+    for ( int i = 0; i < OPERATIONS; i++ )
+    {
+        m_latency[i] = 0;
+        m_requests[i] = 0;
+    }
+    m_wakePipe[0] = m_wakePipe[1] = -1;
+    pthread_mutex_init( &m_mutex, 0 );
+}
+
+MockLdapServer::~MockLdapServer()
+{
+    this->stop();
+    pthread_mutex_destroy( &m_mutex );
+}
+
+int MockLdapServer::load( std::istream &ldif )
+{
+    MockLock lock( m_mutex );
+    LdifReader reader( ldif );
+    int count = 0;
+    while ( reader.readNextRecord() )
+    {
+        LDAPEntry le = reader.getEntryRecord();
+        MockEntry e;
+        e.dn = le.getDN();
+        const LDAPAttributeList *al = le.getAttributes();
+        for ( LDAPAttributeList::const_iterator i = al->begin(); i != al->end(); i++ )
+        {
+            MockEntry::Values &values = e.get( i->getName() );
+            const StringList &sl = i->getValues();
+            values.insert( values.end(), sl.begin(), sl.end() );
+            if ( isXOrderedAttr( i->getName() ) )
+            {
+                renumber( values );
+            }
+        }
+        if ( ! e.find( "entryCSN" ) )
+        {
+            this->touch( e );
+        }
+        if ( ! e.find( "entryUUID" ) )
+        {
+            e.get( "entryUUID" ).push_back( this->nextUuid() );
+        }
+        m_entries.push_back( e );
+        count++;
+    }
+    this->sortEntries();
+    // the contextCSN follows the newest entryCSN
+    int config = this->indexOf( "cn=config" );
+    if ( config >= 0 )
+    {
+        std::string newest;
+        for ( std::vector<MockEntry>::const_iterator i = m_entries.begin();
+                i != m_entries.end(); i++ )
+        {
+            const MockEntry::Values *csn = i->find( "entryCSN" );
+            if ( csn && ! csn->empty() )
+            {
+                newest = std::max( newest, (*csn)[0] );
+            }
+        }
+        m_entries[config].get( "contextCSN" ) = MockEntry::Values( 1, newest );
+    }
+    return count;
+}
+
+void MockLdapServer::dump( std::ostream &ldif )
+{
+    MockLock lock( m_mutex );
+    LdifWriter writer( ldif );
+    for ( std::vector<MockEntry>::const_iterator i = m_entries.begin();
+            i != m_entries.end(); i++ )
+    {
+        LDAPEntry le( i->dn );
+        for ( MockEntry::Attributes::const_iterator j = i->attrs.begin();
+                j != i->attrs.end(); j++ )
+        {
+            StringList values;
+            for ( MockEntry::Values::const_iterator k = j->second.begin();
+                    k != j->second.end(); k++ )
+            {
+                values.add( *k );
+            }
+            le.addAttribute( LDAPAttribute( j->first, values ) );
+        }
+        writer.writeRecord( le );
+    }
+}
+
+void MockLdapServer::setLatency( int micros )
+{
+    MockLock lock( m_mutex );
+    for ( int i = 0; i < OPERATIONS; i++ )
+    {
+        m_latency[i] = micros;
+    }
+}
+
+void MockLdapServer::setLatency( Operation op, int micros )
+{
+    MockLock lock( m_mutex );
+    m_latency[op] = micros;
+}
+
+const char* MockLdapServer::operationName( Operation op )
+{
+    static const char *names[] = { "bind", "search", "modify", "add", "delete",
+            "extended", "other" };
+    return names[op];
+}
+
+bool MockLdapServer::operationByName( const std::string &name, Operation &op )
+{
+    for ( int i = 0; i < OPERATIONS; i++ )
+    {
+        if ( strcasecmp( operationName( (Operation) i ), name.c_str() ) == 0 )
+        {
+            op = (Operation) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned long MockLdapServer::getRequests( Operation op ) const
+{
+    MockLock lock( m_mutex );
+    return m_requests[op];
+}
+
+std::string MockLdapServer::getUri() const
+{
+    std::string uri( "ldapi://" );
+    for ( std::string::const_iterator i = m_socketPath.begin();
+            i != m_socketPath.end(); i++ )
+    {
+        if ( isalnum( *i ) || *i == '.' || *i == '-' || *i == '_' )
+        {
+            uri += *i;
+        }
+        else
+        {
+            char escaped[4];
+            snprintf( escaped, sizeof(escaped), "%%%02X", (unsigned char) *i );
+            uri += escaped;
+        }
+    }
+    return uri;
+}
+
+void MockLdapServer::start( const std::string &socketPath )
+{
+    struct sockaddr_un addr;
+    if ( socketPath.size() >= sizeof(addr.sun_path) )
+    {
+        throw std::runtime_error( "socket path too long: " + socketPath );
+    }
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, socketPath.c_str() );
+    unlink( socketPath.c_str() );
+
+    m_listenFd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( m_listenFd < 0 || bind( m_listenFd, (struct sockaddr*) &addr, sizeof(addr) ) ||
+            listen( m_listenFd, 64 ) || pipe( m_wakePipe ) )
+    {
+        std::string err = strerror( errno );
+        if ( m_listenFd >= 0 )
+        {
+            close( m_listenFd );
+            m_listenFd = -1;
+        }
+        throw std::runtime_error( "cannot listen on " + socketPath + ": " + err );
+    }
+    m_socketPath = socketPath;
+    m_running = true;
+    pthread_create( &m_acceptThread, 0, acceptThread, this );
+}
+
+void MockLdapServer::stop()
+{
+    if ( ! m_running )
+    {
+        return;
+    }
+    // the pipe stays readable, which ends all the threads
+    if ( write( m_wakePipe[1], "x", 1 ) != 1 )
+    {
+        perror( "mock-ldap-server: write" );
+    }
+    pthread_join( m_acceptThread, 0 );
+    for ( std::set<Connection*>::iterator i = m_connections.begin();
+            i != m_connections.end(); i++ )
+    {
+        pthread_join( (*i)->thread, 0 );
+        pthread_mutex_destroy( &(*i)->writeMutex );
+        delete *i;
+    }
+    m_connections.clear();
+    close( m_listenFd );
+    close( m_wakePipe[0] );
+    close( m_wakePipe[1] );
+    unlink( m_socketPath.c_str() );
+    m_listenFd = m_wakePipe[0] = m_wakePipe[1] = -1;
+    m_running = false;
+}
+
+void* MockLdapServer::acceptThread( void *self )
+{
+    MockLdapServer *server = (MockLdapServer*) self;
+    for (;;)
+    {
+        struct pollfd fds[2] = { { server->m_listenFd, POLLIN, 0 },
+                                 { server->m_wakePipe[0], POLLIN, 0 } };
+        if ( poll( fds, 2, -1 ) < 0 && errno != EINTR )
+        {
+            break;
+        }
+        if ( fds[1].revents )
+        {
+            break;
+        }
+        if ( ! fds[0].revents )
+        {
+            continue;
+        }
+        int fd = accept( server->m_listenFd, 0, 0 );
+        if ( fd < 0 )
+        {
+            continue;
+        }
+        Connection *conn = new Connection;
+        conn->server = server;
+        conn->fd = fd;
+        pthread_mutex_init( &conn->writeMutex, 0 );
+        MockLock lock( server->m_mutex );
+        server->m_connections.insert( conn );
+        pthread_create( &conn->thread, 0, connectionThread, conn );
+    }
+    return 0;
+}
+
+void* MockLdapServer::connectionThread( void *conn )
+{
+    Connection *c = (Connection*) conn;
+    c->server->serve( c );
+    {
+        MockLock lock( c->server->m_mutex );
+        c->server->dropSyncSearches( c, -1 );
+    }
+    close( c->fd );
+    return 0;
+}
+
+static void sendAll( int fd, const std::string &out )
+{
+    for ( size_t sent = 0; sent < out.size(); )
+    {
+        ssize_t n = send( fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL );
+        if ( n < 0 && errno != EINTR )
+        {
+            return;
+        }
+        sent += n > 0 ? n : 0;
+    }
+}
+
+struct PendingRequest
+{
+    int msgid;
+    long long due;
+    std::string msg;
+};
+
+// Requests are timestamped when they arrive and answered in order once their
+// latency has passed, so requests sent without waiting for the previous
+// response overlap like they would on a slow network.
+void MockLdapServer::serve( Connection *conn )
+{
+    std::string buffer;
+    std::deque<PendingRequest> queue;
+    bool open = true;
+    while ( open || ! queue.empty() )
+    {
+        int timeout = -1;
+        if ( ! queue.empty() )
+        {
+            long long wait = queue.front().due - monotonicMicros();
+            timeout = wait > 0 ? ( wait + 999 ) / 1000 : 0;
+        }
+        struct pollfd fds[2] = { { conn->fd, (short) ( open ? POLLIN : 0 ), 0 },
+                                 { m_wakePipe[0], POLLIN, 0 } };
+        if ( poll( fds, 2, timeout ) < 0 && errno != EINTR )
+        {
+            return;
+        }
+        if ( fds[1].revents )
+        {
+            return;
+        }
+        if ( fds[0].revents )
+        {
+            char data[16384];
+            ssize_t n = read( conn->fd, data, sizeof(data) );
+            if ( n <= 0 )
+            {
+                return;
+            }
+            buffer.append( data, n );
+            long long now = monotonicMicros();
+            try
+            {
+                size_t size;
+                while ( open && ( size = BerReader::elementSize( buffer ) ) )
+                {
+                    PendingRequest request;
+                    request.msg = buffer.substr( 0, size );
+                    buffer.erase( 0, size );
+                    BerReader message( BerReader( request.msg ).next( BER_SEQUENCE ) );
+                    request.msgid = message.integer();
+                    std::string op;
+                    unsigned char tag = message.next( op );
+                    if ( tag == LDAP_TAG_UNBIND_REQUEST )
+                    {
+                        open = false;
+                    }
+                    else if ( tag == LDAP_TAG_ABANDON_REQUEST )
+                    {
+                        long abandoned = BerReader( berElement( BER_INTEGER, op ) ).integer();
+                        for ( std::deque<PendingRequest>::iterator i = queue.begin();
+                                i != queue.end(); i++ )
+                        {
+                            if ( i->msgid == abandoned )
+                            {
+                                queue.erase( i );
+                                break;
+                            }
+                        }
+                        MockLock lock( m_mutex );
+                        this->dropSyncSearches( conn, abandoned );
+                    }
+                    else
+                    {
+                        MockLock lock( m_mutex );
+                        Operation operation = operationOf( tag );
+                        m_requests[operation]++;
+                        request.due = now + m_latency[operation];
+                        queue.push_back( request );
+                    }
+                }
+            }
+            catch ( const std::runtime_error &e )
+            {
+                return; // malformed, drop the connection
+            }
+        }
+        while ( ! queue.empty() && queue.front().due <= monotonicMicros() )
+        {
+            this->handleMessage( conn, queue.front().msg );
+            queue.pop_front();
+        }
+    }
+}
+
+void MockLdapServer::handleMessage( Connection *conn, const std::string &msg )
+{
+    BerReader message( BerReader( msg ).next( BER_SEQUENCE ) );
+    int msgid = message.integer();
+    std::string request;
+    unsigned char tag = message.next( request );
+
+    std::string out, diag, syncControl;
+    int rc = RC_SUCCESS;
+    bool persist = false;
+    try
+    {
+        // only the LDAP Sync control of searches is supported, the other
+        // critical ones fail the operation
+        if ( ! message.atEnd() && message.peekTag() == BER_CONTROLS )
+        {
+            BerReader controls( message.next( BER_CONTROLS ) );
+            while ( ! controls.atEnd() )
+            {
+                BerReader control( controls.next( BER_SEQUENCE ) );
+                std::string oid = control.next( BER_OCTETSTRING );
+                bool critical = ! control.atEnd() && control.peekTag() == BER_BOOLEAN &&
+                        control.integer( BER_BOOLEAN );
+                if ( oid == SYNC_REQUEST_OID && tag == LDAP_TAG_SEARCH_REQUEST )
+                {
+                    syncControl = control.atEnd() ? "" : control.next( BER_OCTETSTRING );
+                }
+                else if ( critical )
+                {
+                    diag = "unsupported critical control " + oid;
+                    rc = RC_UNAVAILABLE_CRITICAL_EXT;
+                }
+            }
+        }
+        MockLock lock( m_mutex );
+        EntryStates before;
+        bool update = tag == LDAP_TAG_MODIFY_REQUEST || tag == LDAP_TAG_ADD_REQUEST ||
+                tag == LDAP_TAG_DELETE_REQUEST;
+        if ( update && ! m_syncSearches.empty() )
+        {
+            this->getEntryStates( before );
+        }
+        if ( rc == RC_SUCCESS )
+        {
+            switch ( tag )
+            {
+                case LDAP_TAG_BIND_REQUEST:
+                    break;
+                case LDAP_TAG_SEARCH_REQUEST:
+                    if ( ! syncControl.empty() )
+                    {
+                        rc = this->syncSearch( conn, msgid, request, syncControl, out, persist );
+                    }
+                    else
+                    {
+                        rc = this->search( msgid, request, out );
+                    }
+                    break;
+                case LDAP_TAG_MODIFY_REQUEST:
+                    rc = this->modify( request, diag );
+                    break;
+                case LDAP_TAG_ADD_REQUEST:
+                    rc = this->add( request, diag );
+                    break;
+                case LDAP_TAG_DELETE_REQUEST:
+                    rc = this->remove( request, diag );
+                    break;
+                case LDAP_TAG_EXTENDED_REQUEST:
+                    rc = RC_PROTOCOL_ERROR;
+                    diag = "unsupported extended operation";
+                    break;
+                default:
+                    rc = RC_UNWILLING_TO_PERFORM;
+                    diag = "operation not supported by the mock server";
+            }
+        }
+        if ( update && rc == RC_SUCCESS && ! m_syncSearches.empty() )
+        {
+            this->notifySyncSearches( before );
+        }
+        if ( persist )
+        {
+            // sent before any change made after the refresh can be reported
+            MockLock writeLock( conn->writeMutex );
+            sendAll( conn->fd, out );
+            return;
+        }
+    }
+    catch ( const std::runtime_error &e )
+    {
+        out.clear();
+        rc = RC_PROTOCOL_ERROR;
+        diag = e.what();
+    }
+    if ( tag == LDAP_TAG_SEARCH_REQUEST && ! syncControl.empty() && rc == RC_SUCCESS )
+    {
+        // refreshOnly
+        MockLock lock( m_mutex );
+        out += ldapMessage( msgid, LDAP_TAG_SEARCH_DONE, ldapResult( rc, diag ),
+                control( SYNC_DONE_OID, berElement( BER_SEQUENCE,
+                        berElement( BER_OCTETSTRING, this->syncCookie() ) ) ) );
+    }
+    else
+    {
+        out += ldapMessage( msgid, responseTag( tag ), ldapResult( rc, diag ) );
+    }
+    MockLock writeLock( conn->writeMutex );
+    sendAll( conn->fd, out );
+}
+
+int MockLdapServer::search( int msgid, const std::string &request, std::string &out )
+{
+    SearchRequest r = parseSearch( request );
+    if ( r.base.empty() && r.scope == 0 )
+    {
+        MockEntry rootDse;
+        rootDse.get( "objectClass" ).push_back( "top" );
+        rootDse.get( "configContext" ).push_back( "cn=config" );
+        rootDse.get( "supportedLDAPVersion" ).push_back( "3" );
+        rootDse.get( "supportedSASLMechanisms" ).push_back( "EXTERNAL" );
+        if ( matchFilter( rootDse, r.filter ) )
+        {
+            out += ldapMessage( msgid, LDAP_TAG_SEARCH_ENTRY,
+                    encodeEntry( rootDse, r.attrs, r.typesOnly ) );
+        }
+        return RC_SUCCESS;
+    }
+    if ( ! r.base.empty() && this->indexOf( r.base ) < 0 )
+    {
+        return RC_NO_SUCH_OBJECT;
+    }
+    long count = 0;
+    for ( std::vector<MockEntry>::const_iterator i = m_entries.begin();
+            i != m_entries.end(); i++ )
+    {
+        if ( inScope( normalizeDn( i->dn ), r.base, r.scope ) && matchFilter( *i, r.filter ) )
+        {
+            if ( r.sizeLimit && count++ == r.sizeLimit )
+            {
+                return RC_SIZELIMIT_EXCEEDED;
+            }
+            out += ldapMessage( msgid, LDAP_TAG_SEARCH_ENTRY,
+                    encodeEntry( *i, r.attrs, r.typesOnly ) );
+        }
+    }
+    return RC_SUCCESS;
+}
+
+/*
+ * The refresh phase of an LDAP Sync search. Without a cookie all entries are
+ * sent as added, with one only those changed after its CSN, the others as
+ * present. In refreshAndPersist mode the search stays open afterwards.
+ */
+int MockLdapServer::syncSearch( Connection *conn, int msgid, const std::string &request,
+        const std::string &control, std::string &out, bool &persist )
+{
+    SearchRequest r = parseSearch( request );
+    BerReader value( BerReader( control ).next( BER_SEQUENCE ) );
+    int mode = value.integer( BER_ENUMERATED );
+    std::string cookie;
+    if ( ! value.atEnd() && value.peekTag() == BER_OCTETSTRING )
+    {
+        cookie = value.next( BER_OCTETSTRING );
+    }
+    if ( mode != 1 && mode != 3 )
+    {
+        throw std::runtime_error( "invalid LDAP Sync mode" );
+    }
+    if ( this->indexOf( r.base ) < 0 )
+    {
+        return RC_NO_SUCH_OBJECT;
+    }
+    // the newest CSN of the cookie, e.g. "rid=000,csn=<csn>;<csn>"
+    std::string csn;
+    size_t pos = cookie.find( "csn=" );
+    if ( pos != std::string::npos )
+    {
+        size_t end = cookie.find( ',', pos );
+        std::istringstream csns( cookie.substr( pos + 4,
+                end == std::string::npos ? std::string::npos : end - pos - 4 ) );
+        std::string c;
+        while ( std::getline( csns, c, ';' ) )
+        {
+            csn = std::max( csn, c );
+        }
+    }
+    for ( std::vector<MockEntry>::const_iterator i = m_entries.begin();
+            i != m_entries.end(); i++ )
+    {
+        if ( inScope( normalizeDn( i->dn ), r.base, r.scope ) && matchFilter( *i, r.filter ) )
+        {
+            const MockEntry::Values *entryCsn = i->find( "entryCSN" );
+            bool changed = csn.empty() || ! entryCsn || entryCsn->empty() ||
+                    (*entryCsn)[0] > csn;
+            out += syncEntry( msgid, *i, changed ? SYNC_ADD : SYNC_PRESENT, r.attrs, "" );
+        }
+    }
+    if ( mode == 3 )
+    {
+        // refreshPresent, refreshDone keeps its default of TRUE
+        std::string info = berElement( 0xa2,
+                berElement( BER_OCTETSTRING, this->syncCookie() ) );
+        out += ldapMessage( msgid, LDAP_TAG_INTERMEDIATE,
+                berElement( 0x80, SYNC_INFO_OID ) + berElement( 0x81, info ) );
+        SyncSearch search = { conn, msgid, r.base, r.scope, r.filter, r.attrs };
+        m_syncSearches.push_back( search );
+        persist = true;
+    }
+    return RC_SUCCESS;
+}
+
+// all modifications are applied or none
+int MockLdapServer::modify( const std::string &request, std::string &diag )
+{
+    BerReader r( request );
+    int index = this->indexOf( r.next( BER_OCTETSTRING ) );
+    if ( index < 0 )
+    {
+        return RC_NO_SUCH_OBJECT;
+    }
+    MockEntry e( m_entries[index] );
+    BerReader changes( r.next( BER_SEQUENCE ) );
+    while ( ! changes.atEnd() )
+    {
+        BerReader change( changes.next( BER_SEQUENCE ) );
+        int op = change.integer( BER_ENUMERATED );
+        BerReader mod( change.next( BER_SEQUENCE ) );
+        std::string type = mod.next( BER_OCTETSTRING );
+        BerReader valueSet( mod.next( BER_SET ) );
+        MockEntry::Values values;
+        while ( ! valueSet.atEnd() )
+        {
+            values.push_back( valueSet.next( BER_OCTETSTRING ) );
+        }
+        int rc = applyModification( e, op, type, values, diag );
+        if ( rc != RC_SUCCESS )
+        {
+            return rc;
+        }
+    }
+    this->touch( e );
+    m_entries[index] = e;
+    return RC_SUCCESS;
+}
+
+int MockLdapServer::add( const std::string &request, std::string &diag )
+{
+    BerReader r( request );
+    MockEntry e;
+    e.dn = r.next( BER_OCTETSTRING );
+    BerReader attrs( r.next( BER_SEQUENCE ) );
+    while ( ! attrs.atEnd() )
+    {
+        BerReader attr( attrs.next( BER_SEQUENCE ) );
+        std::string type = attr.next( BER_OCTETSTRING );
+        BerReader valueSet( attr.next( BER_SET ) );
+        MockEntry::Values &values = e.get( type );
+        while ( ! valueSet.atEnd() )
+        {
+            values.push_back( valueSet.next( BER_OCTETSTRING ) );
+        }
+        if ( isXOrderedAttr( type ) )
+        {
+            renumber( values );
+        }
+    }
+    if ( this->indexOf( e.dn ) >= 0 )
+    {
+        return RC_ALREADY_EXISTS;
+    }
+    std::string parent = parentDn( e.dn );
+    if ( ! parent.empty() && this->indexOf( parent ) < 0 )
+    {
+        diag = "parent does not exist";
+        return RC_NO_SUCH_OBJECT;
+    }
+    if ( ! e.find( "objectClass" ) )
+    {
+        diag = "no objectClass attribute";
+        return RC_OBJECT_CLASS_VIOLATION;
+    }
+    this->insertSibling( e );
+    this->touch( e );
+    e.remove( "entryUUID" );
+    e.get( "entryUUID" ).push_back( this->nextUuid() );
+    m_entries.push_back( e );
+    this->sortEntries();
+    return RC_SUCCESS;
+}
+
+int MockLdapServer::remove( const std::string &request, std::string &diag )
+{
+    int index = this->indexOf( request );
+    if ( index < 0 )
+    {
+        return RC_NO_SUCH_OBJECT;
+    }
+    std::string ndn = normalizeDn( request );
+    if ( index + 1 < (int) m_entries.size() &&
+            isBelow( normalizeDn( m_entries[index + 1].dn ), ndn ) )
+    {
+        diag = "entry has children";
+        return RC_NOT_ALLOWED_ON_NONLEAF;
+    }
+    MockEntry e( m_entries[index] );
+    m_entries.erase( m_entries.begin() + index );
+    this->removeSibling( e );
+    this->sortEntries();
+    std::string timestamp;
+    this->nextCsn( timestamp );
+    return RC_SUCCESS;
+}
+
+int MockLdapServer::indexOf( const std::string &dn ) const
+{
+    std::map<std::string, int>::const_iterator i = m_index.find( normalizeDn( dn ) );
+    return i == m_index.end() ? -1 : i->second;
+}
+
+void MockLdapServer::sortEntries()
+{
+    std::stable_sort( m_entries.begin(), m_entries.end(), treeOrder );
+    m_index.clear();
+    for ( size_t i = 0; i < m_entries.size(); i++ )
+    {
+        m_index[normalizeDn( m_entries[i].dn )] = i;
+    }
+}
+
+// Gives a new X-ORDERED 'SIBLINGS' entry its index: appended without one,
+// otherwise the siblings at and after the index move up by one.
+void MockLdapServer::insertSibling( MockEntry &entry )
+{
+    std::string ndn = normalizeDn( entry.dn );
+    if ( ! isOrderedRdn( ndn ) )
+    {
+        return;
+    }
+    std::string type, value, name, nparent = parentDn( ndn );
+    splitRdn( entry.dn, type, value );
+    int index, next = 0;
+    bool hasIndex = splitIndex( value, index, name );
+    std::vector<std::pair<int, std::string> > siblings;
+    for ( std::vector<MockEntry>::const_iterator i = m_entries.begin();
+            i != m_entries.end(); i++ )
+    {
+        std::string sibling = normalizeDn( i->dn );
+        std::string sType, sValue, sName;
+        splitRdn( sibling, sType, sValue );
+        int sIndex;
+        if ( parentDn( sibling ) == nparent && strcasecmp( sType.c_str(), type.c_str() ) == 0 &&
+                splitIndex( sValue, sIndex, sName ) )
+        {
+            siblings.push_back( std::make_pair( sIndex, i->dn ) );
+            next = std::max( next, sIndex + 1 );
+        }
+    }
+    if ( ! hasIndex || index >= next )
+    {
+        index = next;
+    }
+    else
+    {
+        std::sort( siblings.rbegin(), siblings.rend() );
+        for ( size_t i = 0; i < siblings.size() && siblings[i].first >= index; i++ )
+        {
+            std::string sType, sValue, sName;
+            int sIndex;
+            splitRdn( siblings[i].second, sType, sValue );
+            splitIndex( sValue, sIndex, sName );
+            this->renameSubtree( siblings[i].second, sType + "=" +
+                    indexed( sIndex + 1, sName ) + siblings[i].second.substr(
+                    rdnEnd( siblings[i].second ) ) );
+        }
+    }
+    std::string rdnValue = indexed( index, name );
+    entry.dn = type + "=" + rdnValue + entry.dn.substr( rdnEnd( entry.dn ) );
+    MockEntry::Values &values = entry.get( type );
+    int old = findValue( values, value );
+    if ( old >= 0 )
+    {
+        values[old] = rdnValue;
+    }
+    else
+    {
+        values.push_back( rdnValue );
+    }
+}
+
+// The siblings after a deleted X-ORDERED 'SIBLINGS' entry move down by one
+void MockLdapServer::removeSibling( const MockEntry &entry )
+{
+    std::string ndn = normalizeDn( entry.dn );
+    if ( ! isOrderedRdn( ndn ) )
+    {
+        return;
+    }
+    std::string type, value, name, nparent = parentDn( ndn );
+    splitRdn( ndn, type, value );
+    int index;
+    if ( ! splitIndex( value, index, name ) )
+    {
+        return;
+    }
+    std::vector<std::pair<int, std::string> > siblings;
+    for ( std::vector<MockEntry>::const_iterator i = m_entries.begin();
+            i != m_entries.end(); i++ )
+    {
+        std::string sibling = normalizeDn( i->dn );
+        std::string sType, sValue, sName;
+        splitRdn( sibling, sType, sValue );
+        int sIndex;
+        if ( parentDn( sibling ) == nparent && sType == type &&
+                splitIndex( sValue, sIndex, sName ) && sIndex > index )
+        {
+            siblings.push_back( std::make_pair( sIndex, i->dn ) );
+        }
+    }
+    std::sort( siblings.begin(), siblings.end() );
+    for ( size_t i = 0; i < siblings.size(); i++ )
+    {
+        std::string sType, sValue, sName;
+        int sIndex;
+        splitRdn( siblings[i].second, sType, sValue );
+        splitIndex( sValue, sIndex, sName );
+        this->renameSubtree( siblings[i].second, sType + "=" +
+                indexed( sIndex - 1, sName ) + siblings[i].second.substr(
+                rdnEnd( siblings[i].second ) ) );
+    }
+}
+
+// renames the entry and its children, the RDN value of the entry follows
+void MockLdapServer::renameSubtree( const std::string &from, const std::string &to )
+{
+    std::string nfrom = normalizeDn( from );
+    std::string type, oldValue, newValue;
+    splitRdn( from, type, oldValue );
+    splitRdn( to, type, newValue );
+    for ( std::vector<MockEntry>::iterator i = m_entries.begin();
+            i != m_entries.end(); i++ )
+    {
+        std::string ndn = normalizeDn( i->dn );
+        if ( ndn == nfrom )
+        {
+            i->dn = to;
+            MockEntry::Values &values = i->get( type );
+            int old = findValue( values, oldValue );
+            if ( old >= 0 )
+            {
+                values[old] = newValue;
+            }
+        }
+        else if ( isBelow( ndn, nfrom ) )
+        {
+            // the RDNs below are kept as they are
+            size_t keep = 0;
+            for ( size_t rdns = std::count( ndn.begin(), ndn.end(), ',' ) -
+                    std::count( nfrom.begin(), nfrom.end(), ',' ); rdns; rdns-- )
+            {
+                keep += rdnEnd( i->dn.substr( keep ) ) + 1;
+            }
+            i->dn = i->dn.substr( 0, keep ) + to;
+        }
+    }
+}
+
+// a new CSN, which becomes the contextCSN of cn=config
+std::string MockLdapServer::nextCsn( std::string &timestamp )
+{
+    struct timeval tv;
+    gettimeofday( &tv, 0 );
+    struct tm tm;
+    gmtime_r( &tv.tv_sec, &tm );
+    char time[16], csn[48];
+    strftime( time, sizeof(time), "%Y%m%d%H%M%S", &tm );
+    snprintf( csn, sizeof(csn), "%s.%06ldZ#%06lx#000#000000", time,
+            (long) tv.tv_usec, m_csnCount++ & 0xffffff );
+    timestamp = std::string( time ) + "Z";
+
+    int config = this->indexOf( "cn=config" );
+    if ( config >= 0 )
+    {
+        m_entries[config].get( "contextCSN" ) = MockEntry::Values( 1, csn );
+    }
+    return csn;
+}
+
+// entryUUIDs in the form slapd uses, unique within the server
+std::string MockLdapServer::nextUuid()
+{
+    char uuid[40];
+    snprintf( uuid, sizeof(uuid), "%08lx-0000-1000-8000-%012lx",
+            (unsigned long) time( 0 ) & 0xffffffff, m_uuidCount++ );
+    return uuid;
+}
+
+std::string MockLdapServer::syncCookie() const
+{
+    std::string csn;
+    int config = this->indexOf( "cn=config" );
+    if ( config >= 0 && m_entries[config].find( "contextCSN" ) )
+    {
+        csn = (*m_entries[config].find( "contextCSN" ))[0];
+    }
+    return "rid=000,csn=" + csn;
+}
+
+void MockLdapServer::getEntryStates( EntryStates &states ) const
+{
+    for ( std::vector<MockEntry>::const_iterator i = m_entries.begin();
+            i != m_entries.end(); i++ )
+    {
+        const MockEntry::Values *csn = i->find( "entryCSN" );
+        states[entryUuid( *i )] = std::make_pair( i->dn,
+                csn && ! csn->empty() ? (*csn)[0] : std::string() );
+    }
+}
+
+// Reports the entries deleted, added, modified or renamed since "before"
+// to the persistent sync searches, deletes first.
+void MockLdapServer::notifySyncSearches( const EntryStates &before )
+{
+    EntryStates after;
+    this->getEntryStates( after );
+    std::string cookie = this->syncCookie();
+    for ( std::vector<SyncSearch>::const_iterator s = m_syncSearches.begin();
+            s != m_syncSearches.end(); s++ )
+    {
+        std::string out;
+        for ( EntryStates::const_iterator i = before.begin(); i != before.end(); i++ )
+        {
+            if ( ! after.count( i->first ) &&
+                    inScope( normalizeDn( i->second.first ), s->base, s->scope ) )
+            {
+                MockEntry deleted;
+                deleted.dn = i->second.first;
+                deleted.get( "entryUUID" ).push_back( i->first );
+                out += syncEntry( s->msgid, deleted, SYNC_DELETE, s->attrs, cookie );
+            }
+        }
+        for ( std::vector<MockEntry>::const_iterator i = m_entries.begin();
+                i != m_entries.end(); i++ )
+        {
+            std::string uuid = entryUuid( *i );
+            EntryStates::const_iterator old = before.find( uuid );
+            if ( ( old != before.end() && old->second == after[uuid] ) ||
+                    ! inScope( normalizeDn( i->dn ), s->base, s->scope ) ||
+                    ! matchFilter( *i, s->filter ) )
+            {
+                continue;
+            }
+            out += syncEntry( s->msgid, *i, old == before.end() ? SYNC_ADD : SYNC_MODIFY,
+                    s->attrs, cookie );
+        }
+        if ( ! out.empty() )
+        {
+            MockLock writeLock( s->conn->writeMutex );
+            sendAll( s->conn->fd, out );
+        }
+    }
+}
+
+// ends the sync search "msgid" of the connection, or all of them for -1
+void MockLdapServer::dropSyncSearches( Connection *conn, int msgid )
+{
+    for ( std::vector<SyncSearch>::iterator i = m_syncSearches.begin();
+            i != m_syncSearches.end(); )
+    {
+        if ( i->conn == conn && ( msgid == -1 || i->msgid == msgid ) )
+        {
+            i = m_syncSearches.erase( i );
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// updates the operational attributes of a changed entry
+void MockLdapServer::touch( MockEntry &entry )
+{
+    std::string timestamp, csn = this->nextCsn( timestamp );
+    entry.get( "entryCSN" ) = MockEntry::Values( 1, csn );
+    entry.get( "modifyTimestamp" ) = MockEntry::Values( 1, timestamp );
+    if ( ! entry.find( "createTimestamp" ) )
+    {
+        entry.get( "createTimestamp" ) = MockEntry::Values( 1, timestamp );
+    }
+    if ( normalizeDn( entry.dn ) == "cn=config" )
+    {
+        entry.get( "contextCSN" ) = MockEntry::Values( 1, csn );
+    }
+}
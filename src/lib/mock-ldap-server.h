@@ -0,0 +1,124 @@
+/*
+ * mock-ldap-server.h
+ *
+ * A minimal LDAPv3 server serving a cn=config tree from an LDIF fixture over
+ * a UNIX socket. It mimics the parts of back-config that libslapdconfig
+ * relies on ("{n}" ordering of values and sibling entries) and delays every
+ * response by a configurable latency, so that the library and the agent can
+ * be tested and measured without a running slapd. Like slapd with syncprov
+ * on the config database it answers LDAP Sync (RFC 4533) searches.
+ *
+ * $Id$
+ */
+
+#ifndef MOCK_LDAP_SERVER_H
+#define MOCK_LDAP_SERVER_H
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <iostream>
+#include <pthread.h>
+
+struct MockEntry
+{
+    typedef std::vector<std::string> Values;
+    typedef std::vector<std::pair<std::string, Values> > Attributes;
+
+    std::string dn;
+    Attributes attrs;
+
+    Values* find( const std::string &type );
+    const Values* find( const std::string &type ) const;
+    Values& get( const std::string &type );
+    void remove( const std::string &type );
+};
+
+class MockLdapServer
+{
+    public:
+        enum Operation { BIND, SEARCH, MODIFY, ADD, DELETE, EXTENDED, OTHER,
+                         OPERATIONS };
+
+        MockLdapServer();
+        ~MockLdapServer();
+
+        // reads the entries of the LDIF stream, returns the number of
+        // entries read
+        int load( std::istream &ldif );
+        void dump( std::ostream &ldif );
+
+        // latency in microseconds between the arrival of a request and its
+        // response, requests of one connection are answered in order
+        void setLatency( int micros );
+        void setLatency( Operation op, int micros );
+        static const char* operationName( Operation op );
+        static bool operationByName( const std::string &name, Operation &op );
+
+        // starts listening on the socket in a background thread, the URI to
+        // pass to LDAPConnection is "ldapi://" + the %-escaped socket path
+        void start( const std::string &socketPath );
+        void stop();
+        std::string getUri() const;
+
+        // number of requests received per operation
+        unsigned long getRequests( Operation op ) const;
+
+    private:
+        struct Connection;
+        // a refreshAndPersist search in its persist phase
+        struct SyncSearch
+        {
+            Connection *conn;
+            int msgid;
+            std::string base;
+            int scope;
+            std::string filter;
+            std::set<std::string> attrs;
+        };
+        // the DN and entryCSN of the entries by entryUUID
+        typedef std::map<std::string, std::pair<std::string, std::string> > EntryStates;
+
+        static void* acceptThread( void *self );
+        static void* connectionThread( void *conn );
+        void serve( Connection *conn );
+        void handleMessage( Connection *conn, const std::string &msg );
+
+        int search( int msgid, const std::string &request, std::string &out );
+        int syncSearch( Connection *conn, int msgid, const std::string &request,
+                        const std::string &control, std::string &out, bool &persist );
+        int modify( const std::string &request, std::string &diag );
+        int add( const std::string &request, std::string &diag );
+        int remove( const std::string &request, std::string &diag );
+
+        int indexOf( const std::string &dn ) const;
+        void sortEntries();
+        void insertSibling( MockEntry &entry );
+        void removeSibling( const MockEntry &entry );
+        void renameSubtree( const std::string &from, const std::string &to );
+        std::string nextCsn( std::string &timestamp );
+        void touch( MockEntry &entry );
+        std::string nextUuid();
+        std::string syncCookie() const;
+        void getEntryStates( EntryStates &states ) const;
+        void notifySyncSearches( const EntryStates &before );
+        void dropSyncSearches( Connection *conn, int msgid );
+
+        std::vector<MockEntry> m_entries;
+        std::map<std::string, int> m_index;
+        int m_latency[OPERATIONS];
+        unsigned long m_requests[OPERATIONS];
+        unsigned long m_csnCount;
+        unsigned long m_uuidCount;
+        std::vector<SyncSearch> m_syncSearches;
+
+        std::string m_socketPath;
+        int m_listenFd;
+        int m_wakePipe[2];
+        bool m_running;
+        pthread_t m_acceptThread;
+        std::set<Connection*> m_connections;
+        mutable pthread_mutex_t m_mutex;
+};
+
+#endif /* MOCK_LDAP_SERVER_H */
@@ -0,0 +1,460 @@
+/*
+ * slapd-config-bench.cpp
+ *
+ * Benchmarks for the parsing and diffing hot paths of libslapdconfig. The
+ * cn=config entries are generated, no slapd is needed. The end-to-end
+ * benchmarks run OlcConfig against an in-process MockLdapServer which
+ * answers each request after the given round trip time.
+ *
+ * Usage: slapd-config-bench [values per attribute] [round trip micros]
+ *
+ * $Id$
+ */
+
+#include <LDAPEntry.h>
+#include <LdifWriter.h>
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include "slapd-config.h"
+#include "mock-ldap-server.h"
+
+// every allocation of the process is counted
+static unsigned long s_allocations = 0;
+
+#if __cplusplus < 201103L
+void* operator new( std::size_t size ) throw( std::bad_alloc )
+#else
+void* operator new( std::size_t size )
+#endif
+{
+    s_allocations++;
+    void *p = malloc( size ? size : 1 );
+    if ( ! p )
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+#if __cplusplus < 201103L
+void* operator new[]( std::size_t size ) throw( std::bad_alloc )
+#else
+void* operator new[]( std::size_t size )
+#endif
+{
+    return operator new( size );
+}
+
+void operator delete( void *p ) throw()
+{
+    free( p );
+}
+
+void operator delete[]( void *p ) throw()
+{
+    free( p );
+}
+
+static void quietLogCallback( int level, const std::string &msg,
+            const char* file=0, const int line=0, const char* function=0)
+{
+}
+
+static long long monotonicNanos()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static std::string indexed( int index, const std::string &value )
+{
+    std::ostringstream s;
+    s << "{" << index << "}" << value;
+    return s.str();
+}
+
+static std::string acl( int i )
+{
+    std::ostringstream s;
+    switch ( i % 3 )
+    {
+        case 0:
+            s << "to dn.subtree=\"ou=people" << i << ",dc=example,dc=com\" attrs=userPassword"
+              << " by self write by dn.base=\"cn=admin" << i << ",dc=example,dc=com\" write"
+              << " by anonymous auth by * none";
+            break;
+        case 1:
+            s << "to filter=(objectClass=bench" << i << ") by group=\"cn=admins" << i
+              << ",ou=groups,dc=example,dc=com\" manage by users read break";
+            break;
+        default:
+            s << "to dn.base=\"cn=entry" << i << ",dc=example,dc=com\" by * read";
+    }
+    return s.str();
+}
+
+static std::string syncRepl( int i )
+{
+    std::ostringstream s;
+    s << "rid=" << ( i % 999 ) + 1 << " provider=ldap://ldap" << i << ".example.com"
+      << " searchbase=\"dc=example,dc=com\" type=refreshAndPersist bindmethod=simple"
+      << " binddn=\"cn=replicator,dc=example,dc=com\" credentials=secret"
+      << " retry=\"5 5 300 +\" timeout=3";
+    return s.str();
+}
+
+static std::string attributeType( int i )
+{
+    std::ostringstream s;
+    s << "( 1.3.6.1.4.1.7057.99." << i << " NAME 'benchAttr" << i << "'"
+      << " DESC 'generated attribute' EQUALITY caseIgnoreMatch"
+      << " SUBSTR caseIgnoreSubstringsMatch"
+      << " SYNTAX 1.3.6.1.4.1.1466.115.121.1.15 )";
+    return s.str();
+}
+
+static LDAPEntry databaseEntry( int count )
+{
+    LDAPEntry e( "olcDatabase={1}hdb,cn=config" );
+    e.addAttribute( LDAPAttribute( "objectclass", "olcDatabaseConfig" ) );
+    e.addAttribute( LDAPAttribute( "objectclass", "olcHdbConfig" ) );
+    e.addAttribute( LDAPAttribute( "olcDatabase", "{1}hdb" ) );
+    e.addAttribute( LDAPAttribute( "olcSuffix", "dc=example,dc=com" ) );
+    StringList acls, indexes, syncrepls;
+    for ( int i = 0; i < count; i++ )
+    {
+        acls.add( indexed( i, acl(i) ) );
+        std::ostringstream index;
+        index << "benchAttr" << i << ( i % 2 ? " eq,sub" : " pres,eq" );
+        indexes.add( index.str() );
+        syncrepls.add( indexed( i, syncRepl(i) ) );
+    }
+    e.addAttribute( LDAPAttribute( "olcAccess", acls ) );
+    e.addAttribute( LDAPAttribute( "olcDbIndex", indexes ) );
+    e.addAttribute( LDAPAttribute( "olcSyncrepl", syncrepls ) );
+    return e;
+}
+
+static LDAPEntry schemaEntry( int count )
+{
+    LDAPEntry e( "cn={4}bench,cn=schema,cn=config" );
+    e.addAttribute( LDAPAttribute( "objectclass", "olcSchemaConfig" ) );
+    e.addAttribute( LDAPAttribute( "cn", "{4}bench" ) );
+    StringList types;
+    for ( int i = 0; i < count; i++ )
+    {
+        types.add( indexed( i, attributeType(i) ) );
+    }
+    e.addAttribute( LDAPAttribute( "olcAttributeTypes", types ) );
+    e.addAttribute( LDAPAttribute( "olcObjectClasses",
+            "{0}( 1.3.6.1.4.1.7057.98.1 NAME 'benchObject' SUP top AUXILIARY MAY benchAttr0 )" ) );
+    return e;
+}
+
+class Benchmark
+{
+    public:
+        Benchmark( const std::string &name ) : m_name(name) {}
+        virtual ~Benchmark() {}
+
+        // runs the operation until at least 0.2 seconds have passed and
+        // prints the time and the allocations per operation
+        void run()
+        {
+            this->op(); // warm up
+            this->begin();
+            long long iterations = 0;
+            unsigned long allocations = s_allocations;
+            long long start = monotonicNanos();
+            long long elapsed = 0;
+            while ( elapsed < 200000000 )
+            {
+                for ( int i = 0; i < 16; i++ )
+                {
+                    this->op();
+                }
+                iterations += 16;
+                elapsed = monotonicNanos() - start;
+            }
+            allocations = s_allocations - allocations;
+            std::cout << std::left << std::setw(28) << m_name << std::right
+                      << std::setw(14) << elapsed / iterations << " ns/op"
+                      << std::setw(12) << allocations / iterations << " allocs/op"
+                      << std::endl;
+            this->report( iterations );
+        }
+
+    protected:
+        virtual void op() = 0;
+        virtual void begin() {}
+        virtual void report( long long iterations ) {}
+
+    private:
+        std::string m_name;
+};
+
+class ParseAcl : public Benchmark
+{
+    public:
+        ParseAcl( int count ) : Benchmark( "OlcAccess()" ), m_next(0)
+        {
+            for ( int i = 0; i < count; i++ )
+            {
+                m_acls.push_back( acl(i) );
+            }
+        }
+
+    protected:
+        virtual void op()
+        {
+            OlcAccess a( m_acls[m_next++ % m_acls.size()] );
+        }
+
+    private:
+        std::vector<std::string> m_acls;
+        unsigned int m_next;
+};
+
+class AclToString : public Benchmark
+{
+    public:
+        AclToString( int count ) : Benchmark( "OlcAccess::toAclString()" ), m_next(0)
+        {
+            for ( int i = 0; i < count; i++ )
+            {
+                m_acls.push_back( boost::shared_ptr<OlcAccess>( new OlcAccess( acl(i) ) ) );
+            }
+        }
+
+    protected:
+        virtual void op()
+        {
+            m_acls[m_next++ % m_acls.size()]->toAclString();
+        }
+
+    private:
+        std::vector<boost::shared_ptr<OlcAccess> > m_acls;
+        unsigned int m_next;
+};
+
+// one ACL in the middle is changed, one is added and one index is dropped
+class DiffDatabase : public Benchmark
+{
+    public:
+        DiffDatabase( int count )
+            : Benchmark( "entryDifftoMod()" ),
+              m_db( OlcDatabase::createFromLdapEntry( databaseEntry(count) ) )
+        {
+            OlcAccessList acls;
+            m_db->getAcl( acls );
+            acls[acls.size() / 2]->setFilter( "(objectClass=changed)" );
+            acls.push_back( boost::shared_ptr<OlcAccess>( new OlcAccess( acl(count) ) ) );
+            m_db->replaceAccessControl( acls );
+            const StringList &indexes = m_db->getStringValues( "olcDbIndex" );
+            StringList remaining;
+            StringList::const_iterator j = indexes.begin();
+            for ( j++; j != indexes.end(); j++ )
+            {
+                remaining.add( *j );
+            }
+            m_db->setStringValues( "olcDbIndex", remaining );
+        }
+
+    protected:
+        virtual void op()
+        {
+            m_db->entryDifftoMod();
+        }
+
+    private:
+        boost::scoped_ptr<OlcDatabase> m_db;
+};
+
+class DatabaseIndexes : public Benchmark
+{
+    public:
+        DatabaseIndexes( int count )
+            : Benchmark( "getDatabaseIndexes()" ),
+              m_db( databaseEntry(count) ) {}
+
+    protected:
+        virtual void op()
+        {
+            m_db.getDatabaseIndexes();
+        }
+
+    private:
+        OlcBdbDatabase m_db;
+};
+
+class SchemaAttributeTypes : public Benchmark
+{
+    public:
+        SchemaAttributeTypes( int count )
+            : Benchmark( "getAttributeTypes()" ),
+              m_schema( schemaEntry(count) ) {}
+
+    protected:
+        virtual void op()
+        {
+            m_schema.getAttributeTypes();
+        }
+
+    private:
+        OlcSchemaConfig m_schema;
+};
+
+// the tree served by the mock server
+static void configTree( std::ostream &ldif, int count )
+{
+    LdifWriter writer( ldif );
+    LDAPEntry global( "cn=config" );
+    global.addAttribute( LDAPAttribute( "objectclass", "olcGlobal" ) );
+    global.addAttribute( LDAPAttribute( "cn", "config" ) );
+    global.addAttribute( LDAPAttribute( "olcPidFile", "/var/run/slapd/slapd.pid" ) );
+    writer.writeRecord( global );
+    LDAPEntry schema( "cn=schema,cn=config" );
+    schema.addAttribute( LDAPAttribute( "objectclass", "olcSchemaConfig" ) );
+    schema.addAttribute( LDAPAttribute( "cn", "schema" ) );
+    writer.writeRecord( schema );
+    LDAPEntry bench( schemaEntry( count ) );
+    bench.setDN( "cn={0}bench,cn=schema,cn=config" );
+    bench.replaceAttribute( LDAPAttribute( "cn", "{0}bench" ) );
+    writer.writeRecord( bench );
+    const char *databases[] = { "{-1}frontend", "{0}config" };
+    for ( int i = 0; i < 2; i++ )
+    {
+        LDAPEntry db( std::string( "olcDatabase=" ) + databases[i] + ",cn=config" );
+        db.addAttribute( LDAPAttribute( "objectclass", "olcDatabaseConfig" ) );
+        db.addAttribute( LDAPAttribute( "olcDatabase", databases[i] ) );
+        writer.writeRecord( db );
+    }
+    writer.writeRecord( databaseEntry( count ) );
+}
+
+class RemoteBenchmark : public Benchmark
+{
+    public:
+        RemoteBenchmark( const std::string &name, const std::string &uri )
+            : Benchmark( name ), m_lc( uri ), m_config( &m_lc ), m_roundTrips(0)
+        {
+            OlcConfig::waitForResult( m_lc.bind() );
+        }
+
+    protected:
+        virtual void begin()
+        {
+            m_roundTrips = m_config.getTraffic().roundTrips;
+        }
+
+        virtual void report( long long iterations )
+        {
+            std::cout << std::setw(42)
+                      << ( m_config.getTraffic().roundTrips - m_roundTrips ) / iterations
+                      << " round trips/op" << std::endl;
+        }
+
+        LDAPAsynConnection m_lc;
+        OlcConfig m_config;
+
+    private:
+        unsigned long long m_roundTrips;
+};
+
+class ReadConfig : public RemoteBenchmark
+{
+    public:
+        ReadConfig( const std::string &uri )
+            : RemoteBenchmark( "OlcConfig::getConfig()", uri ) {}
+
+    protected:
+        virtual void op()
+        {
+            boost::shared_ptr<OlcGlobalConfig> globals;
+            OlcDatabaseList databases;
+            OlcSchemaList schema;
+            m_config.getConfig( globals, databases, schema );
+        }
+};
+
+// changes the filter of the first ACL of the database back and forth
+class UpdateDatabase : public RemoteBenchmark
+{
+    public:
+        UpdateDatabase( const std::string &uri )
+            : RemoteBenchmark( "OlcConfig::updateEntry()", uri ), m_next(0)
+        {
+            m_config.setLocalUpdates( true );
+            boost::shared_ptr<OlcGlobalConfig> globals;
+            OlcSchemaList schema;
+            m_config.getConfig( globals, m_databases, schema );
+        }
+
+    protected:
+        virtual void op()
+        {
+            OlcDatabase &db = *m_databases.back();
+            OlcAccessList acls;
+            db.getAcl( acls );
+            acls.front()->setFilter( m_next++ % 2 ? "(objectClass=a)" : "(objectClass=b)" );
+            db.replaceAccessControl( acls );
+            m_config.updateEntry( db );
+        }
+
+    private:
+        OlcDatabaseList m_databases;
+        unsigned int m_next;
+};
+
+int main( int argc, char **argv )
+{
+    int count = 2000;
+    int roundTrip = 1000;
+    if ( argc > 1 )
+    {
+        count = atoi( argv[1] );
+    }
+    if ( argc > 2 )
+    {
+        roundTrip = atoi( argv[2] );
+    }
+    if ( count < 1 || roundTrip < 0 )
+    {
+        std::cerr << "usage: " << argv[0] << " [values per attribute] [round trip micros]"
+                  << std::endl;
+        return 1;
+    }
+    OlcConfig::setLogCallback( quietLogCallback );
+    OlcConfig::setLogLevel( SLAPD_LOG_ERR );
+
+    std::cout << count << " values per attribute" << std::endl;
+    ParseAcl( count ).run();
+    AclToString( count ).run();
+    DiffDatabase( count ).run();
+    DatabaseIndexes( count ).run();
+    SchemaAttributeTypes( count ).run();
+
+    std::ostringstream socketPath;
+    socketPath << "/tmp/slapd-config-bench." << getpid() << ".sock";
+    std::stringstream ldif;
+    configTree( ldif, count );
+    MockLdapServer server;
+    server.load( ldif );
+    server.setLatency( roundTrip );
+    server.start( socketPath.str() );
+
+    std::cout << roundTrip << " us round trip time" << std::endl;
+    ReadConfig( server.getUri() ).run();
+    UpdateDatabase( server.getUri() ).run();
+    server.stop();
+    return 0;
+}
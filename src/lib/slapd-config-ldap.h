@@ -0,0 +1,245 @@
+/*
+ * slapd-config-ldap.h
+ *
+ * Protocol helpers shared by libslapdconfig and the mock LDAP server: BER
+ * encoding and decoding of the controls and extended operations that
+ * libldapcpp doesn't handle and the attributes back-config keeps in
+ * X-ORDERED 'VALUES' order.
+ *
+ * $Id$
+ */
+
+#ifndef SLAPD_CONFIG_LDAP_H
+#define SLAPD_CONFIG_LDAP_H
+#include <string>
+#include <stdexcept>
+#include <strings.h>
+
+#define BER_BOOLEAN     0x01
+#define BER_INTEGER     0x02
+#define BER_OCTETSTRING 0x04
+#define BER_ENUMERATED  0x0a
+#define BER_SEQUENCE    0x30
+#define BER_SET         0x31
+#define BER_CONTROLS    0xa0
+
+// Attributes using the X-ORDERED 'VALUES' extension, the values of these
+// carry a "{n}" prefix denoting their position
+static const char * const x_ordered_attrs[] = { "olcAccess", "olcLimits", "olcSyncrepl",
+        "olcAuthzRegexp", "olcDbConfig", "olcAttributeTypes", "olcObjectClasses",
+        "olcObjectIdentifier", "olcLdapSyntaxes", "olcDitContentRules" };
+
+inline bool isXOrderedAttr( const std::string &name )
+{
+    for ( size_t i = 0; i < sizeof(x_ordered_attrs) / sizeof(const char*); i++ )
+    {
+        if ( strcasecmp( x_ordered_attrs[i], name.c_str() ) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * BER encoding and decoding, only definite lengths and single byte tags
+ */
+class BerReader
+{
+    public:
+        BerReader( const std::string &data ) : m_data(data), m_pos(0) {}
+
+        bool atEnd() const
+        {
+            return m_pos >= m_data.size();
+        }
+
+        unsigned char peekTag() const
+        {
+            if ( this->atEnd() )
+            {
+                throw std::runtime_error( "BER element expected" );
+            }
+            return m_data[m_pos];
+        }
+
+        // reads the next element, returns its tag and its contents
+        unsigned char next( std::string &value )
+        {
+            unsigned char tag = this->peekTag();
+            size_t start, length;
+            this->header( start, length );
+            value = m_data.substr( start, length );
+            m_pos = start + length;
+            return tag;
+        }
+
+        std::string next( unsigned char tag )
+        {
+            std::string value;
+            if ( this->next( value ) != tag )
+            {
+                throw std::runtime_error( "unexpected BER tag" );
+            }
+            return value;
+        }
+
+        // the next element including tag and length
+        std::string element()
+        {
+            size_t begin = m_pos, start, length;
+            this->header( start, length );
+            m_pos = start + length;
+            return m_data.substr( begin, m_pos - begin );
+        }
+
+        long integer( unsigned char tag = BER_INTEGER )
+        {
+            std::string value = this->next( tag );
+            if ( value.empty() || value.size() > sizeof(long) )
+            {
+                throw std::runtime_error( "invalid BER integer" );
+            }
+            long v = ( value[0] & 0x80 ) ? -1 : 0;
+            for ( size_t i = 0; i < value.size(); i++ )
+            {
+                v = ( v << 8 ) | (unsigned char) value[i];
+            }
+            return v;
+        }
+
+        // size of the first complete element of data, 0 if it is incomplete
+        static size_t elementSize( const std::string &data )
+        {
+            if ( data.size() < 2 )
+            {
+                return 0;
+            }
+            size_t length = (unsigned char) data[1];
+            size_t headerSize = 2;
+            if ( length & 0x80 )
+            {
+                size_t bytes = length & 0x7f;
+                if ( bytes == 0 || bytes > 4 )
+                {
+                    throw std::runtime_error( "unsupported BER length" );
+                }
+                if ( data.size() < 2 + bytes )
+                {
+                    return 0;
+                }
+                length = 0;
+                for ( size_t i = 0; i < bytes; i++ )
+                {
+                    length = ( length << 8 ) | (unsigned char) data[2 + i];
+                }
+                headerSize += bytes;
+            }
+            return data.size() < headerSize + length ? 0 : headerSize + length;
+        }
+
+    private:
+        void header( size_t &start, size_t &length )
+        {
+            if ( m_pos + 2 > m_data.size() )
+            {
+                throw std::runtime_error( "truncated BER element" );
+            }
+            size_t headerSize = 2;
+            length = (unsigned char) m_data[m_pos + 1];
+            if ( length & 0x80 )
+            {
+                size_t bytes = length & 0x7f;
+                if ( bytes == 0 || bytes > 4 || m_pos + 2 + bytes > m_data.size() )
+                {
+                    throw std::runtime_error( "unsupported BER length" );
+                }
+                length = 0;
+                for ( size_t i = 0; i < bytes; i++ )
+                {
+                    length = ( length << 8 ) | (unsigned char) m_data[m_pos + 2 + i];
+                }
+                headerSize += bytes;
+            }
+            start = m_pos + headerSize;
+            if ( start + length > m_data.size() )
+            {
+                throw std::runtime_error( "truncated BER element" );
+            }
+        }
+
+        std::string m_data;
+        size_t m_pos;
+};
+
+inline std::string berLength( std::string::size_type length )
+{
+    std::string s;
+    if ( length < 0x80 )
+    {
+        s += (char) length;
+    }
+    else
+    {
+        std::string bytes;
+        for ( ; length; length >>= 8 )
+        {
+            bytes.insert( bytes.begin(), (char) ( length & 0xff ) );
+        }
+        s += (char) ( 0x80 | bytes.size() );
+        s += bytes;
+    }
+    return s;
+}
+
+inline std::string berElement( unsigned char tag, const std::string &value )
+{
+    return std::string( 1, (char) tag ) + berLength( value.size() ) + value;
+}
+
+inline std::string berInteger( long v, unsigned char tag = BER_INTEGER )
+{
+    std::string bytes;
+    bool done;
+    do
+    {
+        bytes.insert( bytes.begin(), (char) ( v & 0xff ) );
+        v >>= 8;
+        done = ( v == 0 && ! ( bytes[0] & 0x80 ) ) || ( v == -1 && ( bytes[0] & 0x80 ) );
+    } while ( ! done );
+    return berElement( tag, bytes );
+}
+
+// reads the next TLV element from "ber" starting at "pos", returns false
+// instead of throwing if it is truncated
+inline bool berGetElement( const std::string &ber, std::string::size_type &pos,
+                           unsigned char &tag, std::string &value )
+{
+    if ( pos + 2 > ber.size() )
+    {
+        return false;
+    }
+    tag = ber[pos++];
+    std::string::size_type len = (unsigned char) ber[pos++];
+    if ( len & 0x80 )
+    {
+        int octets = len & 0x7f;
+        if ( octets > 4 || pos + octets > ber.size() )
+        {
+            return false;
+        }
+        for ( len = 0; octets; octets-- )
+        {
+            len = (len << 8) | (unsigned char) ber[pos++];
+        }
+    }
+    if ( pos + len > ber.size() )
+    {
+        return false;
+    }
+    value = ber.substr( pos, len );
+    pos += len;
+    return true;
+}
+
+#endif /* SLAPD_CONFIG_LDAP_H */
@@ -0,0 +1,359 @@
+/*
+ * slapd-config-test.cpp
+ *
+ * Checks of OlcConfig against an in-process MockLdapServer serving the
+ * cn=config tree of testsuite/mock-config.ldif. Every test starts a server
+ * of its own on the unchanged fixture. Run by "make check".
+ *
+ * Usage: slapd-config-test [fixture], the default is $MOCK_FIXTURE
+ *
+ * $Id$
+ */
+
+#include <boost/scoped_ptr.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include "slapd-config.h"
+#include "mock-ldap-server.h"
+
+static int s_failures = 0;
+
+#define CHECK( cond ) \
+    do { \
+        if ( ! (cond) ) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " << #cond \
+                      << " failed" << std::endl; \
+            s_failures++; \
+        } \
+    } while ( 0 )
+
+static void quietLogCallback( int level, const std::string &msg,
+            const char* file=0, const int line=0, const char* function=0)
+{
+    if ( level == SLAPD_LOG_ERR )
+    {
+        std::cerr << msg << std::endl;
+    }
+}
+
+// a MockLdapServer serving the fixture and a bound connection to it
+class MockSetup
+{
+    public:
+        MockSetup( const std::string &fixture )
+        {
+            std::ifstream ldif( fixture.c_str() );
+            if ( m_server.load( ldif ) == 0 )
+            {
+                throw std::runtime_error( "Can't read " + fixture );
+            }
+            std::ostringstream socketPath;
+            socketPath << "/tmp/slapd-config-test." << getpid() << ".sock";
+            m_server.start( socketPath.str() );
+        }
+
+        ~MockSetup()
+        {
+            m_server.stop();
+        }
+
+        // a new connection, the caller deletes it
+        LDAPAsynConnection* connect()
+        {
+            LDAPAsynConnection *lc = new LDAPAsynConnection( m_server.getUri() );
+            OlcConfig::waitForResult( lc->bind() );
+            return lc;
+        }
+
+    private:
+        MockLdapServer m_server;
+};
+
+static void readConfig( MockSetup &setup, boost::shared_ptr<OlcGlobalConfig> &globals,
+                        OlcDatabaseList &databases, OlcSchemaList &schema )
+{
+    boost::scoped_ptr<LDAPAsynConnection> lc( setup.connect() );
+    OlcConfig config( lc.get() );
+    config.getConfig( globals, databases, schema );
+}
+
+// number of operations of the plan
+static unsigned int planSize( const OlcCommitPlan &plan )
+{
+    unsigned int size = 0;
+    for ( unsigned int i = 0; i < plan.getWaves().size(); i++ )
+    {
+        size += plan.getWaves()[i].size();
+    }
+    return size;
+}
+
+static void testGetConfig( const std::string &fixture )
+{
+    MockSetup setup( fixture );
+    boost::shared_ptr<OlcGlobalConfig> globals;
+    OlcDatabaseList databases;
+    OlcSchemaList schema;
+    readConfig( setup, globals, databases, schema );
+
+    CHECK( globals );
+    CHECK( globals && globals->getStringValue( "olcPidFile" ) == "/var/run/slapd/slapd.pid" );
+    CHECK( databases.size() == 3 );
+    if ( databases.size() != 3 )
+    {
+        return;
+    }
+    CHECK( databases[0]->getEntryIndex() == -1 );
+    CHECK( databases[1]->getType() == "config" );
+    CHECK( databases[2]->getType() == "hdb" );
+    CHECK( databases[2]->getSuffix() == "dc=example,dc=com" );
+    CHECK( databases[2]->getOverlays().size() == 1 );
+    OlcAccessList acls;
+    CHECK( databases[2]->getAcl( acls ) && acls.size() == 3 );
+    if ( acls.size() == 3 )
+    {
+        // changing the returned ACLs leaves the database alone
+        const std::string acl = acls[0]->toAclString();
+        acls[0]->setFilter( "(objectClass=person)" );
+        OlcAccessList again;
+        databases[2]->getAcl( again );
+        CHECK( again.size() == 3 && again[0]->toAclString() == acl );
+    }
+    CHECK( ! schema.empty() );
+}
+
+// a modification and an added database written through an OlcCommitPlan
+// read back the same from the server
+static void testCommitPlan( const std::string &fixture )
+{
+    MockSetup setup( fixture );
+    boost::scoped_ptr<LDAPAsynConnection> lc( setup.connect() );
+    OlcConfig config( lc.get() );
+    boost::shared_ptr<OlcGlobalConfig> globals;
+    OlcDatabaseList databases;
+    OlcSchemaList schema;
+    config.getConfig( globals, databases, schema );
+    CHECK( databases.size() == 3 );
+    if ( databases.size() != 3 )
+    {
+        return;
+    }
+
+    databases[2]->setRootDn( "cn=admin,dc=example,dc=com" );
+    boost::shared_ptr<OlcBdbDatabase> db( new OlcBdbDatabase( "hdb" ) );
+    db->setIndex( 2 );
+    db->setSuffix( "dc=example,dc=org" );
+    db->setDirectory( "/var/lib/ldap/example.org" );
+    databases.push_back( db );
+
+    OlcConfigEntryList entries;
+    entries.push_back( globals.get() );
+    for ( unsigned int i = 0; i < databases.size(); i++ )
+    {
+        entries.push_back( databases[i].get() );
+    }
+    OlcCommitPlan plan( entries );
+    CHECK( planSize( plan ) == 2 );
+    config.updateEntries( plan );
+    CHECK( db->getDn() == "olcDatabase={2}hdb,cn=config" );
+    CHECK( ! databases[2]->hasChanges() );
+
+    OlcDatabaseList reread;
+    readConfig( setup, globals, reread, schema );
+    CHECK( reread.size() == 4 );
+    if ( reread.size() != 4 )
+    {
+        return;
+    }
+    CHECK( reread[2]->getStringValue( "olcRootDN" ) == "cn=admin,dc=example,dc=com" );
+    CHECK( reread[2]->getSuffix() == "dc=example,dc=com" );
+    CHECK( reread[3]->getDn() == "olcDatabase={2}hdb,cn=config" );
+    CHECK( reread[3]->getSuffix() == "dc=example,dc=org" );
+    CHECK( reread[3]->getStringValue( "olcDbDirectory" ) == "/var/lib/ldap/example.org" );
+
+    // nothing is left to write
+    entries.clear();
+    for ( unsigned int i = 0; i < reread.size(); i++ )
+    {
+        entries.push_back( reread[i].get() );
+    }
+    CHECK( planSize( OlcCommitPlan( entries ) ) == 0 );
+}
+
+// commits the databases in the order of the agent's pendingEntries(), a
+// deleted database after its overlays
+static void commitDatabases( OlcConfig &config, OlcDatabaseList &databases )
+{
+    OlcConfigEntryList entries;
+    for ( unsigned int i = 0; i < databases.size(); i++ )
+    {
+        if ( ! databases[i]->isDeletedEntry() )
+        {
+            entries.push_back( databases[i].get() );
+        }
+        OlcOverlayList &overlays = databases[i]->getOverlays();
+        for ( unsigned int j = 0; j < overlays.size(); j++ )
+        {
+            entries.push_back( overlays[j].get() );
+        }
+        if ( databases[i]->isDeletedEntry() )
+        {
+            entries.push_back( databases[i].get() );
+        }
+    }
+    config.updateEntries( OlcCommitPlan( entries ) );
+}
+
+// what WriteDatabase does for a delete
+static void deleteDatabase( OlcDatabaseList &databases, unsigned int pos )
+{
+    databases[pos]->clearChangedEntry();
+    OlcOverlayList &overlays = databases[pos]->getOverlays();
+    for ( unsigned int j = 0; j < overlays.size(); j++ )
+    {
+        overlays[j]->clearChangedEntry();
+    }
+    OlcDatabase::renumber( databases.begin() + pos + 1, databases.end(), -1 );
+}
+
+static boost::shared_ptr<OlcBdbDatabase> newDatabase( int index, const std::string &dc )
+{
+    boost::shared_ptr<OlcBdbDatabase> db( new OlcBdbDatabase( "hdb" ) );
+    db->setIndex( index );
+    db->setSuffix( "dc=" + dc + ",dc=com" );
+    db->setDirectory( "/var/lib/ldap/" + dc );
+    return db;
+}
+
+// the cache file has no credentials, the entries taken from it get them
+// from the server
+static void testCacheFile( const std::string &fixture )
+{
+    MockSetup setup( fixture );
+    boost::scoped_ptr<LDAPAsynConnection> lc( setup.connect() );
+    OlcConfig config( lc.get() );
+    std::ostringstream cacheFile;
+    cacheFile << "/tmp/slapd-config-test." << getpid() << ".cache";
+    unlink( cacheFile.str().c_str() );
+    config.setCacheFile( cacheFile.str() );
+    for ( int pass = 0; pass < 2; pass++ )
+    {
+        boost::shared_ptr<OlcGlobalConfig> globals;
+        OlcDatabaseList databases;
+        OlcSchemaList schema;
+        config.getConfig( globals, databases, schema );
+        CHECK( databases.size() == 3 );
+        CHECK( databases.size() == 3 &&
+               databases[2]->getStringValue( "olcRootPW" ) == "secret" );
+    }
+    std::ifstream in( cacheFile.str().c_str() );
+    std::ostringstream cached;
+    cached << in.rdbuf();
+    CHECK( cached.str().find( "olcDatabase={1}hdb" ) != std::string::npos );
+    CHECK( cached.str().find( "olcRootPW" ) == std::string::npos );
+    unlink( cacheFile.str().c_str() );
+}
+
+// deletes two databases with one kept in between, in either order, and adds
+// another one. Each delete has to hit the database it was meant for.
+static void testDeleteTwiceAndAdd( const std::string &fixture, bool lowerFirst )
+{
+    MockSetup setup( fixture );
+    boost::scoped_ptr<LDAPAsynConnection> lc( setup.connect() );
+    OlcConfig config( lc.get() );
+    boost::shared_ptr<OlcGlobalConfig> globals;
+    OlcDatabaseList databases;
+    OlcSchemaList schema;
+    config.getConfig( globals, databases, schema );
+    databases.push_back( newDatabase( 2, "two" ) );
+    databases.push_back( newDatabase( 3, "three" ) );
+    databases.push_back( newDatabase( 4, "four" ) );
+    commitDatabases( config, databases );
+    databases.clear();
+    config.getConfig( globals, databases, schema );
+    CHECK( databases.size() == 6 );
+    if ( databases.size() != 6 )
+    {
+        return;
+    }
+
+    // {1}hdb with its overlay and {3}hdb
+    if ( lowerFirst )
+    {
+        deleteDatabase( databases, 2 );
+        deleteDatabase( databases, 4 );
+    }
+    else
+    {
+        deleteDatabase( databases, 4 );
+        deleteDatabase( databases, 2 );
+    }
+    CHECK( databases[2]->isDeletedEntry() );
+    CHECK( databases[2]->getOverlays().size() == 1 &&
+           databases[2]->getOverlays()[0]->isDeletedEntry() );
+    CHECK( databases[4]->isDeletedEntry() );
+    CHECK( databases[3]->getEntryIndex() == 1 );
+    CHECK( databases[5]->getEntryIndex() == 2 );
+    databases.push_back( newDatabase( 3, "five" ) );
+    commitDatabases( config, databases );
+
+    OlcDatabaseList reread;
+    readConfig( setup, globals, reread, schema );
+    CHECK( reread.size() == 5 );
+    if ( reread.size() != 5 )
+    {
+        return;
+    }
+    CHECK( reread[2]->getDn() == "olcDatabase={1}hdb,cn=config" );
+    CHECK( reread[2]->getSuffix() == "dc=two,dc=com" );
+    CHECK( reread[3]->getDn() == "olcDatabase={2}hdb,cn=config" );
+    CHECK( reread[3]->getSuffix() == "dc=four,dc=com" );
+    CHECK( reread[4]->getDn() == "olcDatabase={3}hdb,cn=config" );
+    CHECK( reread[4]->getSuffix() == "dc=five,dc=com" );
+}
+
+int main( int argc, char **argv )
+{
+    std::string fixture;
+    if ( argc > 1 )
+    {
+        fixture = argv[1];
+    }
+    else if ( getenv( "MOCK_FIXTURE" ) )
+    {
+        fixture = getenv( "MOCK_FIXTURE" );
+    }
+    else
+    {
+        std::cerr << "usage: " << argv[0] << " [fixture]" << std::endl;
+        return 1;
+    }
+    OlcConfig::setLogCallback( quietLogCallback );
+    OlcConfig::setLogLevel( SLAPD_LOG_ERR );
+
+    try {
+        testGetConfig( fixture );
+        testCommitPlan( fixture );
+        testCacheFile( fixture );
+        testDeleteTwiceAndAdd( fixture, true );
+        testDeleteTwiceAndAdd( fixture, false );
+    } catch ( LDAPException e ) {
+        std::cerr << e.getResultMsg() << " " << e.getServerMsg() << std::endl;
+        s_failures++;
+    } catch ( std::exception &e ) {
+        std::cerr << e.what() << std::endl;
+        s_failures++;
+    }
+    if ( s_failures )
+    {
+        std::cerr << s_failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
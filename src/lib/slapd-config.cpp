@@ -8,22 +8,43 @@
  * $Id$
  */
 
-#include <LDAPConnection.h>
 #include <LDAPResult.h>
 #include <string>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <sstream>
 #include <map>
+#include <set>
+#include <fstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include <vector>
+#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_set.hpp>
 #include <LDAPEntry.h>
+#include <LdifReader.h>
 #include <LdifWriter.h>
+#include <LDAPAsynConnection.h>
+#include <LDAPMessageQueue.h>
+#include <LDAPSearchResult.h>
+#include <LDAPExtResult.h>
+#include <ldap.h>
 #include "slapd-config.h"
+#include "slapd-config-ldap.h"
 
 
 
+// the message is only built if its level is enabled
 #define log_it( level, string ) \
-    OlcConfig::logCallback( level, string, __FILE__, __LINE__ , __FUNCTION__ )
+    do { \
+        if ( OlcConfig::logEnabled( level ) ) \
+            OlcConfig::logCallback( level, string, __FILE__, __LINE__ , __FUNCTION__ ); \
+    } while ( 0 )
     
 static bool nocase_compare( char c1, char c2){
     return toupper(c1) == toupper(c2);
@@ -55,6 +76,176 @@ static bool strCaseIgnoreEquals(const std::string &s1, const std::string &s2)
     return false;
 }
 
+typedef boost::unordered_set<std::string> ValueSet;
+
+// Strips the "{n}" prefixes from a list of X-ORDERED values. Values without a
+// prefix are appended by slapd in the given order. Returns false if a prefix
+// doesn't match the position of its value.
+static bool stripOrderedIndexes( const StringList &values, std::vector<std::string> &out )
+{
+    out.clear();
+    out.reserve( values.size() );
+    StringList::const_iterator i = values.begin();
+    for ( int pos = 0; i != values.end(); i++, pos++ )
+    {
+        std::string value;
+        int index = splitIndexFromString( *i, value );
+        if ( (*i)[0] == '{' && index != pos )
+        {
+            return false;
+        }
+        out.push_back( value );
+    }
+    return true;
+}
+
+// upper limit for the size of the table used by orderedValuesLcs()
+static const size_t max_lcs_table = 1 << 20;
+
+// Marks the values of oldValues and newValues that are part of their longest
+// common subsequence, i.e. the values that are kept by a minimal
+// insert/delete edit script. Equal heads and tails are matched directly, if
+// the remaining part is too large it is treated as completely replaced.
+static void orderedValuesLcs( const std::vector<std::string> &oldValues,
+        const std::vector<std::string> &newValues,
+        std::vector<bool> &oldKept, std::vector<bool> &newKept )
+{
+    oldKept.assign( oldValues.size(), false );
+    newKept.assign( newValues.size(), false );
+
+    size_t head = 0;
+    while ( head < oldValues.size() && head < newValues.size() &&
+            oldValues[head] == newValues[head] )
+    {
+        oldKept[head] = newKept[head] = true;
+        head++;
+    }
+    size_t oldEnd = oldValues.size();
+    size_t newEnd = newValues.size();
+    while ( oldEnd > head && newEnd > head &&
+            oldValues[oldEnd-1] == newValues[newEnd-1] )
+    {
+        oldEnd--;
+        newEnd--;
+        oldKept[oldEnd] = newKept[newEnd] = true;
+    }
+
+    int rows = oldEnd - head;
+    int cols = newEnd - head;
+    if ( rows == 0 || cols == 0 || (size_t) rows * cols > max_lcs_table )
+    {
+        return;
+    }
+    // len[r * (cols+1) + c] is the LCS length of the remaining values
+    // starting at row r and column c
+    std::vector<int> len( (rows + 1) * (cols + 1), 0 );
+    for ( int r = rows - 1; r >= 0; r-- )
+    {
+        for ( int c = cols - 1; c >= 0; c-- )
+        {
+            if ( oldValues[head + r] == newValues[head + c] )
+            {
+                len[r * (cols+1) + c] = len[(r+1) * (cols+1) + c+1] + 1;
+            }
+            else
+            {
+                len[r * (cols+1) + c] = std::max( len[(r+1) * (cols+1) + c],
+                                                  len[r * (cols+1) + c+1] );
+            }
+        }
+    }
+    int r = 0, c = 0;
+    while ( r < rows && c < cols )
+    {
+        if ( oldValues[head + r] == newValues[head + c] )
+        {
+            oldKept[head + r] = newKept[head + c] = true;
+            r++;
+            c++;
+        }
+        else if ( len[(r+1) * (cols+1) + c] >= len[r * (cols+1) + c+1] )
+        {
+            r++;
+        }
+        else
+        {
+            c++;
+        }
+    }
+}
+
+static std::string indexedValue( int index, const std::string &value )
+{
+    std::ostringstream oStr;
+    oStr << "{" << index << "}" << value;
+    return oStr.str();
+}
+
+// Appends the indexed delete/add modifications turning the X-ORDERED values
+// oldValues into newValues to modlist. The deletes are generated from the
+// highest index downwards, so the indexes of the values still to be deleted
+// stay valid. The adds then insert the new values at their final position in
+// ascending order. Every value gets a modification of its own, as slapd
+// renumbers the values after each of them. Returns false without adding
+// anything if none of the old values is kept, a replace is cheaper then.
+static bool orderedValuesEditScript( const std::string &name,
+        const std::vector<std::string> &oldValues,
+        const std::vector<std::string> &newValues,
+        std::vector<LDAPModification> &modlist )
+{
+    std::vector<bool> oldKept, newKept;
+    orderedValuesLcs( oldValues, newValues, oldKept, newKept );
+    if ( std::find( oldKept.begin(), oldKept.end(), true ) == oldKept.end() )
+    {
+        return false;
+    }
+    for ( int j = oldValues.size() - 1; j >= 0; j-- )
+    {
+        if ( ! oldKept[j] )
+        {
+            log_it(SLAPD_LOG_DEBUG,"Value deleted: " + indexedValue( j, oldValues[j] ) );
+            modlist.push_back(
+                    LDAPModification( LDAPAttribute(name, indexedValue( j, oldValues[j] ) ),
+                            LDAPModification::OP_DELETE)
+                    );
+        }
+    }
+    for ( unsigned int j = 0; j < newValues.size(); j++ )
+    {
+        if ( ! newKept[j] )
+        {
+            log_it(SLAPD_LOG_DEBUG,"Value added: " + indexedValue( j, newValues[j] ) );
+            modlist.push_back(
+                    LDAPModification( LDAPAttribute(name, indexedValue( j, newValues[j] ) ),
+                            LDAPModification::OP_ADD)
+                    );
+        }
+    }
+    return true;
+}
+
+static std::string normalizeDn( const std::string &dn )
+{
+    std::string res(dn);
+    std::transform( res.begin(), res.end(), res.begin(), ::tolower );
+    return res;
+}
+
+// returns the DN of the parent entry, honoring escaped commas in the RDN
+static std::string parentDn( const std::string &dn )
+{
+    std::string::size_type pos = 0;
+    while ( (pos = dn.find(',', pos)) != std::string::npos )
+    {
+        if ( pos == 0 || dn[pos-1] != '\\' )
+        {
+            return dn.substr( pos+1 );
+        }
+        pos++;
+    }
+    return "";
+}
+
 static std::string db_sort_attrs[] = { "olcSyncRepl", "olcMirrorMode" };
 const std::list<std::string> OlcConfigEntry::orderedAttrs;
 const std::list<std::string> OlcDatabase::orderedAttrs(db_sort_attrs, db_sort_attrs + sizeof(db_sort_attrs) / sizeof(std::string) );
@@ -111,6 +302,57 @@ bool OlcConfigEntry::isScheamEntry ( const LDAPEntry& e )
     return false;
 }
 
+// enough for any type stored in the arena
+static const std::size_t ARENA_ALIGNMENT = 16;
+
+OlcArena::OlcArena( std::size_t blockSize ) : m_blockSize(blockSize), m_next(0),
+        m_left(0), m_bytes(0)
+{
+}
+
+OlcArena::~OlcArena()
+{
+    std::vector<char*>::iterator i;
+    for ( i = m_blocks.begin(); i != m_blocks.end(); i++ )
+    {
+        delete[] *i;
+    }
+}
+
+void* OlcArena::allocate( std::size_t size )
+{
+    size = ( size + ARENA_ALIGNMENT - 1 ) & ~( ARENA_ALIGNMENT - 1 );
+    m_bytes += size;
+    if ( size > m_blockSize )
+    {
+        // oversized objects get a block of their own, the current block
+        // stays in use for the following ones
+        char *block = new char[size];
+        m_blocks.push_back( block );
+        return block;
+    }
+    if ( size > m_left )
+    {
+        m_next = new char[m_blockSize];
+        m_blocks.push_back( m_next );
+        m_left = m_blockSize;
+    }
+    void *p = m_next;
+    m_next += size;
+    m_left -= size;
+    return p;
+}
+
+std::size_t OlcArena::getBlocks() const
+{
+    return m_blocks.size();
+}
+
+std::size_t OlcArena::getBytes() const
+{
+    return m_bytes;
+}
+
 OlcConfigEntry* OlcConfigEntry::createFromLdapEntry( const LDAPEntry& e )
 {
     if ( OlcConfigEntry::isGlobalEntry(e) )
@@ -155,42 +397,381 @@ void OlcConfigEntry::updateEntryDn( bool origEntry )
 {
 }
 
+unsigned long OlcConfigEntry::s_attrVersion = 0;
+
+OlcConfigEntry::OlcConfigEntry( const LDAPEntry& le, const LDAPEntry& le1 )
+        : m_dbEntry(le), m_changedEntryValid(false), m_attrIndexValid(false),
+          m_resetVersion(++s_attrVersion)
+{
+    this->setChangedEntry( le1 );
+}
+
+OlcConfigEntry::OlcConfigEntry( const OlcConfigEntry &oce )
+        : entryIndex(oce.entryIndex), m_dbEntry(oce.m_dbEntry),
+          m_changedDn(oce.m_changedDn), m_changedAttrs(oce.m_changedAttrs),
+          m_changedOrder(oce.m_changedOrder), m_changedEntryValid(false),
+          m_attrIndexValid(false), m_resetVersion(oce.m_resetVersion),
+          m_attrVersions(oce.m_attrVersions)
+{
+}
+
+OlcConfigEntry& OlcConfigEntry::operator=( const OlcConfigEntry &oce )
+{
+    entryIndex = oce.entryIndex;
+    m_dbEntry = oce.m_dbEntry;
+    m_changedDn = oce.m_changedDn;
+    m_changedAttrs = oce.m_changedAttrs;
+    m_changedOrder = oce.m_changedOrder;
+    m_changedEntryValid = false;
+    m_attrIndexValid = false;
+    m_resetVersion = oce.m_resetVersion;
+    m_attrVersions = oce.m_attrVersions;
+    return *this;
+}
+
+void OlcConfigEntry::invalidateAttributes()
+{
+    m_changedEntryValid = false;
+    m_attrIndexValid = false;
+    m_attrVersions.clear();
+    m_resetVersion = ++s_attrVersion;
+}
+
 void OlcConfigEntry::clearChangedEntry()
 {
-   m_dbEntryChanged = LDAPEntry();     
+   this->setChangedEntry( LDAPEntry() );
+   this->invalidateAttributes();
 }
 
 void OlcConfigEntry::resetEntries( const LDAPEntry &e )
 {
     m_dbEntry = e;
-    m_dbEntryChanged = e;
+    m_changedDn = e.getDN();
+    m_changedAttrs.clear();
+    m_changedOrder.clear();
+    this->invalidateAttributes();
+    this->resetMemberAttrs();
+}
+
+void OlcConfigEntry::applyChanges()
+{
+    // only the modified attributes need to be copied
+    std::vector<std::string>::const_iterator i;
+    for ( i = m_changedOrder.begin(); i != m_changedOrder.end(); i++ )
+    {
+        const LDAPAttribute &attr = m_changedAttrs.find( *i )->second;
+        std::vector<std::string> values;
+        if ( attr.getNumValues() == 0 )
+        {
+            m_dbEntry.delAttribute( attr.getName() );
+        }
+        else if ( isXOrderedAttr( attr.getName() ) &&
+                  stripOrderedIndexes( attr.getValues(), values ) )
+        {
+            StringList indexed;
+            for ( unsigned int j = 0; j < values.size(); j++ )
+            {
+                indexed.add( indexedValue( j, values[j] ) );
+            }
+            m_dbEntry.replaceAttribute( LDAPAttribute( attr.getName(), indexed ) );
+        }
+        else
+        {
+            m_dbEntry.replaceAttribute( attr );
+        }
+    }
+    m_dbEntry.setDN( m_changedDn );
+    m_changedAttrs.clear();
+    m_changedOrder.clear();
+    this->invalidateAttributes();
+    this->resetMemberAttrs();
+}
+
+void OlcConfigEntry::restoreEntries( const LDAPEntry &origEntry, const LDAPEntry &changedEntry )
+{
+    m_dbEntry = origEntry;
+    this->setChangedEntry( changedEntry );
+    this->invalidateAttributes();
+    this->resetMemberAttrs();
+}
+
+// unlike sameValues() this compares the order of the values as well
+static bool identicalValues( const LDAPAttribute &a, const LDAPAttribute &b )
+{
+    const StringList &va = a.getValues();
+    const StringList &vb = b.getValues();
+    return va.size() == vb.size() && std::equal( va.begin(), va.end(), vb.begin() );
+}
+
+// keeps the attributes of "le" that differ from the original entry
+void OlcConfigEntry::setChangedEntry( const LDAPEntry &le )
+{
+    m_changedDn = le.getDN();
+    m_changedAttrs.clear();
+    m_changedOrder.clear();
+    m_changedEntryValid = false;
+
+    AttributeIndex orig;
+    const LDAPAttributeList *al = m_dbEntry.getAttributes();
+    LDAPAttributeList::const_iterator i;
+    for ( i = al->begin(); i != al->end(); i++ )
+    {
+        orig[i->getName()] = &(*i);
+    }
+    al = le.getAttributes();
+    for ( i = al->begin(); i != al->end(); i++ )
+    {
+        AttributeIndex::iterator j = orig.find( i->getName() );
+        if ( j == orig.end() || ! identicalValues( *j->second, *i ) )
+        {
+            m_changedAttrs.insert( std::make_pair( i->getName(), *i ) );
+            m_changedOrder.push_back( i->getName() );
+        }
+        if ( j != orig.end() )
+        {
+            orig.erase( j );
+        }
+    }
+    // the remaining ones were deleted
+    for ( i = m_dbEntry.getAttributes()->begin(); i != m_dbEntry.getAttributes()->end(); i++ )
+    {
+        if ( orig.find( i->getName() ) != orig.end() )
+        {
+            m_changedAttrs.insert( std::make_pair( i->getName(), LDAPAttribute( i->getName() ) ) );
+            m_changedOrder.push_back( i->getName() );
+        }
+    }
+}
+
+void OlcConfigEntry::forgetChange( const std::string &type )
+{
+    AttributeOverlay::iterator i = m_changedAttrs.find( type );
+    if ( i == m_changedAttrs.end() )
+    {
+        return;
+    }
+    m_changedAttrs.erase( i );
+    AttrNameEqual equal;
+    std::vector<std::string>::iterator j;
+    for ( j = m_changedOrder.begin(); j != m_changedOrder.end(); j++ )
+    {
+        if ( equal( *j, type ) )
+        {
+            m_changedOrder.erase( j );
+            break;
+        }
+    }
+    m_changedEntryValid = false;
+}
+
+const LDAPEntry& OlcConfigEntry::getChangedEntry() const
+{
+    if ( m_changedAttrs.empty() && m_changedDn == m_dbEntry.getDN() )
+    {
+        return m_dbEntry;
+    }
+    if ( ! m_changedEntryValid )
+    {
+        // modified attributes keep their position, added ones go last
+        m_dbEntryChanged = LDAPEntry( m_changedDn );
+        const LDAPAttributeList *al = m_dbEntry.getAttributes();
+        LDAPAttributeList::const_iterator i;
+        for ( i = al->begin(); i != al->end(); i++ )
+        {
+            AttributeOverlay::const_iterator c = m_changedAttrs.find( i->getName() );
+            if ( c == m_changedAttrs.end() )
+            {
+                m_dbEntryChanged.addAttribute( *i );
+            }
+            else if ( c->second.getNumValues() > 0 )
+            {
+                m_dbEntryChanged.addAttribute( c->second );
+            }
+        }
+        std::vector<std::string>::const_iterator j;
+        for ( j = m_changedOrder.begin(); j != m_changedOrder.end(); j++ )
+        {
+            const LDAPAttribute &attr = m_changedAttrs.find( *j )->second;
+            if ( attr.getNumValues() > 0 && ! this->getOrigAttribute( *j ) )
+            {
+                m_dbEntryChanged.addAttribute( attr );
+            }
+        }
+        m_changedEntryValid = true;
+    }
+    return m_dbEntryChanged;
+}
+
+// an attribute without values counts as missing, the order of the values
+// is ignored
+static bool sameValues( const LDAPAttribute *a, const LDAPAttribute *b )
+{
+    int na = a ? a->getNumValues() : 0;
+    int nb = b ? b->getNumValues() : 0;
+    if ( na != nb )
+    {
+        return false;
+    }
+    if ( na == 0 )
+    {
+        return true;
+    }
+    const StringList &va = a->getValues();
+    const StringList &vb = b->getValues();
+    return ValueSet( va.begin(), va.end() ) == ValueSet( vb.begin(), vb.end() );
+}
+
+bool OlcConfigEntry::rebase( const LDAPEntry &le )
+{
+    if ( this->isNewEntry() )
+    {
+        // added on the server as well, the local entry is still to be added
+        // and nothing of the server's one can be merged into it
+        log_it(SLAPD_LOG_INFO, "Entry added locally and on the server: " + le.getDN() );
+        return false;
+    }
+    if ( this->isDeletedEntry() )
+    {
+        // still to be deleted
+        m_dbEntry = le;
+        OlcConfigEntry::clearChangedEntry();
+        return true;
+    }
+    // only the modified attributes can have local changes
+    bool conflict = false;
+    AttributeOverlay local;
+    std::vector<std::string> localOrder;
+    std::vector<std::string>::const_iterator i;
+    for ( i = m_changedOrder.begin(); i != m_changedOrder.end(); i++ )
+    {
+        const LDAPAttribute &changed = m_changedAttrs.find( *i )->second;
+        const LDAPAttribute *orig = this->getOrigAttribute( *i );
+        if ( sameValues( orig, &changed ) )
+        {
+            continue;
+        }
+        if ( ! sameValues( orig, le.getAttributeByName( *i ) ) )
+        {
+            log_it(SLAPD_LOG_INFO, "Conflicting changes of " + *i + " in " + le.getDN() );
+            conflict = true;
+        }
+        local.insert( std::make_pair( *i, changed ) );
+        localOrder.push_back( *i );
+    }
+    m_dbEntry = le;
+    m_changedAttrs.swap( local );
+    m_changedOrder.swap( localOrder );
+    this->invalidateAttributes();
     this->resetMemberAttrs();
+    return ! conflict;
+}
+
+const LDAPAttribute* OlcConfigEntry::getOrigAttribute(const std::string &type) const
+{
+    if ( ! m_attrIndexValid )
+    {
+        m_attrIndex.clear();
+        const LDAPAttributeList *al = m_dbEntry.getAttributes();
+        LDAPAttributeList::const_iterator i;
+        for ( i = al->begin(); i != al->end(); i++ )
+        {
+            m_attrIndex[i->getName()] = &(*i);
+        }
+        m_attrIndexValid = true;
+    }
+    AttributeIndex::const_iterator i = m_attrIndex.find(type);
+    if ( i != m_attrIndex.end() ) {
+        return i->second;
+    } else {
+        return 0;
+    }
+}
+
+const LDAPAttribute* OlcConfigEntry::getAttribute(const std::string &type) const
+{
+    AttributeOverlay::const_iterator i = m_changedAttrs.find(type);
+    if ( i != m_changedAttrs.end() ) {
+        return ( i->second.getNumValues() > 0 ) ? &i->second : 0;
+    } else {
+        return this->getOrigAttribute(type);
+    }
+}
+
+void OlcConfigEntry::replaceAttribute(const LDAPAttribute &attr)
+{
+    AttributeOverlay::iterator i = m_changedAttrs.find(attr.getName());
+    if ( i != m_changedAttrs.end() )
+    {
+        i->second = attr;
+    }
+    else
+    {
+        m_changedAttrs.insert( std::make_pair( attr.getName(), attr ) );
+        m_changedOrder.push_back( attr.getName() );
+    }
+    m_attrVersions[attr.getName()] = ++s_attrVersion;
+    m_changedEntryValid = false;
+}
+
+void OlcConfigEntry::deleteAttribute(const std::string &type)
+{
+    this->replaceAttribute( LDAPAttribute(type) );
 }
 
-StringList OlcConfigEntry::getStringValues(const std::string &type) const
+void OlcConfigEntry::setUpdatedDn(const std::string &dn)
 {
-    const LDAPAttribute *attr = m_dbEntryChanged.getAttributeByName(type);
+    m_changedDn = dn;
+    m_changedEntryValid = false;
+}
+
+void OlcConfigEntry::replaceOrigAttribute(const LDAPAttribute &attr)
+{
+    m_dbEntry.replaceAttribute(attr);
+    m_attrIndexValid = false;
+    AttributeOverlay::const_iterator i = m_changedAttrs.find(attr.getName());
+    if ( i != m_changedAttrs.end() && identicalValues( i->second, attr ) )
+    {
+        this->forgetChange( attr.getName() );
+    }
+    m_changedEntryValid = false;
+}
+
+unsigned long OlcConfigEntry::getAttributeVersion(const std::string &type) const
+{
+    AttributeVersions::const_iterator i = m_attrVersions.find(type);
+    if ( i != m_attrVersions.end() ) {
+        return i->second;
+    } else {
+        return m_resetVersion;
+    }
+}
+
+const StringList& OlcConfigEntry::getStringValues(const std::string &type) const
+{
+    static const StringList empty;
+    const LDAPAttribute *attr = this->getAttribute(type);
     if ( attr ) {
         return attr->getValues();
     } else {
-        return StringList();
+        return empty;
     }
 }
 
-std::string OlcConfigEntry::getStringValue(const std::string &type) const
+const std::string& OlcConfigEntry::getStringValue(const std::string &type) const
 {
-    StringList sl = this->getStringValues(type);
+    static const std::string empty;
+    const StringList &sl = this->getStringValues(type);
     if ( sl.size() == 1 ) {
         return *(sl.begin());
     } else {
-        return "";
+        return empty;
     }
 }
 
 void OlcConfigEntry::setStringValues(const std::string &type, const StringList &values)
 {
     LDAPAttribute attr(type, values);
-    m_dbEntryChanged.replaceAttribute(attr);
+    this->replaceAttribute(attr);
 }
 
 void OlcConfigEntry::setStringValue(const std::string &type, const std::string &value)
@@ -198,39 +779,37 @@ void OlcConfigEntry::setStringValue(const std::string &type, const std::string &
     log_it(SLAPD_LOG_DEBUG,"setStringValue() " + type + " " + value);
     if ( value.empty() )
     {
-        m_dbEntryChanged.delAttribute(type);
+        this->deleteAttribute(type);
     }
     else
     {
         LDAPAttribute attr(type, value);
-        m_dbEntryChanged.replaceAttribute(attr);
+        this->replaceAttribute(attr);
     }
 }
 
 void OlcConfigEntry::addStringValue(const std::string &type, const std::string &value)
 {
-    const LDAPAttribute *attr =  m_dbEntryChanged.getAttributeByName(type);
+    const LDAPAttribute *attr = this->getAttribute(type);
     if ( attr ) {
         LDAPAttribute newAttr(*attr);
         newAttr.addValue(value);
-        m_dbEntryChanged.replaceAttribute(newAttr);
+        this->replaceAttribute(newAttr);
     } else {
         LDAPAttribute newAttr(type, value);
-        m_dbEntryChanged.addAttribute(newAttr);
+        this->replaceAttribute(newAttr);
     }
 }
 
 void OlcConfigEntry::addIndexedStringValue(const std::string &type,
         const std::string &value, int index)
 {
-    std::ostringstream oStr;
-    oStr << "{" << index << "}" << value;
-    this->addStringValue( type, oStr.str() );
+    this->addStringValue( type, indexedValue( index, value ) );
 }
 
 int OlcConfigEntry::getIntValue( const std::string &type ) const
 {
-    StringList sl = this->getStringValues(type);
+    const StringList &sl = this->getStringValues(type);
     if ( sl.empty() )
     {
         return -1;
@@ -256,7 +835,7 @@ std::string OlcConfigEntry::toLdif() const
 {
     std::ostringstream ldifStream;
     LdifWriter ldif(ldifStream);
-    ldif.writeRecord( m_dbEntryChanged );
+    ldif.writeRecord( this->getChangedEntry() );
     return ldifStream.str();
 }
 
@@ -269,48 +848,105 @@ bool OlcConfigEntry::isDeletedEntry() const
     return ( (!this->getDn().empty()) && this->getUpdatedDn().empty() );
 }
 
+bool OlcConfigEntry::hasChanges() const
+{
+    return this->isNewEntry() || this->isDeletedEntry() || ! this->entryDifftoMod().empty();
+}
+
+// the other attributes are equal in both entries and don't need to be diffed
+void OlcConfigEntry::changedAttributes( LDAPEntry &origAttrs, LDAPEntry &changedAttrs ) const
+{
+    origAttrs.setDN( m_dbEntry.getDN() );
+    changedAttrs.setDN( m_changedDn );
+    std::vector<std::string>::const_iterator i;
+    for ( i = m_changedOrder.begin(); i != m_changedOrder.end(); i++ )
+    {
+        const LDAPAttribute *orig = this->getOrigAttribute( *i );
+        if ( orig )
+        {
+            origAttrs.addAttribute( *orig );
+        }
+        const LDAPAttribute &changed = m_changedAttrs.find( *i )->second;
+        if ( changed.getNumValues() > 0 )
+        {
+            changedAttrs.addAttribute( changed );
+        }
+    }
+}
+
 LDAPModList OlcConfigEntry::entryDifftoMod() const {
-    LDAPAttributeList::const_iterator i = m_dbEntry.getAttributes()->begin();
-    std::list<LDAPModification> modlist;
+    if ( m_changedAttrs.empty() )
+    {
+        return LDAPModList();
+    }
+    LDAPEntry origAttrs, changedAttrs;
+    this->changedAttributes( origAttrs, changedAttrs );
+    return this->diffEntries( origAttrs, changedAttrs );
+}
 
-    log_it(SLAPD_LOG_INFO, "Old Entry DN: " + m_dbEntry.getDN());
-    log_it(SLAPD_LOG_INFO,"New Entry DN: " + m_dbEntryChanged.getDN());
-    for(; i != m_dbEntry.getAttributes()->end(); i++ )
+// replacing the changed attributes with their original values reverts any
+// modification of them, no second diff is needed for that
+LDAPModList OlcConfigEntry::undoDifftoMod() const {
+    LDAPModList modlist;
+    std::vector<std::string>::const_iterator i;
+    for ( i = m_changedOrder.begin(); i != m_changedOrder.end(); i++ )
     {
-        log_it(SLAPD_LOG_INFO,i->getName());
-        const LDAPAttribute *changedAttr =  m_dbEntryChanged.getAttributeByName(i->getName());
-        if ( changedAttr ) {
-            StringList::const_iterator j = i->getValues().begin();
-            StringList delValues, addValues;
-            for(; j != i->getValues().end(); j++ )
+        const LDAPAttribute *orig = this->getOrigAttribute( *i );
+        modlist.addModification(
+                LDAPModification( orig ? *orig : LDAPAttribute( *i ),
+                                  LDAPModification::OP_REPLACE ) );
+    }
+    return modlist;
+}
+
+LDAPModList OlcConfigEntry::diffEntries( const LDAPEntry &oldEntry,
+                                         const LDAPEntry &newEntry ) const {
+    LDAPAttributeList::const_iterator i = oldEntry.getAttributes()->begin();
+    std::vector<LDAPModification> modlist;
+
+    log_it(SLAPD_LOG_INFO, "Old Entry DN: " + oldEntry.getDN());
+    log_it(SLAPD_LOG_INFO,"New Entry DN: " + newEntry.getDN());
+    for(; i != oldEntry.getAttributes()->end(); i++ )
+    {
+        log_it(SLAPD_LOG_DEBUG,i->getName());
+        const LDAPAttribute *changedAttr = newEntry.getAttributeByName(i->getName());
+        if ( changedAttr ) {
+            const StringList &oldValues = i->getValues();
+            const StringList &newValues = changedAttr->getValues();
+            std::vector<std::string> oldOrdered, newOrdered;
+            if ( isXOrderedAttr( i->getName() ) &&
+                 stripOrderedIndexes( oldValues, oldOrdered ) &&
+                 stripOrderedIndexes( newValues, newOrdered ) )
             {
-                bool deleted = true;
-                StringList::const_iterator k = changedAttr->getValues().begin();
-                for( ; k != changedAttr->getValues().end(); k++ ) {
-                    if ( *k == *j ) {
-                        deleted = false;
-                        break;
-                    }
+                if ( oldOrdered == newOrdered )
+                {
+                    log_it(SLAPD_LOG_DEBUG,"Ordered values unchanged: " + i->getName() );
+                    continue;
+                }
+                if ( orderedValuesEditScript( i->getName(), oldOrdered, newOrdered, modlist ) )
+                {
+                    continue;
                 }
-                if ( deleted ) 
+            }
+            ValueSet newSet( newValues.begin(), newValues.end() );
+            ValueSet oldSet( oldValues.begin(), oldValues.end() );
+            StringList delValues, addValues;
+            StringList::const_iterator j = oldValues.begin();
+            for(; j != oldValues.end(); j++ )
+            {
+                if ( newSet.find(*j) == newSet.end() )
                 {
                     delValues.add(*j);
                     log_it(SLAPD_LOG_DEBUG,"Value deleted: " + *j );
                 }
             }
-            j = changedAttr->getValues().begin();
-            for(; j != changedAttr->getValues().end(); j++ )
+            for( j = newValues.begin(); j != newValues.end(); j++ )
             {
-                bool added = true;
-                StringList::const_iterator k = i->getValues().begin();
-                for( ; k != i->getValues().end(); k++ ) {
-                    if ( *k == *j ) {
-                        log_it(SLAPD_LOG_DEBUG,"Value unchanged: " + *k );
-                        added = false;
-                        break;
-                    }
+                if ( oldSet.find(*j) != oldSet.end() )
+                {
+                    log_it(SLAPD_LOG_DEBUG,"Value unchanged: " + *j );
                 }
-                if ( added ) 
+                else
                 {
                     addValues.add(*j);
                     log_it(SLAPD_LOG_DEBUG,"Value added: " + *j);
@@ -346,12 +982,16 @@ LDAPModList OlcConfigEntry::entryDifftoMod() const {
                     );
         }
     }
-    i = m_dbEntryChanged.getAttributes()->begin();
-    for(; i != m_dbEntryChanged.getAttributes()->end(); i++ )
+    AttributeIndex oldAttrs;
+    for ( i = oldEntry.getAttributes()->begin(); i != oldEntry.getAttributes()->end(); i++ )
+    {
+        oldAttrs[i->getName()] = &(*i);
+    }
+    i = newEntry.getAttributes()->begin();
+    for(; i != newEntry.getAttributes()->end(); i++ )
     {
         log_it(SLAPD_LOG_DEBUG,i->getName() );
-        const LDAPAttribute *old =  m_dbEntry.getAttributeByName(i->getName());
-        if (! old ) {
+        if ( oldAttrs.find(i->getName()) == oldAttrs.end() ) {
             log_it(SLAPD_LOG_INFO,"Attribute added: " + i->getName());
             if (! i->getValues().empty() )
             {
@@ -362,25 +1002,43 @@ LDAPModList OlcConfigEntry::entryDifftoMod() const {
             }
         }
     }
-    LDAPModList modifications;
-    std::list<std::string>::const_iterator k;
-    std::list<LDAPModification>::iterator j;
-    for ( k = this->getOrderedAttrs()->begin(); k != this->getOrderedAttrs()->end(); k++ )
+
+    // The first modification of each of the ordered Attributes is moved to
+    // the front (in the order given by getOrderedAttrs()), the remaining
+    // modifications keep their order.
+    const std::list<std::string> *orderedAttrs = this->getOrderedAttrs();
+    std::vector<int> firstMod( orderedAttrs->size(), -1 );
+    std::vector<bool> moved( modlist.size(), false );
+    for ( unsigned int j = 0; j < modlist.size(); j++ )
     {
-        log_it( SLAPD_LOG_INFO, "ordered Attribute " + *k );
-        for ( j = modlist.begin(); j != modlist.end(); j++ )
+        std::list<std::string>::const_iterator k = orderedAttrs->begin();
+        for ( int pos = 0; k != orderedAttrs->end(); k++, pos++ )
         {
-            if ( strCaseIgnoreEquals(*k, j->getAttribute()->getName() ) )
+            if ( firstMod[pos] == -1 &&
+                 strCaseIgnoreEquals(*k, modlist[j].getAttribute()->getName() ) )
             {
-                modifications.addModification( *j );
-                modlist.erase( j );
+                firstMod[pos] = j;
+                moved[j] = true;
                 break;
             }
         }
     }
-    for ( j = modlist.begin(); j != modlist.end(); j++ )
+    LDAPModList modifications;
+    for ( unsigned int pos = 0; pos < firstMod.size(); pos++ )
+    {
+        if ( firstMod[pos] != -1 )
+        {
+            log_it( SLAPD_LOG_INFO, "ordered Attribute " +
+                    modlist[firstMod[pos]].getAttribute()->getName() );
+            modifications.addModification( modlist[firstMod[pos]] );
+        }
+    }
+    for ( unsigned int j = 0; j < modlist.size(); j++ )
     {
-        modifications.addModification( *j );
+        if ( ! moved[j] )
+        {
+            modifications.addModification( modlist[j] );
+        }
     }
     return modifications;
 }
@@ -398,6 +1056,20 @@ OlcOverlay* OlcOverlay::createFromLdapEntry( const LDAPEntry& e)
     return new OlcOverlay(e);
 }
 
+boost::shared_ptr<OlcOverlay> OlcOverlay::createFromLdapEntry( const LDAPEntry& e,
+                                                               const OlcArenaPtr &arena )
+{
+    StringList oc = e.getAttributeByName("objectclass")->getValues();
+    for( StringList::const_iterator i = oc.begin(); i != oc.end(); i++ )
+    {
+        if ( strCaseIgnoreEquals(*i, "olcSyncProvConfig" ) )
+        {
+            return olcCreate<OlcSyncProvOl>( arena, e );
+        }
+    }
+    return olcCreate<OlcOverlay>( arena, e );
+}
+
 OlcOverlay::OlcOverlay( const LDAPEntry& e) : OlcConfigEntry(e)
 {
     log_it(SLAPD_LOG_INFO,"OlcOverlay::OlcOverlay()" );
@@ -410,12 +1082,12 @@ OlcOverlay::OlcOverlay( const std::string &type, const std::string &parent, cons
 {
     std::ostringstream dnstr;
     dnstr << "olcOverlay=" << m_type << "," << parent;
-    m_dbEntryChanged.setDN(dnstr.str());
+    this->setUpdatedDn(dnstr.str());
     if ( !oc.empty() )
     {
-        m_dbEntryChanged.addAttribute( LDAPAttribute("objectclass", oc) );
+        this->addStringValue("objectclass", oc);
     }
-    m_dbEntryChanged.addAttribute(LDAPAttribute("olcoverlay", m_type));
+    this->addStringValue("olcoverlay", m_type);
 }
 
 const std::string OlcOverlay::getType() const
@@ -428,13 +1100,17 @@ void OlcOverlay::newParentDn( const std::string& parent )
     std::ostringstream dnstr;
     m_parent = parent;
     dnstr << "olcOverlay={" << entryIndex << "}" << m_type << "," << parent;
-    log_it(SLAPD_LOG_INFO, "Changing Overlay DN from: " + m_dbEntryChanged.getDN()
+    log_it(SLAPD_LOG_INFO, "Changing Overlay DN from: " + this->getUpdatedDn()
                            + " to: " + dnstr.str() );
+    // a deleted overlay only follows with the DN it is deleted by
+    if ( ! this->isDeletedEntry() )
+    {
+        this->setUpdatedDn(dnstr.str());
+    }
     if (! m_dbEntry.getDN().empty() )
     {
         m_dbEntry.setDN(dnstr.str());
     }
-    m_dbEntryChanged.setDN(dnstr.str());
 }
 
 void OlcOverlay::resetMemberAttrs()
@@ -448,12 +1124,15 @@ void OlcOverlay::updateEntryDn(bool origEntry )
     std::ostringstream dn, name;
     name << "{" << entryIndex << "}" << m_type;
     dn << "olcOverlay=" << name.str() << "," << m_parent;
-    m_dbEntryChanged.setDN(dn.str());
-    m_dbEntryChanged.replaceAttribute(LDAPAttribute("olcOverlay", name.str()));
+    if ( ! this->isDeletedEntry() )
+    {
+        this->setUpdatedDn(dn.str());
+        this->replaceAttribute(LDAPAttribute("olcOverlay", name.str()));
+    }
     if ( origEntry && (! m_dbEntry.getDN().empty()) )
     {
         m_dbEntry.setDN(dn.str());
-        m_dbEntry.replaceAttribute(LDAPAttribute("olcOverlay", name.str()));
+        this->replaceOrigAttribute(LDAPAttribute("olcOverlay", name.str()));
     }
 }
 
@@ -509,69 +1188,189 @@ bool OlcSyncProvOl::getSessionLog( int &slog ) const
     }
 }
 
-static int extractAlcToken( const std::string& acl, std::string::size_type& startpos, bool quoted )
+// A non-owning slice of a configuration value. The parsers below split
+// values into slices and only copy the parts they keep.
+class ValueSlice
 {
-    std::string::size_type pos;
+    public:
+        ValueSlice() : m_str(0), m_pos(0), m_len(0) {}
+        ValueSlice( const std::string &str, std::string::size_type pos,
+                    std::string::size_type end )
+            : m_str(&str), m_pos(pos), m_len(end - pos) {}
 
-    // skip leading whitespaces
-    startpos = acl.find_first_not_of("\t ", startpos );
+        bool empty() const
+        {
+            return m_len == 0;
+        }
 
-    if ( quoted && acl[startpos] == '"' )
-    {
-        // find matching (unescapted) quote 
-        startpos++;
-        pos = startpos;
-        bool found=false;
-        while( ! found )
+        std::string::size_type find( char c ) const
         {
-            pos = acl.find_first_of('"', pos );
-            if ( pos == std::string::npos )
+            for ( std::string::size_type i = 0; i < m_len; i++ )
             {
-                break;
+                if ( (*m_str)[m_pos + i] == c )
+                {
+                    return i;
+                }
+            }
+            return std::string::npos;
+        }
+
+        ValueSlice substr( std::string::size_type pos,
+                           std::string::size_type len = std::string::npos ) const
+        {
+            pos = std::min( pos, m_len );
+            len = std::min( len, m_len - pos );
+            return ValueSlice( *m_str, m_pos + pos, m_pos + pos + len );
+        }
+
+        std::string str() const
+        {
+            return m_str ? m_str->substr( m_pos, m_len ) : std::string();
+        }
+
+        bool operator==( const char *s ) const
+        {
+            return m_str ? m_str->compare( m_pos, m_len, s ) == 0 : *s == '\0';
+        }
+
+        bool operator==( const std::string &s ) const
+        {
+            return m_str ? m_str->compare( m_pos, m_len, s ) == 0 : s.empty();
+        }
+
+        bool operator!=( const char *s ) const
+        {
+            return !( *this == s );
+        }
+
+    private:
+        const std::string *m_str;
+        std::string::size_type m_pos;
+        std::string::size_type m_len;
+};
+
+// Splits a configuration value into whitespace separated tokens. Quoted
+// tokens end at the first double quote that is not escaped by a backslash,
+// the escapes are kept in the token.
+class ValueTokenizer
+{
+    public:
+        ValueTokenizer( const std::string &value ) : m_value(value), m_pos(0) {}
+
+        bool atEnd() const
+        {
+            return m_pos >= m_value.size();
+        }
+
+        char peek() const
+        {
+            return atEnd() ? '\0' : m_value[m_pos];
+        }
+
+        void advance( std::string::size_type count = 1 )
+        {
+            m_pos = std::min( m_pos + count, m_value.size() );
+        }
+
+        std::string::size_type position() const
+        {
+            return m_pos;
+        }
+
+        void seek( std::string::size_type pos )
+        {
+            m_pos = pos;
+        }
+
+        void skipSpace()
+        {
+            m_pos = std::min( m_value.find_first_not_of( "\t ", m_pos ), m_value.size() );
+        }
+
+        // everything up to (not including) the next character out of delims
+        ValueSlice nextWord( const char *delims )
+        {
+            std::string::size_type start = m_pos;
+            m_pos = std::min( m_value.find_first_of( delims, m_pos ), m_value.size() );
+            return ValueSlice( m_value, start, m_pos );
+        }
+
+        // the next token after any whitespace. If quoted is set a token
+        // starting with a double quote runs up to the closing quote, the
+        // quotes are not part of the slice.
+        ValueSlice nextToken( bool quoted )
+        {
+            skipSpace();
+            if ( quoted && peek() == '"' )
+            {
+                std::string::size_type start = m_pos + 1;
+                m_pos = closingQuote( start );
+                ValueSlice token( m_value, start, m_pos );
+                advance();
+                return token;
             }
-            if ( acl[pos-1] != '\\' )
+            return nextWord( "\t " );
+        }
+
+        // like nextToken( false ), but whitespace inside double quoted
+        // parts does not end the token, e.g. dn.exact="cn=a b,dc=x"
+        ValueSlice nextQuotedWord()
+        {
+            skipSpace();
+            std::string::size_type start = m_pos;
+            while ( !atEnd() && m_value[m_pos] != ' ' && m_value[m_pos] != '\t' )
             {
-                found = true;
+                if ( m_value[m_pos] == '"' )
+                {
+                    m_pos = closingQuote( m_pos + 1 );
+                }
+                advance();
             }
+            return ValueSlice( m_value, start, m_pos );
         }
-        if ( !found )
+
+    private:
+        std::string::size_type closingQuote( std::string::size_type pos ) const
         {
-            log_it(SLAPD_LOG_ERR, "Not matching quote found" );
+            while ( pos < m_value.size() && m_value[pos] != '"' )
+            {
+                if ( m_value[pos] == '\\' )
+                {
+                    pos++;
+                }
+                pos++;
+            }
+            if ( pos >= m_value.size() )
+            {
+                log_it(SLAPD_LOG_ERR, "Not matching quote found" );
+                return m_value.size();
+            }
+            return pos;
         }
-    }
-    else
-    {
-        pos = acl.find_first_of("\t ", startpos );
-    }
-    return pos;
-}
+
+        const std::string &m_value;
+        std::string::size_type m_pos;
+};
 
 OlcAccess::OlcAccess( const std::string& aclString )
 {
-    std::string::size_type spos = 0;
-    std::string::size_type tmppos = 0;
     // every ACL starts with "to"
     if ( aclString.compare(0, 2, "to") != 0 )
     {
         log_it(SLAPD_LOG_ERR, "acl does not start with \"to\"" );
         throw std::runtime_error( "acl does not start with \"to\"" );
     }
-    spos+=2;
-
-    // skip whitespaces
-    tmppos = aclString.find_first_not_of("\t ", spos );
-    if ( tmppos != std::string::npos && tmppos > spos )
-    {
-        spos = tmppos;
-    }
+    ValueTokenizer tokens( aclString );
+    tokens.advance( 2 );
+    tokens.skipSpace();
 
     // we should be at the start of the "what" part now, might `*` 
     // or a string followed by '='
-    if ( aclString[spos] == '*' )
+    ValueSlice word;
+    if ( tokens.peek() == '*' )
     {
-        log_it(SLAPD_LOG_ERR, "acl matches all entries" );
-        spos = tmppos+1;
-        tmppos = extractAlcToken( aclString, spos, true );
+        tokens.advance();
+        word = tokens.nextToken( false );
         m_all = true;
     }
     else
@@ -579,161 +1378,114 @@ OlcAccess::OlcAccess( const std::string& aclString )
         m_all = false;
         while ( true )
         {
-            tmppos = aclString.find_first_of("=\t ", spos );
-            if ( tmppos == std::string::npos )
+            word = tokens.nextWord( "=\t " );
+            if ( tokens.atEnd() )
             {
                 log_it(SLAPD_LOG_ERR, "Unexpected end of ACL" );
                 throw std::runtime_error( "Unexpected end of ACL" );
             }
+            if ( word == "by" )
+            {
+                break;
+            }
+            tokens.advance();
+            ValueSlice value = tokens.nextToken( true );
+            if ( word == "filter" )
+            {
+                m_filter = value.str();
+            }
+            else if ( word == "attrs" )
+            {
+                m_attributes = value.str();
+            }
+            else if ( word == "dn.base" || word == "dn.subtree" )
+            {
+                m_dn_type = word.str();
+                m_dn_value = value.str();
+            }
             else
             {
-                std::string whatType = aclString.substr(spos, tmppos-spos);
-                log_it(SLAPD_LOG_INFO, "Whattype: " +  whatType );
-                if ( aclString.substr(spos, tmppos-spos) == "by" )
-                {
-                    break;
-                }
-                spos = tmppos+1;
-
-                tmppos = extractAlcToken( aclString, spos, true );
-                
-                log_it(SLAPD_LOG_INFO, "Whatvalue: " +  aclString.substr(spos, tmppos-spos) );
-                if ( whatType == "filter" )
-                {
-                    m_filter = aclString.substr(spos, tmppos-spos);
-                }
-                else if (whatType == "attrs")
-                {
-                    m_attributes = aclString.substr(spos, tmppos-spos);
-                }
-                else if (whatType == "dn.base" || whatType == "dn.subtree" )
-                {
-                    m_dn_type = whatType;
-                    m_dn_value = aclString.substr(spos, tmppos-spos);
-                }
-                else
-                {
-                    throw std::runtime_error( "Can't parse ACL unsupported \"what\": \"" + whatType + "\"" );
-                }
-                spos = aclString.find_first_not_of("\t ", tmppos+1 );
+                throw std::runtime_error( "Can't parse ACL unsupported \"what\": \"" + word.str() + "\"" );
             }
+            tokens.skipSpace();
         }
     }
     // we should have reached the "by"-clauses now
-    while ( true )
+    while ( !word.empty() )
     {
-        if ( spos == std::string::npos )
-        {
-            throw std::runtime_error( "Error while parsing ACL by clause" );
-        }
-        if ( aclString.substr(spos, tmppos-spos) != "by" )
+        if ( word != "by" )
         {
-            if (tmppos != std::string::npos )
+            if ( ! tokens.atEnd() )
             {
                 throw std::runtime_error( "Error while parsing ACL by clause" );
             }
+            // a single trailing token after the last "by" clause has always
+            // been tolerated, keep ignoring it
+            log_it(SLAPD_LOG_INFO, "Ignoring trailing ACL token <" + word.str() + ">" );
             break;
         }
-        else
+        tokens.skipSpace();
+
+        // we should be at the start of the "by" part now, might `*` 
+        // or a string followed by '='
+        ValueSlice type = tokens.nextWord( "=\t " );
+        if ( tokens.atEnd() )
+        {
+            log_it(SLAPD_LOG_ERR, "Unexpected end of ACL" );
+            throw std::runtime_error( "Error while parsing ACL" );
+        }
+        ValueSlice value;
+        if ( type == "group" || type == "dn.base" || type == "dn.subtree" )
         {
-            std::string type = "";
-            std::string value = "";
-            std::string level = "";
-            std::string control = "";
-            spos = tmppos+1;
-            // skip whitespaces
-            tmppos = aclString.find_first_not_of("\t ", spos );
-            if ( tmppos != std::string::npos && tmppos > spos )
+            if ( tokens.peek() != '=' )
             {
-                spos = tmppos;
+                throw std::runtime_error( "Error while parsing ACL, expected \"=\"" );
             }
+            tokens.advance();
+            value = tokens.nextToken( true );
+        }
+        else if ( type != "users" && type != "anonymous" && type != "self" && type != "*" )
+        {
+            throw std::runtime_error( "Unsupported \"by\" clause" );
+        }
+        else
+        {
+            tokens.advance();
+        }
 
-            // we should be at the start of the "by" part now, might `*` 
-            // or a string followed by '='
-            if ( aclString[spos] == '*' )
-            {
-                log_it(SLAPD_LOG_ERR, "by clause matches all entries" );
-                type = "*";
-            }
-            tmppos = aclString.find_first_of("=\t ", spos );
-            if ( tmppos == std::string::npos )
-            {
-                log_it(SLAPD_LOG_ERR, "Unexpected end of ACL" );
-                throw std::runtime_error( "Error while parsing ACL" );
-            }
-            else
+        ValueSlice level = tokens.nextToken( false );
+        ValueSlice control;
+        if ( level == "stop" || level == "break" || level == "continue" )
+        {
+            // it's ok to have no access level defined
+            control = level;
+            level = ValueSlice();
+        }
+        else if ( !level.empty() && 
+                  level != "none" && level != "disclose" && level != "auth" &&
+                  level != "compare" && level != "read" &&
+                  level != "write" && level != "manage" )
+        {
+            throw std::runtime_error( "Unsupported access level <" + level.str() + ">" );
+        }
+        if ( control.empty() )
+        {
+            std::string::size_type pos = tokens.position();
+            control = tokens.nextToken( false );
+            if ( control != "stop" && control != "break" && control != "continue" )
             {
-                if ( type.empty() )
-                    type = aclString.substr(spos, tmppos-spos);
-
-                log_it(SLAPD_LOG_INFO, "bytype: " +  type );
-                if ( type == "group" || type == "dn.base" || type == "dn.subtree" )
-                {
-                    if ( aclString[tmppos] == '=' )
-                    {
-                        spos = tmppos+1;
-                        tmppos = extractAlcToken( aclString, spos, true );
-                        value = aclString.substr(spos, tmppos-spos);
-                        log_it(SLAPD_LOG_INFO, "byvalue: " +  value );
-                    }
-                    else
-                    {
-                        throw std::runtime_error( "Error while parsing ACL, expected \"=\"" );
-                    }
-                }
-                else if ( type != "users" && type != "anonymous" && type != "self" && type != "*" )
-                {
-                    throw std::runtime_error( "Unsupported \"by\" clause" );
-                }
-                spos = tmppos+1;
-                tmppos = extractAlcToken( aclString, spos, false );
-                level = aclString.substr(spos, tmppos-spos);
-                if ( !level.empty() && 
-                     level != "none" && level != "disclose" && level != "auth" &&
-                     level != "compare" && level != "read" &&
-                     level != "write" && level != "manage" )
-                {
-                    if ( level == "stop" || level == "break" || level == "continue" )
-                    {
-                        // it's ok to have no access level defined
-                        control = level;
-                        level = "";
-                    }
-                    else
-                    {
-                        throw std::runtime_error( "Unsupported access level <" + level + ">" );
-                    }
-                }
-                log_it(SLAPD_LOG_INFO, "access: " +  level );
-                if ( control.empty() && tmppos != std::string::npos )
-                {
-                    spos = tmppos+1;
-                    tmppos = extractAlcToken( aclString, spos, false );
-                    control = aclString.substr(spos, tmppos-spos);
-                    log_it(SLAPD_LOG_INFO, "control: " +  control );
-                    if ( control != "stop" && control != "break" && control != "continue" )
-                    {
-                        control = "";
-                        tmppos = spos-1;
-                    }
-                }
-                if (tmppos != std::string::npos )
-                {
-                    spos = aclString.find_first_not_of("\t ", tmppos+1 );
-                    if ( spos != std::string::npos )
-                    {
-                        tmppos = aclString.find_first_of("\t ", spos );
-                    }
-                    else
-                    {
-                        tmppos = spos;
-                    }
-                }
+                control = ValueSlice();
+                tokens.seek( pos );
             }
-            log_it(SLAPD_LOG_INFO, "level <"+level+"> type <"+type+"> value <"+value+"> control <" + control + ">" );
-            boost::shared_ptr<OlcAclBy> by( new OlcAclBy(level, type, value, control) );
-            m_byList.push_back(by);
         }
+        boost::shared_ptr<OlcAclBy> by( new OlcAclBy( level.str(), type.str(),
+                                                      value.str(), control.str() ) );
+        m_byList.push_back(by);
+        word = tokens.nextToken( false );
+    }
+    if ( m_byList.empty() )
+    {
+        throw std::runtime_error( "Error while parsing ACL by clause" );
     }
 }
 
@@ -863,48 +1615,25 @@ std::string OlcAccess::toAclString() const
 
 OlcLimits::OlcLimits( const std::string& limitString )
 {
-    std::string::size_type spos = 0;
-    std::string::size_type tmppos = 0;
     // limits look like this:  <selector> <limit> [<limit> [...]]
+    ValueTokenizer tokens( limitString );
 
-    // split of the selector pattern
-    tmppos = limitString.find_first_not_of("\t ", spos );
-    spos = tmppos;
-    tmppos = limitString.find_first_of("\t\" ", spos );
-    // skip quoted whitespaces
-    while ( limitString[tmppos] == '"'  && limitString[tmppos-1] != '\\')
-    {
-        tmppos = extractAlcToken( limitString, tmppos, true );
-        tmppos = limitString.find_first_of("\t\" ", tmppos+1 );
-    }
-    m_selector = limitString.substr(spos, tmppos-spos );
-    log_it(SLAPD_LOG_DEBUG, "selector: <"+m_selector+">" );
+    // split of the selector pattern, skipping quoted whitespaces
+    m_selector = tokens.nextQuotedWord().str();
 
     // now the list of <limits> follows
-    spos = tmppos;
-    if ( spos != std::string::npos )
-    {
-        spos = limitString.find_first_not_of("\t ", spos );
-    }
-    while ( spos != std::string::npos )
+    tokens.skipSpace();
+    while ( !tokens.atEnd() )
     {
-        tmppos = extractAlcToken( limitString, spos, false );
-        std::string tmp = limitString.substr( spos, tmppos-spos ); 
-        log_it(SLAPD_LOG_DEBUG, "limit: <"+tmp+">" );
-        std::string::size_type delimpos = tmp.find( '=' );
+        ValueSlice limit = tokens.nextToken( false );
+        std::string::size_type delimpos = limit.find( '=' );
         if ( delimpos == std::string::npos )
         {
             throw std::runtime_error( "error while parsing limits statement" );
         }
-        m_limits.push_back( make_pair(tmp.substr(0, delimpos), tmp.substr( delimpos+1 ) ));
-        if ( tmppos != std::string::npos )
-        {
-            spos = limitString.find_first_not_of("\t ", tmppos+1 );
-        }
-        else
-        {
-            break;
-        }
+        m_limits.push_back( make_pair( limit.substr( 0, delimpos ).str(),
+                                       limit.substr( delimpos+1 ).str() ) );
+        tokens.skipSpace();
     }
 }
 
@@ -963,121 +1692,110 @@ OlcSyncRepl::OlcSyncRepl( const std::string &syncreplLine):
         starttls( OlcSyncRepl::StartTlsNo )
 {
     log_it(SLAPD_LOG_DEBUG, "OlcSyncRepl::OlcSyncRepl(" + syncreplLine + ")");
-    if ( !syncreplLine.empty() )
+    ValueTokenizer tokens( syncreplLine );
+
+    // skip leading whitespaces
+    tokens.skipSpace();
+    while ( !tokens.atEnd() )
     {
-        std::string::size_type spos1=0, spos2=0;
+        ValueSlice key = tokens.nextWord( "=" );
+        tokens.advance();
+        std::string value = tokens.nextToken( true ).str();
+        tokens.skipSpace();
 
-        // skip leading whitespaces
-        spos2 = syncreplLine.find_first_not_of("\t ", spos1 );
-        while ( spos2 != std::string::npos && spos2 >= spos1 )
+        if ( key == RID )
         {
-            spos1 = spos2;
-            spos2 = syncreplLine.find_first_of("=", spos1 );
-            std::string key = syncreplLine.substr(spos1, spos2-spos1);
-            log_it(SLAPD_LOG_DEBUG, "Key: <" + key + ">");
-            spos1 = spos2 + 1;
-            spos2 = extractAlcToken(syncreplLine, spos1, true );
-            std::string value = syncreplLine.substr(spos1, spos2-spos1);
-            log_it(SLAPD_LOG_DEBUG, "Value: <" + value + ">");
-            if ( spos2 != std::string::npos )
-            {
-                spos1 = spos2 + 1;
-                spos2 = syncreplLine.find_first_not_of("\t ", spos1 );
-            }
-            if ( key == RID )
-            {
-                std::istringstream s(value);
-                s >> rid;
-            }
-            else if ( key == PROVIDER )
-            {
-                this->setProvider(value); 
-            }
-            else if ( key == BASE )
-            {
-                this->setSearchBase(value);
-            }
-            else if ( key == TYPE )
-            {
-                this->setType(value);
-            }
-            else if ( key == BINDMETHOD )
-            {
-                if ( value != "simple" )
-                {
-                    log_it(SLAPD_LOG_ERR, "Bind method " + value + " is currenty unsupported" );
-                    throw std::runtime_error( "Bind method " + value + " is currenty unsupported" );
-                }
-            }
-            else if ( key == BINDDN )
-            {
-                this->setBindDn(value);
-            }
-            else if ( key == CREDENTIALS )
+            std::istringstream s(value);
+            s >> rid;
+        }
+        else if ( key == PROVIDER )
+        {
+            this->setProvider(value); 
+        }
+        else if ( key == BASE )
+        {
+            this->setSearchBase(value);
+        }
+        else if ( key == TYPE )
+        {
+            this->setType(value);
+        }
+        else if ( key == BINDMETHOD )
+        {
+            if ( value != "simple" )
             {
-                this->setCredentials(value);
+                log_it(SLAPD_LOG_ERR, "Bind method " + value + " is currenty unsupported" );
+                throw std::runtime_error( "Bind method " + value + " is currenty unsupported" );
             }
-            else if ( key == INTERVAL )
-            {
-                istringstream intervalStr(value);
+        }
+        else if ( key == BINDDN )
+        {
+            this->setBindDn(value);
+        }
+        else if ( key == CREDENTIALS )
+        {
+            this->setCredentials(value);
+        }
+        else if ( key == INTERVAL )
+        {
+            istringstream intervalStr(value);
 
-                intervalStr.exceptions( std::ios::failbit | std::ios::badbit );
-                try 
-                {
-                    intervalStr >> refreshOnlyDays;
-                    intervalStr.get();
-                    intervalStr >> refreshOnlyHours;
-                    intervalStr.get();
-                    intervalStr >> refreshOnlyMins;
-                    intervalStr.get();
-                    intervalStr >> refreshOnlySecs;
-                } 
-                catch ( std::exception e)
-                {
-                    log_it(SLAPD_LOG_ERR, "Error parsing replication interval:\"" + value + "\"" );
-                    log_it(SLAPD_LOG_ERR, e.what()  );
-                    throw std::runtime_error( "Error parsing replication interval:\"" + value + "\"" );
-                }
-            }
-            else if ( key == STARTTLS )
-            {
-                if ( value == "critical" )
-                {
-                    this->setStartTls(OlcSyncRepl::StartTlsCritical);
-                }
-                else if ( value == "yes" )
-                {
-                    this->setStartTls(OlcSyncRepl::StartTlsYes);
-                }
-            }
-            else if ( key == RETRY )
-            {
-                this->setRetryString(value);
-            }
-            else if ( key == TLS_REQCERT )
+            intervalStr.exceptions( std::ios::failbit | std::ios::badbit );
+            try 
             {
-                this->setTlsReqCert(value);
-            }
-            else if ( key == NETWORK_TIMEOUT )
+                intervalStr >> refreshOnlyDays;
+                intervalStr.get();
+                intervalStr >> refreshOnlyHours;
+                intervalStr.get();
+                intervalStr >> refreshOnlyMins;
+                intervalStr.get();
+                intervalStr >> refreshOnlySecs;
+            } 
+            catch ( std::exception e)
             {
-                std::istringstream s(value);
-                s >> networkTimeout;
+                log_it(SLAPD_LOG_ERR, "Error parsing replication interval:\"" + value + "\"" );
+                log_it(SLAPD_LOG_ERR, e.what()  );
+                throw std::runtime_error( "Error parsing replication interval:\"" + value + "\"" );
             }
-            else if ( key == TIMEOUT )
+        }
+        else if ( key == STARTTLS )
+        {
+            if ( value == "critical" )
             {
-                std::istringstream s(value);
-                s >> timeout;
+                this->setStartTls(OlcSyncRepl::StartTlsCritical);
             }
-            else
+            else if ( value == "yes" )
             {
-                otherValues.push_back(make_pair(key, value));
+                this->setStartTls(OlcSyncRepl::StartTlsYes);
             }
         }
-    }
-}
-
-std::string OlcSyncRepl::toSyncReplLine() const
-{
+        else if ( key == RETRY )
+        {
+            this->setRetryString(value);
+        }
+        else if ( key == TLS_REQCERT )
+        {
+            this->setTlsReqCert(value);
+        }
+        else if ( key == NETWORK_TIMEOUT )
+        {
+            std::istringstream s(value);
+            s >> networkTimeout;
+        }
+        else if ( key == TIMEOUT )
+        {
+            std::istringstream s(value);
+            s >> timeout;
+        }
+        else
+        {
+            otherValues.push_back(make_pair(key.str(), value));
+        }
+    }
+}
+
+std::string OlcSyncRepl::toSyncReplLine() const
+{
     std::ostringstream srlStream;
 
     srlStream << "rid=" << rid << " "
@@ -1263,33 +1981,21 @@ int OlcSyncRepl::getTimeout() const
 OlcSecurity::OlcSecurity(const std::string &securityVal)
 {
     log_it(SLAPD_LOG_DEBUG, "OlcSecurity::OlcSecurity(" + securityVal + ")");
-    if ( !securityVal.empty() )
-    {
-        std::string::size_type spos1=0, spos2=0;
+    ValueTokenizer tokens( securityVal );
 
-        // skip leading whitespaces
-        spos2 = securityVal.find_first_not_of("\t ", spos1 );
-        while ( spos2 != std::string::npos && spos2 >= spos1 )
-        {
-            spos1 = spos2;
-            spos2 = securityVal.find_first_of("=", spos1 );
-            std::string key = securityVal.substr(spos1, spos2-spos1);
-            log_it(SLAPD_LOG_DEBUG, "Key: <" + key + ">");
-            spos1 = spos2 + 1;
-            spos2 = extractAlcToken(securityVal, spos1, false );
-            std::string value = securityVal.substr(spos1, spos2-spos1);
-            log_it(SLAPD_LOG_DEBUG, "Value: <" + value + ">");
-            if ( spos2 != std::string::npos )
-            {
-                spos1 = spos2 + 1;
-                spos2 = securityVal.find_first_not_of("\t ", spos1 );
-            }
+    // skip leading whitespaces
+    tokens.skipSpace();
+    while ( !tokens.atEnd() )
+    {
+        std::string key = tokens.nextWord( "=" ).str();
+        tokens.advance();
+        ValueSlice value = tokens.nextToken( false );
+        tokens.skipSpace();
 
-            int ival;
-            std::istringstream s(value);
-            s >> ival;
-            this->setSsf(key, ival);
-        }
+        int ival = 0;
+        std::istringstream s( value.str() );
+        s >> ival;
+        this->setSsf(key, ival);
     }
 }
 
@@ -1387,33 +2093,90 @@ void OlcServerId::setServerUri( const std::string &uri )
     serverUri = uri;
 }
 
-OlcDatabase::OlcDatabase( const LDAPEntry& le=LDAPEntry()) : OlcConfigEntry(le)
+OlcIdAllocator::OlcIdAllocator( int minId, int maxId )
+        : m_minId(minId), m_useCount( maxId - minId, 0 ), m_firstFree(minId)
+{
+}
+
+void OlcIdAllocator::clear()
+{
+    m_useCount.assign( m_useCount.size(), 0 );
+    m_firstFree = m_minId;
+}
+
+void OlcIdAllocator::markUsed( int id )
+{
+    if ( id >= m_minId && id - m_minId < (int) m_useCount.size() )
+    {
+        m_useCount[id - m_minId]++;
+    }
+}
+
+void OlcIdAllocator::release( int id )
+{
+    if ( id >= m_minId && id - m_minId < (int) m_useCount.size() &&
+         m_useCount[id - m_minId] > 0 )
+    {
+        if ( --m_useCount[id - m_minId] == 0 && id < m_firstFree )
+        {
+            m_firstFree = id;
+        }
+    }
+}
+
+bool OlcIdAllocator::isUsed( int id ) const
+{
+    return id >= m_minId && id - m_minId < (int) m_useCount.size() &&
+           m_useCount[id - m_minId] > 0;
+}
+
+int OlcIdAllocator::getFreeId() const
+{
+    while ( m_firstFree - m_minId < (int) m_useCount.size() &&
+            m_useCount[m_firstFree - m_minId] > 0 )
+    {
+        m_firstFree++;
+    }
+    if ( m_firstFree - m_minId < (int) m_useCount.size() )
+    {
+        return m_firstFree;
+    }
+    return 0;
+}
+
+OlcDatabase::OlcDatabase( const LDAPEntry& le=LDAPEntry()) : OlcConfigEntry(le),
+        m_aclVersion(0), m_limitsVersion(0), m_syncReplVersion(0)
 {
     std::string type(this->getStringValue("olcdatabase"));
     entryIndex = splitIndexFromString( type, m_type );
 }
 
-OlcDatabase::OlcDatabase( const std::string& type ) : m_type(type) 
+OlcDatabase::OlcDatabase( const std::string& type ) : m_type(type),
+        m_aclVersion(0), m_limitsVersion(0), m_syncReplVersion(0)
 {
     std::ostringstream dnstr;
     dnstr << "olcDatabase=" << m_type << ",cn=config";
-    m_dbEntryChanged.setDN(dnstr.str());
-    m_dbEntryChanged.addAttribute(LDAPAttribute("objectclass", "olcDatabaseConfig"));
-    m_dbEntryChanged.addAttribute(LDAPAttribute("olcDatabase", m_type));
+    this->setUpdatedDn(dnstr.str());
+    this->addStringValue("objectclass", "olcDatabaseConfig");
+    this->addStringValue("olcDatabase", m_type);
 }
 
 void OlcDatabase::updateEntryDn(bool origEntry )
 {
     log_it(SLAPD_LOG_INFO, "updateEntryDN()");
-    std::ostringstream dn, name;
-    name << "{" << entryIndex << "}" << m_type;
-    dn << "olcDatabase=" << name.str() << ",cn=config" ;
-    m_dbEntryChanged.setDN(dn.str());
-    m_dbEntryChanged.replaceAttribute(LDAPAttribute("olcDatabase", name.str()));
+    std::ostringstream index;
+    index << "{" << entryIndex << "}";
+    const LDAPAttribute name( "olcDatabase", index.str() + m_type );
+    const std::string dn = "olcDatabase=" + index.str() + m_type + ",cn=config";
+    if ( ! this->isDeletedEntry() )
+    {
+        this->setUpdatedDn(dn);
+        this->replaceAttribute(name);
+    }
     if ( origEntry && (! m_dbEntry.getDN().empty()) )
     {
-        m_dbEntry.setDN(dn.str());
-        m_dbEntry.replaceAttribute(LDAPAttribute("olcDatabase", name.str()));
+        m_dbEntry.setDN(dn);
+        this->replaceOrigAttribute(name);
     }
 }
 
@@ -1459,14 +2222,53 @@ const std::string OlcDatabase::getType() const
     return this->m_type;
 }
 
+// callers modify the returned ACLs and limits before writing them back, so
+// they get their own copies of the cached ones, like with getSyncRepl()
+static void copyAcls( const OlcAccessList &from, OlcAccessList &to )
+{
+    to.clear();
+    to.reserve( from.size() );
+    OlcAccessList::const_iterator i;
+    for ( i = from.begin(); i != from.end(); i++ )
+    {
+        boost::shared_ptr<OlcAccess> acl( new OlcAccess( **i ) );
+        OlcAclByList byList = acl->getAclByList();
+        OlcAclByList::iterator j;
+        for ( j = byList.begin(); j != byList.end(); j++ )
+        {
+            j->reset( new OlcAclBy( **j ) );
+        }
+        acl->setByList( byList );
+        to.push_back( acl );
+    }
+}
+
+static void copyLimits( const OlcLimitList &from, OlcLimitList &to )
+{
+    to.clear();
+    to.reserve( from.size() );
+    OlcLimitList::const_iterator i;
+    for ( i = from.begin(); i != from.end(); i++ )
+    {
+        to.push_back( boost::shared_ptr<OlcLimits>( new OlcLimits( **i ) ) );
+    }
+}
+
 bool OlcDatabase::getAcl(OlcAccessList &aclList) const
 {
-    const LDAPAttribute* aclAttr = m_dbEntryChanged.getAttributeByName("olcAccess");
+    unsigned long version = this->getAttributeVersion("olcAccess");
+    if ( m_aclVersion == version )
+    {
+        copyAcls( m_aclCache, aclList );
+        return m_aclParsed;
+    }
+    const LDAPAttribute* aclAttr = this->getAttribute("olcAccess");
     aclList.clear();
     bool ret = true;
     if ( aclAttr )
     {
-        StringList values = aclAttr->getValues();
+        const StringList &values = aclAttr->getValues();
+        aclList.reserve( values.size() );
         StringList::const_iterator i;
         for ( i =  values.begin(); i != values.end(); i++ )
         {
@@ -1487,6 +2289,10 @@ bool OlcDatabase::getAcl(OlcAccessList &aclList) const
             }
         }
     }
+    m_aclCache = aclList;
+    m_aclParsed = ret;
+    m_aclVersion = version;
+    copyAcls( m_aclCache, aclList );
     return ret;
 }
 
@@ -1517,13 +2323,20 @@ void OlcDatabase::replaceAccessControl(const OlcAccessList& acllist )
 
 bool OlcDatabase::getLimits(OlcLimitList &limitList) const
 {
-    const LDAPAttribute* limitsAttr = m_dbEntryChanged.getAttributeByName("olcLimits");
+    unsigned long version = this->getAttributeVersion("olcLimits");
+    if ( m_limitsVersion == version )
+    {
+        copyLimits( m_limitsCache, limitList );
+        return m_limitsParsed;
+    }
+    const LDAPAttribute* limitsAttr = this->getAttribute("olcLimits");
     log_it(SLAPD_LOG_INFO, "OlcDatabase::getLimits()");
     limitList.clear();
     bool ret = true;
     if ( limitsAttr )
     {
-        StringList values = limitsAttr->getValues();
+        const StringList &values = limitsAttr->getValues();
+        limitList.reserve( values.size() );
         StringList::const_iterator i;
         for ( i =  values.begin(); i != values.end(); i++ )
         {
@@ -1548,6 +2361,10 @@ bool OlcDatabase::getLimits(OlcLimitList &limitList) const
     {
         log_it(SLAPD_LOG_INFO, "no limit set");
     }
+    m_limitsCache = limitList;
+    m_limitsParsed = ret;
+    m_limitsVersion = version;
+    copyLimits( m_limitsCache, limitList );
     return ret;
 }
 
@@ -1566,7 +2383,27 @@ void OlcDatabase::replaceLimits( const OlcLimitList& limits )
 
 OlcSyncReplList OlcDatabase::getSyncRepl() const
 {
-    const LDAPAttribute* srAttr = m_dbEntryChanged.getAttributeByName("olcSyncrepl");
+    unsigned long version = this->getAttributeVersion("olcSyncrepl");
+    if ( m_syncReplVersion != version )
+    {
+        m_syncReplCache = this->parseSyncRepl();
+        m_syncReplVersion = version;
+    }
+    // callers usually modify the returned objects before writing them back
+    // with setSyncRepl(), so they get their own copies
+    OlcSyncReplList res;
+    res.reserve( m_syncReplCache.size() );
+    OlcSyncReplList::const_iterator i;
+    for ( i = m_syncReplCache.begin(); i != m_syncReplCache.end(); i++ )
+    {
+        res.push_back( boost::shared_ptr<OlcSyncRepl>( new OlcSyncRepl( **i ) ) );
+    }
+    return res;
+}
+
+OlcSyncReplList OlcDatabase::parseSyncRepl() const
+{
+    const LDAPAttribute* srAttr = this->getAttribute("olcSyncrepl");
     OlcSyncReplList res;
 
     if (! srAttr )
@@ -1574,7 +2411,8 @@ OlcSyncReplList OlcDatabase::getSyncRepl() const
         return res;
     }
 
-    StringList values = srAttr->getValues();
+    const StringList &values = srAttr->getValues();
+    res.reserve( values.size() );
     for ( StringList::const_iterator i = values.begin();
           i != values.end();
           i++ )
@@ -1632,6 +2470,36 @@ OlcOverlayList& OlcDatabase::getOverlays()
     return m_overlays;
 }
 
+void OlcDatabase::renumber( std::vector<boost::shared_ptr<OlcDatabase> >::iterator first,
+                            std::vector<boost::shared_ptr<OlcDatabase> >::iterator last,
+                            int offset )
+{
+    int count = 0;
+    for ( ; first != last; first++ )
+    {
+        OlcDatabase &db = **first;
+        // a deleted database is only renamed to the DN it has when its
+        // delete is sent, it stays deleted
+        if ( ! db.isDeletedEntry() )
+        {
+            count++;
+        }
+        db.entryIndex += offset;
+        db.updateEntryDn( true );
+
+        // the overlays only get the new DN of their parent
+        const std::string parent = db.isDeletedEntry() ? db.getDn() : db.getUpdatedDn();
+        OlcOverlayList::const_iterator i;
+        for ( i = db.m_overlays.begin(); i != db.m_overlays.end(); i++ )
+        {
+            (*i)->newParentDn( parent );
+        }
+    }
+    std::ostringstream msg;
+    msg << "Renumbered " << count << " databases by " << offset;
+    log_it(SLAPD_LOG_INFO, msg.str() );
+}
+
 void OlcDatabase::resetMemberAttrs()
 {
     std::string type(this->getStringValue("olcdatabase"));
@@ -1665,16 +2533,33 @@ OlcDatabase* OlcDatabase::createFromLdapEntry( const LDAPEntry& e)
     }
 }
 
+boost::shared_ptr<OlcDatabase> OlcDatabase::createFromLdapEntry( const LDAPEntry& e,
+                                                                 const OlcArenaPtr &arena )
+{
+    boost::shared_ptr<OlcDatabase> db;
+    if ( OlcDatabase::isBdbDatabase( e ) )
+    {
+        log_it(SLAPD_LOG_INFO,"creating OlcBbdDatabase()" );
+        db = olcCreate<OlcBdbDatabase>( arena, e );
+    }
+    else
+    {
+        log_it(SLAPD_LOG_INFO,"creating OlcDatabase()" );
+        db = olcCreate<OlcDatabase>( arena, e );
+    }
+    return db;
+}
+
 
 OlcBdbDatabase::OlcBdbDatabase( const std::string& type ) : OlcDatabase(type) 
 { 
     if ( type == "hdb" )
     {
-        m_dbEntryChanged.addAttribute(LDAPAttribute("objectclass", "olcHdbConfig"));
+        this->addStringValue("objectclass", "olcHdbConfig");
     }
     else
     {
-        m_dbEntryChanged.addAttribute(LDAPAttribute("objectclass", "olcBdbConfig"));
+        this->addStringValue("objectclass", "olcBdbConfig");
     }
 }
 
@@ -1728,8 +2613,7 @@ inline std::vector<IndexType> indexString2Type( const std::string &indexes )
 
 IndexMap OlcBdbDatabase::getDatabaseIndexes() const
 {
-    const LDAPAttributeList *al = m_dbEntryChanged.getAttributes();
-    const LDAPAttribute *attr = al->getAttributeByName("olcdbindex");
+    const LDAPAttribute *attr = this->getAttribute("olcdbindex");
     IndexMap res;
     if (! attr ) {
         return res;
@@ -1750,8 +2634,7 @@ IndexMap OlcBdbDatabase::getDatabaseIndexes() const
 
 std::vector<IndexType> OlcBdbDatabase::getDatabaseIndex( const std::string &type ) const
 {
-    const LDAPAttributeList *al = m_dbEntryChanged.getAttributes();
-    const LDAPAttribute *attr = al->getAttributeByName("olcdbindex");
+    const LDAPAttribute *attr = this->getAttribute("olcdbindex");
     std::vector<IndexType> res;
     if (! attr ) {
         return res;
@@ -1804,7 +2687,7 @@ void OlcBdbDatabase::addIndex(const std::string& attr, const std::vector<IndexTy
 
 void OlcBdbDatabase::deleteIndex(const std::string& type)
 {
-    const LDAPAttribute *attr = m_dbEntryChanged.getAttributes()->getAttributeByName("olcdbindex");
+    const LDAPAttribute *attr = this->getAttribute("olcdbindex");
     if (! attr ) {
         return;
     };
@@ -1892,9 +2775,9 @@ void OlcBdbDatabase::getCheckPoint( int& kbytes, int& min) const
 
 OlcGlobalConfig::OlcGlobalConfig() : OlcConfigEntry()
 {
-    m_dbEntryChanged.setDN("cn=config");
-    m_dbEntryChanged.addAttribute(LDAPAttribute("objectclass", "olcGlobal"));
-    m_dbEntryChanged.addAttribute(LDAPAttribute("cn", "config"));
+    this->setUpdatedDn("cn=config");
+    this->addStringValue("objectclass", "olcGlobal");
+    this->addStringValue("cn", "config");
 }
 
 OlcGlobalConfig::OlcGlobalConfig( const LDAPEntry &le) : OlcConfigEntry(le)
@@ -1925,7 +2808,7 @@ const std::vector<std::string> OlcGlobalConfig::getLogLevelString() const
 }
 
 void OlcGlobalConfig::setLogLevel(const std::list<std::string> &level) {
-    const LDAPAttribute *sattr = m_dbEntryChanged.getAttributeByName("olcloglevel");
+    const LDAPAttribute *sattr = this->getAttribute("olcloglevel");
     LDAPAttribute attr( "olcloglevel" );
     if ( sattr ) {
         attr = *sattr;
@@ -1937,17 +2820,11 @@ void OlcGlobalConfig::setLogLevel(const std::list<std::string> &level) {
         values.add(*i);
     }
     attr.setValues(values);
-    m_dbEntryChanged.replaceAttribute(attr);
+    this->replaceAttribute(attr);
 }
 
 void OlcGlobalConfig::addLogLevel(std::string level) {
-    const LDAPAttribute *sattr = m_dbEntryChanged.getAttributeByName("olcloglevel");
-    LDAPAttribute attr;
-    if ( sattr ) {
-        attr = *sattr;
-    }
-    attr.addValue(level);
-    m_dbEntryChanged.replaceAttribute(attr);
+    this->addStringValue("olcloglevel", level);
 }
 
 const std::vector<std::string> OlcGlobalConfig::getAllowFeatures() const
@@ -1964,7 +2841,7 @@ const std::vector<std::string> OlcGlobalConfig::getAllowFeatures() const
 
 void OlcGlobalConfig::setAllowFeatures(const std::list<std::string> &allow )
 {
-    const LDAPAttribute *sattr = m_dbEntryChanged.getAttributeByName("olcAllows");
+    const LDAPAttribute *sattr = this->getAttribute("olcAllows");
     LDAPAttribute attr( "olcAllows" );
     if ( sattr ) {
         attr = *sattr;
@@ -1976,7 +2853,7 @@ void OlcGlobalConfig::setAllowFeatures(const std::list<std::string> &allow )
         values.add(*i);
     }
     attr.setValues(values);
-    m_dbEntryChanged.replaceAttribute(attr);
+    this->replaceAttribute(attr);
 }
 
 const std::vector<std::string> OlcGlobalConfig::getDisallowFeatures() const
@@ -1993,7 +2870,7 @@ const std::vector<std::string> OlcGlobalConfig::getDisallowFeatures() const
 
 void OlcGlobalConfig::setDisallowFeatures(const std::list<std::string> &disallow )
 {
-    const LDAPAttribute *sattr = m_dbEntryChanged.getAttributeByName("olcDisallows");
+    const LDAPAttribute *sattr = this->getAttribute("olcDisallows");
     LDAPAttribute attr( "olcDisallows" );
     if ( sattr ) {
         attr = *sattr;
@@ -2005,7 +2882,7 @@ void OlcGlobalConfig::setDisallowFeatures(const std::list<std::string> &disallow
         values.add(*i);
     }
     attr.setValues(values);
-    m_dbEntryChanged.replaceAttribute(attr);
+    this->replaceAttribute(attr);
 }
 
 
@@ -2056,9 +2933,9 @@ const std::string OlcSchemaConfig::schemabase = "cn=schema,cn=config";
 
 OlcSchemaConfig::OlcSchemaConfig() : OlcConfigEntry()
 {
-    m_dbEntryChanged.setDN("cn=schema,cn=config");
-    m_dbEntryChanged.addAttribute(LDAPAttribute("objectclass", "olcSchemaConfig"));
-    m_dbEntryChanged.addAttribute(LDAPAttribute("cn", "schema"));
+    this->setUpdatedDn("cn=schema,cn=config");
+    this->addStringValue("objectclass", "olcSchemaConfig");
+    this->addStringValue("cn", "schema");
 }
 
 OlcSchemaConfig::OlcSchemaConfig(const LDAPEntry &e) : OlcConfigEntry(e)
@@ -2146,12 +3023,12 @@ void OlcSchemaConfig::updateEntryDn(bool origEntry )
     std::ostringstream dn, name;
     name << "{" << entryIndex << "}" << m_name;
     dn << "cn=" << name.str() << "," << "cn=schema,cn=config";
-    m_dbEntryChanged.setDN(dn.str());
-    m_dbEntryChanged.replaceAttribute(LDAPAttribute("cn", name.str()));
+    this->setUpdatedDn(dn.str());
+    this->replaceAttribute(LDAPAttribute("cn", name.str()));
     if ( origEntry && (! m_dbEntry.getDN().empty()) )
     {
         m_dbEntry.setDN(dn.str());
-        m_dbEntry.replaceAttribute(LDAPAttribute("cn", name.str()));
+        this->replaceOrigAttribute(LDAPAttribute("cn", name.str()));
     }
 }
 
@@ -2269,190 +3146,2045 @@ void OlcTlsSettings::setCrlFile(const std::string& file)
     m_crlFile = file;
 }
 
-OlcConfig::OlcConfig(LDAPConnection *lc) : m_lc(lc)
+static bool isBelowDn( const std::string &dn, const std::string &base )
 {
+    return dn.size() > base.size() + 1 &&
+           dn.compare( dn.size() - base.size(), base.size(), base ) == 0 &&
+           dn[dn.size() - base.size() - 1] == ',';
 }
 
-bool OlcConfig::hasConnection() const
+static long long monotonicMicros()
 {
-    if ( m_lc )
-    {
-        return true;
-    }
-    else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+const long long OlcOperationStats::histogramBounds[] = {
+    100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000,
+    200000, 500000, 1000000, 2000000, 5000000 };
+
+OlcOperationStats::OlcOperationStats() : count(0), failed(0), totalMicros(0),
+        maxMicros(0)
+{
+    std::fill( histogram, histogram + HISTOGRAM_BUCKETS, 0 );
+}
+
+void OlcOperationStats::add( long long micros, bool success )
+{
+    count++;
+    if ( ! success )
     {
-        return false;
+        failed++;
     }
+    totalMicros += micros;
+    maxMicros = std::max( maxMicros, micros );
+    histogram[ std::upper_bound( histogramBounds, histogramBounds + HISTOGRAM_BUCKETS - 1,
+                                 micros ) - histogramBounds ]++;
 }
 
-boost::shared_ptr<OlcGlobalConfig> OlcConfig::getGlobals()
+OlcStatistics::DnClass OlcStatistics::dnClass( const std::string &dn )
 {
-    LDAPSearchResults *sr;
-    LDAPEntry *dbEntry;
-    if ( ! m_lc )
+    std::string ndn = normalizeDn( dn );
+    if ( ndn == "cn=config" )
     {
-        throw std::runtime_error( "LDAP Connection not initialized" );
+        return GLOBAL;
     }
-    try {
-        sr = m_lc->search( "cn=config", LDAPConnection::SEARCH_BASE);
-        dbEntry = sr->getNext();
-    } catch (LDAPException e) {
-        log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
-        throw;
+    if ( ndn == "cn=schema,cn=config" || isBelowDn( ndn, "cn=schema,cn=config" ) )
+    {
+        return SCHEMA;
     }
-    if ( dbEntry ) {
-        log_it(SLAPD_LOG_INFO,"Got GlobalConfig: " + dbEntry->getDN() );
-        boost::shared_ptr<OlcGlobalConfig> gc( new OlcGlobalConfig(*dbEntry) );
-        return gc;
+    if ( ndn.compare( 0, 12, "olcdatabase=" ) == 0 )
+    {
+        return DATABASE;
     }
-    boost::shared_ptr<OlcGlobalConfig> gc( new OlcGlobalConfig() );
-    return gc;
+    if ( ndn.compare( 0, 11, "olcoverlay=" ) == 0 )
+    {
+        return OVERLAY;
+    }
+    return OTHER;
 }
 
-void OlcConfig::setGlobals( OlcGlobalConfig &olcg)
+const char* OlcStatistics::operationName( Operation op )
 {
-    if ( ! m_lc )
+    static const char *names[] = { "search", "add", "modify", "delete", "extended" };
+    return names[op];
+}
+
+const char* OlcStatistics::dnClassName( DnClass dnClass )
+{
+    static const char *names[] = { "global", "database", "overlay", "schema", "other" };
+    return names[dnClass];
+}
+
+void OlcStatistics::record( Operation op, DnClass dnClass, long long micros, bool success )
+{
+    m_stats[op][dnClass].add( micros, success );
+}
+
+const OlcOperationStats& OlcStatistics::get( Operation op, DnClass dnClass ) const
+{
+    return m_stats[op][dnClass];
+}
+
+void OlcStatistics::clear()
+{
+    for ( int i = 0; i < OPERATIONS; i++ )
     {
-        throw std::runtime_error( "LDAP Connection not initialized" );
-    }
-    try {
-        LDAPModList ml = olcg.entryDifftoMod();
-        m_lc->modify( olcg.getDn(), &ml );
-    } catch (LDAPException e) {
-        log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
-        throw;
+        std::fill( m_stats[i], m_stats[i] + DN_CLASSES, OlcOperationStats() );
     }
 }
 
-void OlcConfig::updateEntry( OlcConfigEntry &oce )
+// Measures the latency of a synchronous LDAP operation. If the timer goes
+// out of scope before done() is called (i.e. the operation threw an
+// exception) the operation is counted as failed.
+class OperationTimer
 {
-    try {
-        bool reread = true;
-        log_it(SLAPD_LOG_INFO, "updateEntry() Old DN: "+oce.getDn()+" ChangedDN: "+ oce.getChangedEntry().getDN() );
-//        log_it(SLAPD_LOG_INFO, " LDIF "+oce.toLdif() );
-        if ( ! m_lc )
+    public:
+        OperationTimer( OlcStatistics &stats, OlcTraffic &traffic,
+                        OlcStatistics::Operation op, const std::string &dn )
+            : m_stats(stats), m_op(op), m_dnClass( OlcStatistics::dnClass(dn) ),
+              m_start( monotonicMicros() ), m_done(false)
         {
-            throw std::runtime_error( "LDAP Connection not initialized" );
+            traffic.roundTrips++;
         }
-        if ( oce.isNewEntry () ) 
+
+        ~OperationTimer()
         {
-            m_lc->add(&oce.getChangedEntry());
-        } else if (oce.isDeletedEntry() ) {
-            m_lc->del(oce.getDn());
-            reread = false;
-        } else {
-            LDAPModList ml = oce.entryDifftoMod();
-            if ( ! ml.empty() ) {
-                m_lc->modify( oce.getDn(), &ml );
-            } else {
-                log_it(SLAPD_LOG_INFO, oce.getDn() + ": no changes" );
-                reread = false;
+            if ( ! m_done )
+            {
+                this->done( false );
             }
         }
-        // re-read Entry from Server
-        if ( reread )
+
+        // leaves time spent on the client (e.g. processing the entries
+        // of a search) out of the latency
+        void exclude( long long micros )
         {
-            LDAPSearchResults *sr = m_lc->search( oce.getUpdatedDn(), LDAPConnection::SEARCH_BASE);
-            LDAPEntry *e = sr->getNext();
-            if ( e ) {
-                log_it(SLAPD_LOG_INFO,"Re-read Entry " + e->getDN() );
-                oce.resetEntries( *e );
-                delete(e);
-            }
-            delete(sr);
+            m_start += micros;
         }
-    } catch (LDAPException e) {
-        log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
-        throw;
-    }
-}
 
-/*
- * This function triggers a simple Modify Operation ( basically a NO-OP) to
- * the config backend, if slapd is currently running an indexing task this
- * Operation will block until that task is finished as back-config can only
- * complete that operation when it's the only active thread.
- */
-void OlcConfig::waitForBackgroundTasks()
+        void done( bool success = true )
+        {
+            m_stats.record( m_op, m_dnClass, monotonicMicros() - m_start, success );
+            m_done = true;
+        }
+
+    private:
+        OlcStatistics &m_stats;
+        OlcStatistics::Operation m_op;
+        OlcStatistics::DnClass m_dnClass;
+        long long m_start;
+        bool m_done;
+};
+
+static unsigned long entrySize( const LDAPEntry &entry )
 {
-    try {
-        boost::shared_ptr<OlcGlobalConfig> globals = this->getGlobals();
-        std::string attrval = globals->getStringValue("olcArgsFIle");
-        LDAPModification mod( LDAPAttribute("olcArgsFIle", attrval), LDAPModification::OP_ADD );
-        LDAPModList ml;
-        ml.addModification(mod);
-        m_lc->modify( "cn=config", &ml );
-    } catch (LDAPException e) {
-        if (e.getResultCode() != LDAPResult::ATTRIBUTE_OR_VALUE_EXISTS )
+    unsigned long size = entry.getDN().size();
+    const LDAPAttributeList *attrs = entry.getAttributes();
+    LDAPAttributeList::const_iterator i;
+    for ( i = attrs->begin(); i != attrs->end(); i++ )
+    {
+        size += i->getName().size();
+        const StringList &values = i->getValues();
+        StringList::const_iterator j;
+        for ( j = values.begin(); j != values.end(); j++ )
         {
-            log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
-            throw;
+            size += j->size();
         }
     }
+    return size;
 }
 
-OlcDatabaseList OlcConfig::getDatabases()
+static void countEntry( OlcTraffic &traffic, const LDAPEntry &entry )
 {
-    OlcDatabaseList res;
-    if ( ! m_lc )
+    traffic.entries++;
+    traffic.bytes += entrySize( entry );
+}
+
+OlcConnectionPool::Key::Key( const std::string &url, bool startTls,
+                            const std::string &caCert )
+        : url(url), startTls(startTls), caCert(caCert)
+{
+}
+
+bool OlcConnectionPool::Key::operator<( const Key &key ) const
+{
+    if ( url != key.url )
+        return url < key.url;
+    if ( startTls != key.startTls )
+        return startTls < key.startTls;
+    return caCert < key.caCert;
+}
+
+OlcConnectionPool::OlcConnectionPool( int idleTimeout ) : m_idleTimeout(idleTimeout)
+{
+}
+
+OlcConnectionPool::~OlcConnectionPool()
+{
+    std::multimap<Key, Connection>::iterator i;
+    for ( i = m_idle.begin(); i != m_idle.end(); i++ )
     {
-        throw std::runtime_error( "LDAP Connection not initialized" );
+        delete i->second.lc;
     }
-    try {
-        LDAPSearchResults *sr = m_lc->search( "cn=config", 
-                LDAPConnection::SEARCH_ONE, "objectclass=olcDatabaseConfig" );
-        LDAPEntry *dbEntry;
-        while ( (dbEntry = sr->getNext()) )
-        {
-            std::string dbDn(dbEntry->getDN());
-            log_it(SLAPD_LOG_INFO,"Got Database Entry: " + dbDn);
-            boost::shared_ptr<OlcDatabase> olce(OlcDatabase::createFromLdapEntry(*dbEntry));
-            LDAPSearchResults *overlaySearchRes = m_lc->search( dbDn, 
-                    LDAPConnection::SEARCH_ONE, "objectclass=olcOverlayConfig" );
-            LDAPEntry *overlayEntry;
-            while ( (overlayEntry = overlaySearchRes->getNext()) )
-            {
-                log_it(SLAPD_LOG_INFO,"Got Overlay: " + overlayEntry->getDN() );
-                boost::shared_ptr<OlcOverlay> overlay(OlcOverlay::createFromLdapEntry(*overlayEntry) );
-                olce->addOverlay(overlay);
-            }
-            res.push_back(olce);
-        }
-    } catch (LDAPException e ) {
-        log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
-        throw;
+    std::map<LDAPAsynConnection*, std::pair<Key, Connection> >::iterator j;
+    for ( j = m_inUse.begin(); j != m_inUse.end(); j++ )
+    {
+        delete j->first;
     }
-    return res;
 }
 
-OlcSchemaList OlcConfig::getSchemaNames()
+LDAPAsynConnection* OlcConnectionPool::acquire( const Key &key, State &state )
 {
-    OlcSchemaList res;
-    if ( ! m_lc )
+    this->expire();
+    std::multimap<Key, Connection>::iterator found = m_idle.find( key );
+    Connection c;
+    if ( found != m_idle.end() )
     {
-        throw std::runtime_error( "LDAP Connection not initialized" );
+        c = found->second;
+        m_idle.erase( found );
+        state = BIND;
+        log_it(SLAPD_LOG_DEBUG, "Reusing connection to " + key.url );
     }
-    try {
-        StringList attrs;
-        LDAPSearchResults *sr = m_lc->search( "cn=schema,cn=config", 
-                LDAPConnection::SEARCH_SUB, "objectclass=olcSchemaConfig" );
-        LDAPEntry *entry;
-        while ( (entry = sr->getNext()) )
+    else
+    {
+        c.lc = new LDAPAsynConnection( key.url );
+        if ( ! key.caCert.empty() )
         {
-            log_it(SLAPD_LOG_INFO,"Got Schema Entry: " + entry->getDN() );
-            boost::shared_ptr<OlcSchemaConfig> olce(new OlcSchemaConfig(*entry));
-            res.push_back(olce);
+            TlsOptions tls = c.lc->getTlsOptions();
+            tls.setOption( TlsOptions::CACERTFILE, key.caCert );
         }
-    } catch (LDAPException e ) {
-        log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
-        throw;
+        state = NEW;
+        log_it(SLAPD_LOG_DEBUG, "New connection to " + key.url );
     }
-    return res;
+    m_inUse.insert( std::make_pair( c.lc, std::make_pair( key, c ) ) );
+    return c.lc;
 }
 
-void OlcConfig::setLogCallback( SlapdConfigLogCallback *lcb )
+void OlcConnectionPool::release( LDAPAsynConnection *lc )
 {
-    OlcConfig::logCallback = lcb;
+    std::map<LDAPAsynConnection*, std::pair<Key, Connection> >::iterator i = m_inUse.find( lc );
+    if ( i == m_inUse.end() )
+    {
+        return;
+    }
+    Connection c = i->second.second;
+    c.lastUsed = time( 0 );
+    m_idle.insert( std::make_pair( i->second.first, c ) );
+    m_inUse.erase( i );
+    this->expire();
+}
+
+void OlcConnectionPool::discard( LDAPAsynConnection *lc )
+{
+    std::map<LDAPAsynConnection*, std::pair<Key, Connection> >::iterator i = m_inUse.find( lc );
+    if ( i != m_inUse.end() )
+    {
+        m_inUse.erase( i );
+        delete lc;
+    }
+}
+
+void OlcConnectionPool::expire()
+{
+    time_t now = time( 0 );
+    std::multimap<Key, Connection>::iterator i = m_idle.begin();
+    while ( i != m_idle.end() )
+    {
+        if ( now - i->second.lastUsed > m_idleTimeout )
+        {
+            log_it(SLAPD_LOG_DEBUG, "Closing idle connection to " + i->first.url );
+            delete i->second.lc;
+            m_idle.erase( i++ );
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+unsigned int OlcConnectionPool::idleConnections() const
+{
+    return m_idle.size();
+}
+
+OlcConfig::OlcConfig(LDAPAsynConnection *lc) : m_lc(lc), m_arenaBlockSize(0),
+        m_localUpdates(false), m_txnChecked(false), m_txnSupported(false)
+{
+}
+
+void OlcConfig::setCacheFile( const std::string &path )
+{
+    m_cacheFile = path;
+}
+
+void OlcConfig::setLocalUpdates( bool enable )
+{
+    m_localUpdates = enable;
+}
+
+void OlcConfig::setArenaBlockSize( std::size_t size )
+{
+    m_arenaBlockSize = size;
+}
+
+OlcArenaPtr OlcConfig::newArena() const
+{
+    if ( m_arenaBlockSize == 0 )
+    {
+        return OlcArenaPtr();
+    }
+    return OlcArenaPtr( new OlcArena( m_arenaBlockSize ) );
+}
+
+bool OlcConfig::hasConnection() const
+{
+    if ( m_lc )
+    {
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+// Waits for the final result of an operation, the entries of a search are
+// skipped. Throws an LDAPException if the operation failed, otherwise the
+// result belongs to the caller.
+static LDAPResult* readResult( LDAPMessageQueue *queue )
+{
+    boost::scoped_ptr<LDAPMessageQueue> q( queue );
+    for (;;)
+    {
+        LDAPMsg *msg = q->getNext();
+        int type = msg->getMessageType();
+        if ( type == LDAPMsg::SEARCH_ENTRY || type == LDAPMsg::SEARCH_REFERENCE )
+        {
+            delete(msg);
+            continue;
+        }
+        LDAPResult *res = dynamic_cast<LDAPResult*>( msg );
+        if ( ! res || res->getResultCode() != LDAPResult::SUCCESS )
+        {
+            LDAPException e( res ? res->getResultCode() : (int) LDAPResult::OTHER,
+                             res ? res->getErrMsg() : std::string( "Unexpected response" ) );
+            delete(msg);
+            throw e;
+        }
+        return res;
+    }
+}
+
+void OlcConfig::waitForResult( LDAPMessageQueue *queue )
+{
+    delete( readResult( queue ) );
+}
+
+// keeps the first entry of a search
+class EntryReader : public OlcEntryHandler
+{
+    public:
+        EntryReader() : m_found(false) {}
+
+        virtual bool handleEntry( const LDAPEntry &entry )
+        {
+            if ( ! m_found )
+            {
+                m_entry = entry;
+                m_found = true;
+            }
+            return true;
+        }
+
+        const LDAPEntry* getEntry() const
+        {
+            return m_found ? &m_entry : 0;
+        }
+
+    private:
+        LDAPEntry m_entry;
+        bool m_found;
+};
+
+boost::shared_ptr<OlcGlobalConfig> OlcConfig::getGlobals()
+{
+    EntryReader reader;
+    this->searchEntries( "cn=config", LDAPAsynConnection::SEARCH_BASE, "objectclass=*", reader );
+    const LDAPEntry *dbEntry = reader.getEntry();
+    if ( dbEntry ) {
+        log_it(SLAPD_LOG_INFO,"Got GlobalConfig: " + dbEntry->getDN() );
+        boost::shared_ptr<OlcGlobalConfig> gc( new OlcGlobalConfig(*dbEntry) );
+        return gc;
+    }
+    boost::shared_ptr<OlcGlobalConfig> gc( new OlcGlobalConfig() );
+    return gc;
+}
+
+void OlcConfig::setGlobals( OlcGlobalConfig &olcg)
+{
+    if ( ! m_lc )
+    {
+        throw std::runtime_error( "LDAP Connection not initialized" );
+    }
+    try {
+        LDAPModList ml = olcg.entryDifftoMod();
+        OperationTimer timer( m_stats, m_traffic, OlcStatistics::MODIFY, olcg.getDn() );
+        waitForResult( m_lc->modify( olcg.getDn(), &ml ) );
+        timer.done();
+    } catch (LDAPException e) {
+        log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
+        throw;
+    }
+}
+
+void OlcConfig::updateEntry( OlcConfigEntry &oce )
+{
+    try {
+        bool reread = true;
+        log_it(SLAPD_LOG_INFO, "updateEntry() Old DN: "+oce.getDn()+" ChangedDN: "+ oce.getChangedEntry().getDN() );
+//        log_it(SLAPD_LOG_INFO, " LDIF "+oce.toLdif() );
+        if ( ! m_lc )
+        {
+            throw std::runtime_error( "LDAP Connection not initialized" );
+        }
+        if ( oce.isNewEntry () ) 
+        {
+            OperationTimer timer( m_stats, m_traffic, OlcStatistics::ADD, oce.getUpdatedDn() );
+            m_traffic.bytes += entrySize( oce.getChangedEntry() );
+            waitForResult( m_lc->add(&oce.getChangedEntry()) );
+            timer.done();
+        } else if (oce.isDeletedEntry() ) {
+            OperationTimer timer( m_stats, m_traffic, OlcStatistics::DELETE, oce.getDn() );
+            waitForResult( m_lc->del(oce.getDn()) );
+            timer.done();
+            reread = false;
+        } else {
+            LDAPModList ml = oce.entryDifftoMod();
+            if ( ! ml.empty() ) {
+                OperationTimer timer( m_stats, m_traffic, OlcStatistics::MODIFY, oce.getDn() );
+                waitForResult( m_lc->modify( oce.getDn(), &ml ) );
+                timer.done();
+            } else {
+                log_it(SLAPD_LOG_INFO, oce.getDn() + ": no changes" );
+                reread = false;
+            }
+        }
+        if ( reread && m_localUpdates && ! oce.isNewEntry() )
+        {
+            // the server applied exactly the modifications we sent
+            log_it(SLAPD_LOG_INFO,"Applying changes locally " + oce.getUpdatedDn() );
+            oce.applyChanges();
+        }
+        // re-read Entry from Server
+        else if ( reread )
+        {
+            EntryReader reader;
+            this->searchEntries( oce.getUpdatedDn(), LDAPAsynConnection::SEARCH_BASE,
+                                 "objectclass=*", reader );
+            const LDAPEntry *e = reader.getEntry();
+            if ( e ) {
+                log_it(SLAPD_LOG_INFO,"Re-read Entry " + e->getDN() );
+                oce.resetEntries( *e );
+            }
+        }
+    } catch (LDAPException e) {
+        log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
+        throw;
+    }
+}
+
+static const std::string PAGED_RESULTS_OID = "1.2.840.113556.1.4.319";
+// LDAP Transactions (RFC 5805)
+static const std::string TXN_START_OID = "1.3.6.1.1.21.1";
+static const std::string TXN_SPEC_OID = "1.3.6.1.1.21.2";
+static const std::string TXN_END_OID = "1.3.6.1.1.21.3";
+// result code of slapd for update operations queued in a transaction, only
+// defined by ldap.h when libldap was built with transaction support
+#ifndef LDAP_X_TXN_SPECIFY_OKAY
+#define LDAP_X_TXN_SPECIFY_OKAY 0x4120
+#endif
+// LDAP Content Synchronization (RFC 4533)
+static const char *SYNC_REQUEST_OID = "1.3.6.1.4.1.4203.1.9.1.1";
+static const char *SYNC_STATE_OID = "1.3.6.1.4.1.4203.1.9.1.2";
+static const char *SYNC_INFO_OID = "1.3.6.1.4.1.4203.1.9.1.4";
+
+static void addDependency( std::vector<std::vector<int> > &successors,
+                           std::vector<int> &predecessors, int from, int to )
+{
+    successors[from].push_back( to );
+    predecessors[to]++;
+}
+
+// The parent of the added or deleted entry of step "child" among the steps
+// "candidates" with the parent's DN, the one having that DN at the child's
+// turn in the given order: for an add the nearest add in front of it, for a
+// delete the nearest delete behind it. Failing that the nearest one on the
+// other side is taken. -1 if none of them does the same operation.
+static int parentStep( const std::vector<OlcCommitPlan::Step> &steps,
+                       const std::vector<int> &candidates, int child )
+{
+    const OlcCommitPlan::Operation op = steps[child].op;
+    int before = -1, after = -1;
+    for ( unsigned int i = 0; i < candidates.size(); i++ )
+    {
+        int c = candidates[i];
+        if ( steps[c].op != op )
+            continue;
+        if ( c < child )
+            before = c;
+        else if ( after < 0 )
+            after = c;
+    }
+    if ( op == OlcCommitPlan::ADD )
+        return before >= 0 ? before : after;
+    return after >= 0 ? after : before;
+}
+
+OlcCommitPlan::OlcCommitPlan( const OlcConfigEntryList &entries )
+{
+    std::vector<Step> steps;
+    OlcConfigEntryList::const_iterator i;
+    for ( i = entries.begin(); i != entries.end(); i++ )
+    {
+        Step s;
+        s.entry = *i;
+        if ( (*i)->isNewEntry() )
+        {
+            s.op = ADD;
+            s.dn = (*i)->getUpdatedDn();
+        } else if ( (*i)->isDeletedEntry() ) {
+            s.op = DELETE;
+            s.dn = (*i)->getDn();
+        } else {
+            s.mods = (*i)->entryDifftoMod();
+            if ( s.mods.empty() )
+            {
+                continue;
+            }
+            s.op = MODIFY;
+            s.dn = (*i)->getDn();
+        }
+        steps.push_back( s );
+    }
+
+    int n = steps.size();
+    std::vector<std::string> dns( n ), parents( n );
+    // several steps can have the same DN, e.g. a deleted database and the
+    // one renumbered into its place
+    boost::unordered_map<std::string, std::vector<int> > byDn;
+    std::vector<int> schemaSteps;
+    int globalsStep = -1;
+    const std::string schemaBase = normalizeDn( OlcSchemaConfig::schemabase );
+    for ( int j = 0; j < n; j++ )
+    {
+        dns[j] = normalizeDn( steps[j].dn );
+        parents[j] = parentDn( dns[j] );
+        byDn[dns[j]].push_back( j );
+        if ( dns[j] == "cn=config" )
+        {
+            globalsStep = j;
+        }
+        if ( dns[j] == schemaBase || isBelowDn( dns[j], schemaBase ) )
+        {
+            schemaSteps.push_back( j );
+        }
+    }
+
+    std::vector<std::vector<int> > successors( n );
+    std::vector<int> predecessors( n, 0 );
+    for ( int j = 0; j < n; j++ )
+    {
+        boost::unordered_map<std::string, std::vector<int> >::const_iterator p =
+                byDn.find( parents[j] );
+        if ( p != byDn.end() && steps[j].op != MODIFY )
+        {
+            int parent = parentStep( steps, p->second, j );
+            if ( parent >= 0 )
+            {
+                if ( steps[j].op == ADD )
+                    addDependency( successors, predecessors, parent, j );
+                else
+                    addDependency( successors, predecessors, j, parent );
+            }
+        }
+        if ( isBelowDn( dns[j], "cn=config" ) &&
+             dns[j] != schemaBase && ! isBelowDn( dns[j], schemaBase ) )
+        {
+            // databases and overlays might reference the schema
+            for ( unsigned int k = 0; k < schemaSteps.size(); k++ )
+            {
+                addDependency( successors, predecessors, schemaSteps[k], j );
+            }
+            // and are written after the global settings they depend on
+            if ( globalsStep >= 0 )
+            {
+                addDependency( successors, predecessors, globalsStep, j );
+            }
+        }
+        if ( steps[j].op != MODIFY )
+        {
+            for ( int k = 0; k < n; k++ )
+            {
+                if ( k != j && isBelowDn( dns[k], parents[j] ) )
+                {
+                    // the children of a deleted entry are ordered above
+                    if ( steps[j].op == DELETE && isBelowDn( dns[k], dns[j] ) )
+                        continue;
+                    if ( k < j )
+                        addDependency( successors, predecessors, k, j );
+                    else
+                        addDependency( successors, predecessors, j, k );
+                }
+            }
+        }
+    }
+
+    std::vector<int> current;
+    for ( int j = 0; j < n; j++ )
+    {
+        if ( predecessors[j] == 0 )
+            current.push_back( j );
+    }
+    int planned = 0;
+    while ( ! current.empty() )
+    {
+        Wave wave;
+        std::vector<int> next;
+        for ( unsigned int j = 0; j < current.size(); j++ )
+        {
+            wave.push_back( steps[current[j]] );
+            std::vector<int> &succ = successors[current[j]];
+            for ( unsigned int k = 0; k < succ.size(); k++ )
+            {
+                if ( --predecessors[succ[k]] == 0 )
+                    next.push_back( succ[k] );
+            }
+        }
+        planned += current.size();
+        m_waves.push_back( wave );
+        std::sort( next.begin(), next.end() );
+        current.swap( next );
+    }
+
+    if ( planned != n )
+    {
+        // the given order contradicts the DN hierarchy, stick to the given
+        // order then
+        log_it(SLAPD_LOG_INFO, "Cyclic dependencies, committing sequentially" );
+        m_waves.clear();
+        for ( int j = 0; j < n; j++ )
+        {
+            m_waves.push_back( Wave( 1, steps[j] ) );
+        }
+    }
+}
+
+const std::vector<OlcCommitPlan::Wave>& OlcCommitPlan::getWaves() const
+{
+    return m_waves;
+}
+
+std::string OlcCommitPlan::toString() const
+{
+    static const char *opNames[] = { "add", "modify", "delete" };
+    std::ostringstream os;
+    for ( unsigned int i = 0; i < m_waves.size(); i++ )
+    {
+        os << i << ":";
+        for ( unsigned int j = 0; j < m_waves[i].size(); j++ )
+        {
+            os << ( j ? ", " : " " ) << opNames[m_waves[i][j].op] << " "
+               << m_waves[i][j].dn;
+        }
+        os << std::endl;
+    }
+    return os.str();
+}
+
+// Sends the operations for OlcConfig::updateEntries() and collects their
+// results. Within a transaction the entries are only refreshed after it has
+// been committed, otherwise every successful operation is recorded in a
+// journal along with what is needed to undo it.
+class UpdatePipeline
+{
+    public:
+        UpdatePipeline( LDAPAsynConnection *lc, OlcTraffic &traffic,
+                        OlcStatistics &stats, bool localUpdates,
+                        const std::string &txnId = "" )
+            : m_lc(lc), m_traffic(traffic),
+              m_stats(stats),
+              m_localUpdates(localUpdates), m_txnId(txnId),
+              m_errCode(LDAPResult::SUCCESS)
+        {
+            if ( ! m_txnId.empty() )
+            {
+                m_txnCtrls.add( LDAPCtrl( TXN_SPEC_OID, true, m_txnId ) );
+                m_txnCons.setServerControls( &m_txnCtrls );
+            }
+        }
+
+        ~UpdatePipeline()
+        {
+            std::vector<PendingUpdate>::iterator i;
+            for ( i = m_pending.begin(); i != m_pending.end(); i++ )
+            {
+                delete(i->queue);
+            }
+        }
+
+        void send( const OlcCommitPlan::Step &step )
+        {
+            OlcConfigEntry &oce = *step.entry;
+            log_it(SLAPD_LOG_INFO, "updateEntries() Old DN: "+oce.getDn()+" ChangedDN: "+ oce.getChangedEntry().getDN() );
+            const LDAPConstraints *cons = m_txnId.empty() ? 0 : &m_txnCons;
+            PendingUpdate u;
+            u.step.entry = &oce;
+            u.step.op = step.op;
+            u.step.origEntry = oce.getOrigEntry();
+            u.step.changedEntry = oce.getChangedEntry();
+            u.reread = ! ( m_localUpdates && step.op == OlcCommitPlan::MODIFY );
+            u.dnClass = OlcStatistics::dnClass( step.dn );
+            u.start = monotonicMicros();
+            m_traffic.roundTrips++;
+            if ( step.op == OlcCommitPlan::ADD )
+            {
+                m_traffic.bytes += entrySize( oce.getChangedEntry() );
+                u.queue = m_lc->add( &oce.getChangedEntry(), cons );
+            } else if ( step.op == OlcCommitPlan::DELETE ) {
+                u.queue = m_lc->del( oce.getDn(), cons );
+                u.reread = false;
+            } else {
+                if ( m_txnId.empty() )
+                {
+                    u.step.undo = oce.undoDifftoMod();
+                }
+                u.queue = m_lc->modify( oce.getDn(), &step.mods, cons );
+            }
+            m_pending.push_back( u );
+        }
+
+        // waits for the results of all outstanding operations, outside of a
+        // transaction the entries that were written successfully are
+        // refreshed
+        void flush()
+        {
+            while ( ! m_pending.empty() )
+            {
+                PendingUpdate u = m_pending.front();
+                m_pending.erase( m_pending.begin() );
+                boost::scoped_ptr<LDAPMessageQueue> q( u.queue );
+                boost::scoped_ptr<LDAPMsg> msg( q->getNext() );
+                int code = ((LDAPResult*) msg.get())->getResultCode();
+                bool success = code == LDAPResult::SUCCESS ||
+                               ( ! m_txnId.empty() && code == LDAP_X_TXN_SPECIFY_OKAY );
+                m_stats.record( statsOperation( u.step.op ), u.dnClass,
+                                monotonicMicros() - u.start, success );
+                if ( success )
+                {
+                    m_written.push_back( u );
+                    if ( m_txnId.empty() )
+                    {
+                        m_journal.push_back( u.step );
+                    }
+                }
+                else
+                {
+                    std::string errMsg = ((LDAPResult*) msg.get())->getErrMsg();
+                    log_it(SLAPD_LOG_INFO, u.step.entry->getUpdatedDn() + ": " + errMsg );
+                    if ( m_errCode == LDAPResult::SUCCESS )
+                    {
+                        m_errCode = code;
+                        m_errMsg = errMsg;
+                    }
+                }
+            }
+            if ( m_txnId.empty() )
+            {
+                this->refresh();
+            }
+        }
+
+        // re-reads (or updates locally) the entries written so far
+        void refresh()
+        {
+            std::vector<PendingUpdate> reads;
+            std::vector<PendingUpdate>::iterator i;
+            for ( i = m_written.begin(); i != m_written.end(); i++ )
+            {
+                if ( i->reread )
+                {
+                    m_traffic.roundTrips++;
+                    i->start = monotonicMicros();
+                    i->queue = m_lc->search( i->step.entry->getUpdatedDn(), LDAPAsynConnection::SEARCH_BASE );
+                    reads.push_back( *i );
+                }
+                else if ( i->step.op != OlcCommitPlan::DELETE )
+                {
+                    log_it(SLAPD_LOG_INFO,"Applying changes locally " + i->step.entry->getUpdatedDn() );
+                    i->step.entry->applyChanges();
+                }
+            }
+            m_written.clear();
+            m_pending.swap( reads );
+            // re-read the Entries from Server
+            while ( ! m_pending.empty() )
+            {
+                PendingUpdate u = m_pending.front();
+                m_pending.erase( m_pending.begin() );
+                boost::scoped_ptr<LDAPMessageQueue> q( u.queue );
+                bool done = false;
+                while ( ! done )
+                {
+                    boost::scoped_ptr<LDAPMsg> msg( q->getNext() );
+                    if ( msg->getMessageType() == LDAPMsg::SEARCH_ENTRY )
+                    {
+                        const LDAPEntry *e = ((LDAPSearchResult*) msg.get())->getEntry();
+                        countEntry( m_traffic, *e );
+                        log_it(SLAPD_LOG_INFO,"Re-read Entry " + e->getDN() );
+                        u.step.entry->resetEntries( *e );
+                    }
+                    else if ( msg->getMessageType() == LDAPMsg::SEARCH_DONE )
+                    {
+                        m_stats.record( OlcStatistics::SEARCH, u.dnClass, monotonicMicros() - u.start,
+                                ((LDAPResult*) msg.get())->getResultCode() == LDAPResult::SUCCESS );
+                        done = true;
+                    }
+                }
+            }
+        }
+
+        // undoes the journaled operations in reverse order and puts back the
+        // entries as they were before the commit. Failures are only logged,
+        // the remaining operations are still undone.
+        void rollback()
+        {
+            std::vector<JournalStep>::reverse_iterator i;
+            for ( i = m_journal.rbegin(); i != m_journal.rend(); i++ )
+            {
+                try {
+                    if ( i->op == OlcCommitPlan::ADD )
+                    {
+                        log_it(SLAPD_LOG_INFO, "Undo add " + i->changedEntry.getDN() );
+                        OperationTimer timer( m_stats, m_traffic, OlcStatistics::DELETE,
+                                              i->changedEntry.getDN() );
+                        OlcConfig::waitForResult( m_lc->del( i->changedEntry.getDN() ) );
+                        timer.done();
+                    } else if ( i->op == OlcCommitPlan::DELETE ) {
+                        log_it(SLAPD_LOG_INFO, "Undo delete " + i->origEntry.getDN() );
+                        OperationTimer timer( m_stats, m_traffic, OlcStatistics::ADD,
+                                              i->origEntry.getDN() );
+                        m_traffic.bytes += entrySize( i->origEntry );
+                        OlcConfig::waitForResult( m_lc->add( &i->origEntry ) );
+                        timer.done();
+                    } else if ( ! i->undo.empty() ) {
+                        log_it(SLAPD_LOG_INFO, "Undo modify " + i->origEntry.getDN() );
+                        OperationTimer timer( m_stats, m_traffic, OlcStatistics::MODIFY,
+                                              i->origEntry.getDN() );
+                        OlcConfig::waitForResult( m_lc->modify( i->origEntry.getDN(), &i->undo ) );
+                        timer.done();
+                    }
+                } catch ( LDAPException e ) {
+                    log_it(SLAPD_LOG_INFO, "Undo failed: " + e.getResultMsg() + " " + e.getServerMsg() );
+                }
+                i->entry->restoreEntries( i->origEntry, i->changedEntry );
+            }
+            m_journal.clear();
+        }
+
+        bool failed() const
+        {
+            return m_errCode != LDAPResult::SUCCESS;
+        }
+
+        // the result code of the first failed operation
+        int errorCode() const
+        {
+            return m_errCode;
+        }
+
+        void throwOnError() const
+        {
+            if ( m_errCode != LDAPResult::SUCCESS )
+            {
+                throw LDAPException( m_errCode, m_errMsg );
+            }
+        }
+
+    private:
+        static OlcStatistics::Operation statsOperation( OlcCommitPlan::Operation op )
+        {
+            if ( op == OlcCommitPlan::ADD )
+            {
+                return OlcStatistics::ADD;
+            }
+            return op == OlcCommitPlan::DELETE ? OlcStatistics::DELETE : OlcStatistics::MODIFY;
+        }
+
+        struct JournalStep {
+            OlcConfigEntry *entry;
+            OlcCommitPlan::Operation op;
+            LDAPEntry origEntry;
+            LDAPEntry changedEntry;
+            LDAPModList undo;
+        };
+        struct PendingUpdate {
+            JournalStep step;
+            LDAPMessageQueue *queue;
+            bool reread;
+            OlcStatistics::DnClass dnClass;
+            long long start;
+        };
+
+        LDAPAsynConnection *m_lc;
+        OlcTraffic &m_traffic;
+        OlcStatistics &m_stats;
+        bool m_localUpdates;
+        std::string m_txnId;
+        LDAPControlSet m_txnCtrls;
+        LDAPConstraints m_txnCons;
+        std::vector<PendingUpdate> m_pending;
+        std::vector<PendingUpdate> m_written;
+        std::vector<JournalStep> m_journal;
+        int m_errCode;
+        std::string m_errMsg;
+};
+
+class RootDseReader : public OlcEntryHandler
+{
+    public:
+        virtual bool handleEntry( const LDAPEntry &entry )
+        {
+            const LDAPAttribute *attr = entry.getAttributeByName( "supportedExtension" );
+            if ( attr )
+            {
+                m_extensions = attr->getValues();
+            }
+            return true;
+        }
+
+        bool hasExtension( const std::string &oid ) const
+        {
+            return std::find( m_extensions.begin(), m_extensions.end(), oid )
+                    != m_extensions.end();
+        }
+
+    private:
+        StringList m_extensions;
+};
+
+bool OlcConfig::supportsTransactions()
+{
+    if ( ! m_txnChecked )
+    {
+        RootDseReader rootDse;
+        StringList attrs;
+        attrs.add( "supportedExtension" );
+        try {
+            this->searchEntries( "", LDAPAsynConnection::SEARCH_BASE, "objectclass=*",
+                                 rootDse, attrs );
+            m_txnSupported = rootDse.hasExtension( TXN_START_OID );
+        } catch ( LDAPException e ) {
+            m_txnSupported = false;
+        }
+        m_txnChecked = true;
+    }
+    return m_txnSupported;
+}
+
+// result codes of a server refusing transactions for cn=config, even if
+// the root DSE announces them (back-config doesn't support them)
+static bool isTxnRefused( int code )
+{
+    return code == LDAPResult::UNWILLING_TO_PERFORM ||
+           code == LDAPResult::UNAVAILABLE ||
+           code == LDAPResult::UNAVAILABLE_CRITICAL_EXTENSION;
+}
+
+/*
+ * Sends all changes of the plan within a single transaction. Returns false,
+ * without anything being changed, if the server refuses the transaction,
+ * transactions aren't tried again on this connection then. Any other error,
+ * e.g. a constraint violation of one of the operations, aborts the
+ * transaction and is thrown.
+ */
+bool OlcConfig::updateInTransaction( const OlcCommitPlan &plan )
+{
+    std::string txnId;
+    try {
+        OperationTimer timer( m_stats, m_traffic, OlcStatistics::EXTENDED, "" );
+        boost::scoped_ptr<LDAPResult> res( readResult( m_lc->extOperation( TXN_START_OID ) ) );
+        timer.done();
+        txnId = static_cast<LDAPExtResult*>( res.get() )->getResponse();
+    } catch ( LDAPException e ) {
+        log_it(SLAPD_LOG_INFO, "Can't start transaction: " + e.getResultMsg() + " " + e.getServerMsg() );
+        m_txnSupported = false;
+        return false;
+    }
+
+    UpdatePipeline pipeline( m_lc, m_traffic, m_stats, m_localUpdates, txnId );
+    const std::vector<OlcCommitPlan::Wave> &waves = plan.getWaves();
+    for ( unsigned int i = 0; i < waves.size(); i++ )
+    {
+        for ( unsigned int j = 0; j < waves[i].size(); j++ )
+        {
+            pipeline.send( waves[i][j] );
+        }
+    }
+    pipeline.flush();
+    if ( pipeline.failed() )
+    {
+        log_it(SLAPD_LOG_INFO, "Operation rejected within transaction, aborting it" );
+        try {
+            // txnEndReq with commit set to FALSE
+            std::string req = berElement( 0x30, berElement( 0x01, std::string( 1, '\0' ) ) +
+                                                berElement( 0x04, txnId ) );
+            OperationTimer timer( m_stats, m_traffic, OlcStatistics::EXTENDED, "" );
+            waitForResult( m_lc->extOperation( TXN_END_OID, req ) );
+            timer.done();
+        } catch ( LDAPException e ) {
+            log_it(SLAPD_LOG_INFO, "Can't abort transaction: " + e.getResultMsg() );
+        }
+        if ( ! isTxnRefused( pipeline.errorCode() ) )
+        {
+            pipeline.throwOnError();
+        }
+        log_it(SLAPD_LOG_INFO, "Transactions not supported for cn=config, not using them anymore" );
+        m_txnSupported = false;
+        return false;
+    }
+    // a failed commit leaves the server unchanged, the model is only
+    // refreshed after a successful one
+    try {
+        OperationTimer timer( m_stats, m_traffic, OlcStatistics::EXTENDED, "" );
+        waitForResult( m_lc->extOperation( TXN_END_OID, berElement( 0x30, berElement( 0x04, txnId ) ) ) );
+        timer.done();
+    } catch ( LDAPException e ) {
+        log_it(SLAPD_LOG_INFO, "Can't commit transaction: " + e.getResultMsg() + " " + e.getServerMsg() );
+        if ( ! isTxnRefused( e.getResultCode() ) )
+        {
+            throw;
+        }
+        m_txnSupported = false;
+        return false;
+    }
+    pipeline.refresh();
+    return true;
+}
+
+void OlcConfig::updateEntries( const OlcConfigEntryList &entries )
+{
+    this->updateEntries( OlcCommitPlan( entries ) );
+}
+
+void OlcConfig::updateEntries( const OlcCommitPlan &plan )
+{
+    if ( ! m_lc )
+    {
+        throw std::runtime_error( "LDAP Connection not initialized" );
+    }
+    try {
+        if ( this->supportsTransactions() && this->updateInTransaction( plan ) )
+        {
+            return;
+        }
+        UpdatePipeline pipeline( m_lc, m_traffic, m_stats, m_localUpdates );
+        const std::vector<OlcCommitPlan::Wave> &waves = plan.getWaves();
+        for ( unsigned int i = 0; i < waves.size() && ! pipeline.failed(); i++ )
+        {
+            for ( unsigned int j = 0; j < waves[i].size(); j++ )
+            {
+                pipeline.send( waves[i][j] );
+            }
+            pipeline.flush();
+        }
+        if ( pipeline.failed() )
+        {
+            log_it(SLAPD_LOG_INFO, "Commit failed, undoing the applied changes" );
+            pipeline.rollback();
+        }
+        pipeline.throwOnError();
+    } catch (LDAPException e) {
+        log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
+        throw;
+    }
+}
+
+/*
+ * This function triggers a simple Modify Operation ( basically a NO-OP) to
+ * the config backend, if slapd is currently running an indexing task this
+ * Operation will block until that task is finished as back-config can only
+ * complete that operation when it's the only active thread.
+ */
+void OlcConfig::waitForBackgroundTasks()
+{
+    try {
+        boost::shared_ptr<OlcGlobalConfig> globals = this->getGlobals();
+        std::string attrval = globals->getStringValue("olcArgsFIle");
+        LDAPModification mod( LDAPAttribute("olcArgsFIle", attrval), LDAPModification::OP_ADD );
+        LDAPModList ml;
+        ml.addModification(mod);
+        OperationTimer timer( m_stats, m_traffic, OlcStatistics::MODIFY, "cn=config" );
+        waitForResult( m_lc->modify( "cn=config", &ml ) );
+        timer.done();
+    } catch (LDAPException e) {
+        if (e.getResultCode() != LDAPResult::ATTRIBUTE_OR_VALUE_EXISTS )
+        {
+            log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
+            throw;
+        }
+    }
+}
+
+OlcDatabaseList OlcConfig::getDatabases()
+{
+    boost::shared_ptr<OlcGlobalConfig> globals;
+    OlcDatabaseList res;
+    OlcSchemaList schema;
+    this->readConfigTree( "(|(objectclass=olcDatabaseConfig)(objectclass=olcOverlayConfig))",
+                          globals, res, schema );
+    return res;
+}
+
+class ConfigTreeLoader : public OlcEntryHandler
+{
+    public:
+        ConfigTreeLoader( boost::shared_ptr<OlcGlobalConfig> &globals,
+                          OlcDatabaseList &databases,
+                          OlcSchemaList &schema,
+                          const OlcArenaPtr &arena )
+            : m_globals(globals), m_databases(databases), m_schema(schema),
+              m_arena(arena) {}
+
+        virtual bool handleEntry( const LDAPEntry &entry )
+        {
+            if ( OlcConfigEntry::isDatabaseEntry(entry) )
+            {
+                log_it(SLAPD_LOG_INFO,"Got Database Entry: " + entry.getDN() );
+                boost::shared_ptr<OlcDatabase> olce(OlcDatabase::createFromLdapEntry(entry, m_arena));
+                m_dbByDn.insert( make_pair( normalizeDn(entry.getDN()), olce ) );
+                m_databases.push_back(olce);
+            }
+            else if ( OlcConfigEntry::isOverlayEntry(entry) )
+            {
+                // the parent database might not have been returned yet
+                m_overlayEntries.push_back(entry);
+            }
+            else if ( OlcConfigEntry::isScheamEntry(entry) )
+            {
+                log_it(SLAPD_LOG_INFO,"Got Schema Entry: " + entry.getDN() );
+                boost::shared_ptr<OlcSchemaConfig> olce( olcCreate<OlcSchemaConfig>( m_arena, entry ) );
+                m_schema.push_back(olce);
+            }
+            else if ( OlcConfigEntry::isGlobalEntry(entry) )
+            {
+                log_it(SLAPD_LOG_INFO,"Got GlobalConfig: " + entry.getDN() );
+                m_globals = olcCreate<OlcGlobalConfig>( m_arena, entry );
+            }
+            return true;
+        }
+
+        void assignOverlays()
+        {
+            std::list<LDAPEntry>::const_iterator i;
+            for ( i = m_overlayEntries.begin(); i != m_overlayEntries.end(); i++ )
+            {
+                std::map<std::string, boost::shared_ptr<OlcDatabase> >::const_iterator db =
+                        m_dbByDn.find( normalizeDn( parentDn( i->getDN() ) ) );
+                if ( db == m_dbByDn.end() )
+                {
+                    log_it(SLAPD_LOG_ERR,"No Database found for Overlay: " + i->getDN() );
+                    continue;
+                }
+                log_it(SLAPD_LOG_INFO,"Got Overlay: " + i->getDN() );
+                boost::shared_ptr<OlcOverlay> overlay(OlcOverlay::createFromLdapEntry(*i, m_arena) );
+                db->second->addOverlay(overlay);
+            }
+            m_overlayEntries.clear();
+        }
+
+    private:
+        boost::shared_ptr<OlcGlobalConfig> &m_globals;
+        OlcDatabaseList &m_databases;
+        OlcSchemaList &m_schema;
+        // databases by (normalized) DN, used to assign the overlays to their
+        // parent database
+        std::map<std::string, boost::shared_ptr<OlcDatabase> > m_dbByDn;
+        std::list<LDAPEntry> m_overlayEntries;
+        OlcArenaPtr m_arena;
+};
+
+void OlcConfig::readConfigTree( const std::string &filter,
+                                boost::shared_ptr<OlcGlobalConfig> &globals,
+                                OlcDatabaseList &databases,
+                                OlcSchemaList &schema )
+{
+    ConfigTreeLoader loader( globals, databases, schema, this->newArena() );
+    this->searchEntries( "cn=config", LDAPAsynConnection::SEARCH_SUB, filter, loader );
+    loader.assignOverlays();
+}
+
+/*
+ * Reads the global configuration, all databases (including their overlays)
+ * and the schema with a single subtree search below cn=config, instead of
+ * issuing separate searches for each of them. With a cache file only the
+ * entries changed since the last call are read.
+ */
+void OlcConfig::getConfig( boost::shared_ptr<OlcGlobalConfig> &globals,
+                           OlcDatabaseList &databases,
+                           OlcSchemaList &schema )
+{
+    if ( m_cacheFile.empty() )
+    {
+        this->readConfigTree( "objectclass=*", globals, databases, schema );
+    }
+    else
+    {
+        ConfigTreeLoader loader( globals, databases, schema, this->newArena() );
+        this->readSnapshot( loader );
+        loader.assignOverlays();
+    }
+    if ( ! globals )
+    {
+        globals.reset( new OlcGlobalConfig() );
+    }
+}
+
+OlcSchemaList OlcConfig::getSchemaNames()
+{
+    boost::shared_ptr<OlcGlobalConfig> globals;
+    OlcDatabaseList databases;
+    OlcSchemaList res;
+    ConfigTreeLoader loader( globals, databases, res, this->newArena() );
+    this->searchEntries( "cn=schema,cn=config", LDAPAsynConnection::SEARCH_SUB,
+                         "objectclass=olcSchemaConfig", loader );
+    return res;
+}
+
+/*
+ * Snapshot cache of the cn=config tree, see OlcConfig::setCacheFile(). The
+ * file is an LDIF dump of the entries including their entryCSN and
+ * modifyTimestamp.
+ */
+
+// the entryCSN of an entry or, for servers without one, its modifyTimestamp
+static std::string entryVersion( const LDAPEntry &entry )
+{
+    const char *attrs[] = { "entryCSN", "modifyTimestamp" };
+    for ( int i = 0; i < 2; i++ )
+    {
+        const LDAPAttribute *attr = entry.getAttributeByName( attrs[i] );
+        if ( attr && attr->getNumValues() > 0 )
+        {
+            return *attr->getValues().begin();
+        }
+    }
+    return "";
+}
+
+struct SnapshotEntry
+{
+    std::string version;
+    LDAPEntry entry;
+};
+
+// by normalized DN
+typedef std::map<std::string, SnapshotEntry> SnapshotMap;
+
+class SnapshotCollector : public OlcEntryHandler
+{
+    public:
+        SnapshotCollector( SnapshotMap &entries ) : m_entries(entries) {}
+
+        virtual bool handleEntry( const LDAPEntry &entry )
+        {
+            SnapshotEntry &e = m_entries[normalizeDn( entry.getDN() )];
+            e.version = entryVersion( entry );
+            e.entry = entry;
+            m_dns.add( entry.getDN() );
+            return true;
+        }
+
+        // the DNs in the order they were received
+        const StringList& getDns() const
+        {
+            return m_dns;
+        }
+
+    private:
+        SnapshotMap &m_entries;
+        StringList m_dns;
+};
+
+// the attributes holding credentials, they are never written to the cache
+// file but read from the server each time
+static const char * const secret_attrs[] = { "olcRootPW", "olcSyncrepl",
+        "olcDbIDAssertBind", "olcDbACLPasswd" };
+
+static void stripSecrets( LDAPEntry &entry )
+{
+    for ( size_t i = 0; i < sizeof(secret_attrs) / sizeof(const char*); i++ )
+    {
+        entry.delAttribute( secret_attrs[i] );
+    }
+}
+
+// returns false if "entry" has none of the secret attributes
+static bool hasSecrets( const LDAPEntry &entry )
+{
+    for ( size_t i = 0; i < sizeof(secret_attrs) / sizeof(const char*); i++ )
+    {
+        if ( entry.getAttributeByName( secret_attrs[i] ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void copySecrets( const LDAPEntry &from, LDAPEntry &to )
+{
+    for ( size_t i = 0; i < sizeof(secret_attrs) / sizeof(const char*); i++ )
+    {
+        const LDAPAttribute *attr = from.getAttributeByName( secret_attrs[i] );
+        if ( attr )
+        {
+            to.replaceAttribute( *attr );
+        }
+    }
+}
+
+// the versions of all entries, along with their secret attributes
+class VersionCollector : public OlcEntryHandler
+{
+    public:
+        virtual bool handleEntry( const LDAPEntry &entry )
+        {
+            m_versions.push_back( make_pair( entry.getDN(), entryVersion( entry ) ) );
+            if ( hasSecrets( entry ) )
+            {
+                m_secrets[normalizeDn( entry.getDN() )] = entry;
+            }
+            return true;
+        }
+
+        std::vector<std::pair<std::string, std::string> > m_versions;
+        // by normalized DN
+        std::map<std::string, LDAPEntry> m_secrets;
+};
+
+// RFC 4515 escaping of an assertion value
+static std::string filterEscape( const std::string &value )
+{
+    std::string res;
+    for ( std::string::const_iterator i = value.begin(); i != value.end(); i++ )
+    {
+        switch ( *i )
+        {
+            case '(':  res += "\\28"; break;
+            case ')':  res += "\\29"; break;
+            case '*':  res += "\\2a"; break;
+            case '\\': res += "\\5c"; break;
+            default:   res += *i;
+        }
+    }
+    return res;
+}
+
+static void readSnapshotFile( const std::string &file, SnapshotMap &entries )
+{
+    std::ifstream in( file.c_str() );
+    if ( ! in )
+    {
+        return;
+    }
+    try {
+        LdifReader ldif( in );
+        SnapshotCollector collector( entries );
+        while ( ldif.readNextRecord() )
+        {
+            collector.handleEntry( ldif.getEntryRecord() );
+        }
+    } catch ( std::runtime_error e ) {
+        log_it(SLAPD_LOG_ERR, "Ignoring invalid cache file " + file + ": " + e.what() );
+        entries.clear();
+    }
+}
+
+// written to a temporary file first, a crash never leaves a partial file
+static void writeSnapshotFile( const std::string &file,
+                               const std::vector<const LDAPEntry*> &entries )
+{
+    std::string tmp = file + ".tmp";
+    unlink( tmp.c_str() );
+    int fd = open( tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600 );
+    if ( fd < 0 )
+    {
+        log_it(SLAPD_LOG_ERR, "Cannot write cache file " + tmp + ": " + strerror( errno ) );
+        return;
+    }
+    // the LDIF is written through the descriptor opened above, reopening
+    // the file by name could follow a symlink put there in the meantime
+    std::ostringstream out;
+    LdifWriter ldif( out );
+    std::vector<const LDAPEntry*>::const_iterator i;
+    for ( i = entries.begin(); i != entries.end(); i++ )
+    {
+        LDAPEntry entry( **i );
+        stripSecrets( entry );
+        ldif.writeRecord( entry );
+    }
+    const std::string data = out.str();
+    std::string::size_type written = 0;
+    while ( written < data.size() )
+    {
+        ssize_t n = write( fd, data.data() + written, data.size() - written );
+        if ( n < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if ( n <= 0 )
+        {
+            break;
+        }
+        written += n;
+    }
+    bool ok = written == data.size() && fsync( fd ) == 0;
+    if ( ! ok )
+    {
+        log_it(SLAPD_LOG_ERR, "Cannot write cache file " + tmp + ": " + strerror( errno ) );
+    }
+    if ( close( fd ) != 0 )
+    {
+        ok = false;
+    }
+    if ( ! ok || rename( tmp.c_str(), file.c_str() ) )
+    {
+        log_it(SLAPD_LOG_ERR, "Cannot write cache file " + file );
+        unlink( tmp.c_str() );
+    }
+}
+
+/*
+ * Passes the entries of cn=config to the handler, taking unchanged entries
+ * from the cache file. One search returns the versions of all entries, a
+ * second one (if needed) the entries that are new or have changed. When
+ * more than a quarter of the entries changed the whole tree is read again.
+ */
+void OlcConfig::readSnapshot( OlcEntryHandler &handler )
+{
+    SnapshotMap cached;
+    readSnapshotFile( m_cacheFile, cached );
+
+    StringList attrs;
+    attrs.add( "*" );
+    attrs.add( "entryCSN" );
+    attrs.add( "modifyTimestamp" );
+    SnapshotCollector fetched( cached );
+    VersionCollector versions;
+    StringList dns;
+    unsigned int changed = 0;
+
+    if ( cached.empty() )
+    {
+        this->searchEntries( "cn=config", LDAPAsynConnection::SEARCH_SUB, "objectclass=*",
+                             fetched, attrs );
+        dns = fetched.getDns();
+        changed = dns.size();
+    }
+    else
+    {
+        StringList versionAttrs;
+        versionAttrs.add( "entryCSN" );
+        versionAttrs.add( "modifyTimestamp" );
+        for ( size_t j = 0; j < sizeof(secret_attrs) / sizeof(const char*); j++ )
+        {
+            versionAttrs.add( secret_attrs[j] );
+        }
+        this->searchEntries( "cn=config", LDAPAsynConnection::SEARCH_SUB, "objectclass=*",
+                             versions, versionAttrs );
+        std::string filter;
+        std::vector<std::pair<std::string, std::string> >::const_iterator i;
+        for ( i = versions.m_versions.begin(); i != versions.m_versions.end(); i++ )
+        {
+            dns.add( i->first );
+            SnapshotMap::const_iterator c = cached.find( normalizeDn( i->first ) );
+            if ( i->second.empty() || c == cached.end() || c->second.version != i->second )
+            {
+                changed++;
+                filter += "(entryDN=" + filterEscape( i->first ) + ")";
+            }
+        }
+        if ( changed > versions.m_versions.size() / 4 )
+        {
+            this->searchEntries( "cn=config", LDAPAsynConnection::SEARCH_SUB, "objectclass=*",
+                                 fetched, attrs );
+        }
+        else if ( changed > 0 )
+        {
+            this->searchEntries( "cn=config", LDAPAsynConnection::SEARCH_SUB,
+                                 "(|" + filter + ")", fetched, attrs );
+        }
+    }
+
+    // entries deleted on the server are dropped, as are the ones added
+    // between the two searches
+    std::vector<const LDAPEntry*> entries;
+    for ( StringList::const_iterator i = dns.begin(); i != dns.end(); i++ )
+    {
+        SnapshotMap::const_iterator c = cached.find( normalizeDn( *i ) );
+        if ( c != cached.end() )
+        {
+            entries.push_back( &c->second.entry );
+        }
+    }
+    std::ostringstream msg;
+    msg << changed << " of " << entries.size() << " entries read from the server, "
+        << "the others from " << m_cacheFile;
+    log_it(SLAPD_LOG_INFO, msg.str() );
+    if ( changed > 0 || entries.size() != cached.size() )
+    {
+        writeSnapshotFile( m_cacheFile, entries );
+    }
+
+    // the entries taken from the cache file get their secrets from the
+    // version search
+    std::set<std::string> fetchedDns;
+    StringList::const_iterator f;
+    for ( f = fetched.getDns().begin(); f != fetched.getDns().end(); f++ )
+    {
+        fetchedDns.insert( normalizeDn( *f ) );
+    }
+    std::vector<const LDAPEntry*>::const_iterator i;
+    for ( i = entries.begin(); i != entries.end(); i++ )
+    {
+        LDAPEntry entry( **i );
+        entry.delAttribute( "entryCSN" );
+        entry.delAttribute( "modifyTimestamp" );
+        const std::string ndn = normalizeDn( entry.getDN() );
+        std::map<std::string, LDAPEntry>::const_iterator s = versions.m_secrets.find( ndn );
+        if ( s != versions.m_secrets.end() && fetchedDns.find( ndn ) == fetchedDns.end() )
+        {
+            copySecrets( s->second, entry );
+        }
+        if ( ! handler.handleEntry( entry ) )
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * Runs a search and passes each entry to the handler as soon as it is
+ * received from the server instead of collecting the complete result
+ * first. If "pageSize" is non-zero the Simple Paged Results control
+ * (RFC 2696) is used (as non-critical) to retrieve the result in chunks
+ * of "pageSize" entries. The search is abandoned when the handler returns
+ * false.
+ */
+void OlcConfig::searchEntries( const std::string &base, int scope,
+                               const std::string &filter,
+                               OlcEntryHandler &handler,
+                               const StringList &attrs, int pageSize )
+{
+    if ( ! m_lc )
+    {
+        throw std::runtime_error( "LDAP Connection not initialized" );
+    }
+    std::string cookie;
+    try {
+        do {
+            LDAPConstraints cons;
+            LDAPControlSet cs;
+            if ( pageSize > 0 )
+            {
+                std::string ctrlVal = berElement( 0x30, berInteger(pageSize) + 
+                                                        berElement( 0x04, cookie ) );
+                cs.add( LDAPCtrl( PAGED_RESULTS_OID, false, ctrlVal ) );
+                cons.setServerControls( &cs );
+            }
+            cookie = "";
+
+            // subtree searches are not attributed to a single class of entries
+            OperationTimer timer( m_stats, m_traffic, OlcStatistics::SEARCH,
+                                  scope == LDAPAsynConnection::SEARCH_BASE ? base : "" );
+            boost::scoped_ptr<LDAPMessageQueue> q( m_lc->search( base, scope, filter, attrs, false,
+                                                                 pageSize > 0 ? &cons : 0 ) );
+            bool done = false;
+            while ( ! done )
+            {
+                boost::scoped_ptr<LDAPMsg> msg( q->getNext() );
+                switch ( msg->getMessageType() )
+                {
+                    case LDAPMsg::SEARCH_ENTRY :
+                    {
+                        const LDAPEntry *entry = ((LDAPSearchResult*) msg.get())->getEntry();
+                        countEntry( m_traffic, *entry );
+                        long long handlerStart = monotonicMicros();
+                        bool next = handler.handleEntry( *entry );
+                        timer.exclude( monotonicMicros() - handlerStart );
+                        if ( ! next )
+                        {
+                            log_it(SLAPD_LOG_DEBUG, "Search abandoned by handler" );
+                            m_lc->abandon( msg->getMsgID() );
+                            timer.done();
+                            cookie = "";
+                            done = true;
+                        }
+                        break;
+                    }
+                    case LDAPMsg::SEARCH_DONE :
+                    {
+                        LDAPResult *res = (LDAPResult*) msg.get();
+                        if ( res->getResultCode() != LDAPResult::SUCCESS )
+                        {
+                            throw LDAPException( res->getResultCode(), res->getErrMsg() );
+                        }
+                        timer.done();
+                        if ( pageSize > 0 && res->hasControls() )
+                        {
+                            const LDAPControlSet &rcs = res->getSrvControls();
+                            LDAPControlSet::const_iterator i;
+                            for ( i = rcs.begin(); i != rcs.end(); i++ )
+                            {
+                                std::string seq, size;
+                                std::string::size_type pos = 0;
+                                unsigned char tag;
+                                if ( i->getOID() == PAGED_RESULTS_OID &&
+                                     berGetElement( i->getData(), pos, tag, seq ) )
+                                {
+                                    pos = 0;
+                                    if ( ! berGetElement( seq, pos, tag, size ) ||
+                                         ! berGetElement( seq, pos, tag, cookie ) )
+                                    {
+                                        cookie = "";
+                                    }
+                                }
+                            }
+                        }
+                        done = true;
+                        break;
+                    }
+                    default :
+                        // ignore search references, cn=config has none
+                        break;
+                }
+            }
+        } while ( ! cookie.empty() );
+    } catch (LDAPException e ) {
+        log_it(SLAPD_LOG_INFO, e.getResultMsg() + " " + e.getServerMsg() );
+        throw;
+    }
+}
+
+/*
+ * LDAP Sync session on cn=config. ldapcpp only offers blocking reads of
+ * search results, so the session uses the libldap handle of the connection
+ * directly and polls it with a zero timeout. The operations of ldapcpp on
+ * the same connection don't consume the messages of the session.
+ */
+
+// collects the entryUUIDs of all entries and the contextCSN of cn=config
+class SyncStateReader : public OlcEntryHandler
+{
+    public:
+        SyncStateReader( std::map<std::string, std::string> &dns ) : m_dns(dns) {}
+
+        virtual bool handleEntry( const LDAPEntry &entry )
+        {
+            const LDAPAttribute *uuid = entry.getAttributeByName( "entryUUID" );
+            if ( uuid && uuid->getNumValues() > 0 )
+            {
+                std::string value = *uuid->getValues().begin();
+                std::transform( value.begin(), value.end(), value.begin(), ::tolower );
+                m_dns[value] = entry.getDN();
+            }
+            const LDAPAttribute *csn = entry.getAttributeByName( "contextCSN" );
+            if ( csn )
+            {
+                StringList::const_iterator i;
+                for ( i = csn->getValues().begin(); i != csn->getValues().end(); i++ )
+                {
+                    m_contextCsn += ( m_contextCsn.empty() ? "" : ";" ) + *i;
+                }
+            }
+            return true;
+        }
+
+        const std::string& getContextCsn() const
+        {
+            return m_contextCsn;
+        }
+
+    private:
+        std::map<std::string, std::string> &m_dns;
+        std::string m_contextCsn;
+};
+
+// the string form of the 16 octets of a syncUUID
+static std::string uuidString( const std::string &octets )
+{
+    std::ostringstream s;
+    s << std::hex << std::setfill('0');
+    for ( unsigned int i = 0; i < octets.size(); i++ )
+    {
+        if ( i == 4 || i == 6 || i == 8 || i == 10 )
+        {
+            s << '-';
+        }
+        s << std::setw(2) << (int) (unsigned char) octets[i];
+    }
+    return s.str();
+}
+
+// true if the DN already belongs to another entry, e.g. to a sibling that
+// was renumbered into it before the change of the entry itself was reported
+static bool dnTaken( const OlcSyncState &sync, const std::string &dn,
+                     const std::string &uuid )
+{
+    std::string ndn = normalizeDn( dn );
+    std::map<std::string, std::string>::const_iterator i;
+    for ( i = sync.dns.begin(); i != sync.dns.end(); i++ )
+    {
+        if ( i->first != uuid && normalizeDn( i->second ) == ndn )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void syncDelete( OlcSyncState &sync, OlcSyncHandler &handler,
+                        const std::string &uuid, const std::string &dn )
+{
+    std::map<std::string, std::string>::iterator i = sync.dns.find( uuid );
+    std::string deleted = dn;
+    if ( i != sync.dns.end() )
+    {
+        deleted = i->second;
+        sync.dns.erase( i );
+    }
+    if ( ! deleted.empty() && ! dnTaken( sync, deleted, uuid ) )
+    {
+        handler.entryDeleted( deleted );
+    }
+}
+
+// a SearchResultEntry carrying a Sync State control
+static bool syncEntry( LDAPAsynConnection *alc, LDAPMessage *msg, OlcSyncState &sync,
+                       OlcSyncHandler &handler, OlcTraffic &traffic )
+{
+    LDAP *ld = alc->getSessionHandle();
+    LDAPControl **ctrls = 0;
+    std::string value;
+    if ( ldap_get_entry_controls( ld, msg, &ctrls ) == LDAP_SUCCESS && ctrls )
+    {
+        LDAPControl *ctrl = ldap_control_find( SYNC_STATE_OID, ctrls, 0 );
+        if ( ctrl )
+        {
+            value.assign( ctrl->ldctl_value.bv_val, ctrl->ldctl_value.bv_len );
+        }
+        ldap_controls_free( ctrls );
+    }
+    // syncStateValue ::= SEQUENCE { state ENUMERATED, entryUUID syncUUID,
+    //                               cookie syncCookie OPTIONAL }
+    std::string seq, state, uuid, cookie;
+    std::string::size_type pos = 0;
+    unsigned char tag;
+    if ( ! berGetElement( value, pos, tag, seq ) )
+    {
+        log_it(SLAPD_LOG_ERR, "Sync entry without Sync State control" );
+        return false;
+    }
+    pos = 0;
+    if ( ! berGetElement( seq, pos, tag, state ) || state.size() != 1 ||
+         ! berGetElement( seq, pos, tag, uuid ) )
+    {
+        log_it(SLAPD_LOG_ERR, "Invalid Sync State control" );
+        return false;
+    }
+    if ( berGetElement( seq, pos, tag, cookie ) )
+    {
+        sync.cookie = cookie;
+    }
+    uuid = uuidString( uuid );
+    LDAPEntry entry( alc, msg );
+    countEntry( traffic, entry );
+    log_it(SLAPD_LOG_DEBUG, "Sync state " + std::string( 1, '0' + state[0] ) +
+                            " of " + entry.getDN() );
+
+    switch ( state[0] )
+    {
+        case 0: // present
+            break;
+        case 1: // add
+        case 2: // modify
+        {
+            std::map<std::string, std::string>::const_iterator i = sync.dns.find( uuid );
+            if ( i != sync.dns.end() &&
+                 normalizeDn( i->second ) != normalizeDn( entry.getDN() ) &&
+                 ! dnTaken( sync, i->second, uuid ) )
+            {
+                handler.entryDeleted( i->second );
+            }
+            handler.entryChanged( entry );
+            break;
+        }
+        case 3: // delete
+            syncDelete( sync, handler, uuid, entry.getDN() );
+            return true;
+        default:
+            return false;
+    }
+    sync.dns[uuid] = entry.getDN();
+    if ( sync.refreshing )
+    {
+        sync.seen.insert( uuid );
+    }
+    return true;
+}
+
+// an IntermediateResponse carrying a Sync Info message
+static bool syncInfo( LDAP *ld, LDAPMessage *msg, OlcSyncState &sync,
+                      OlcSyncHandler &handler )
+{
+    char *oid = 0;
+    struct berval *data = 0;
+    if ( ldap_parse_intermediate( ld, msg, &oid, &data, 0, 0 ) != LDAP_SUCCESS )
+    {
+        return false;
+    }
+    bool isSyncInfo = oid && strcmp( oid, SYNC_INFO_OID ) == 0;
+    std::string value;
+    if ( data )
+    {
+        value.assign( data->bv_val, data->bv_len );
+    }
+    ldap_memfree( oid );
+    ber_bvfree( data );
+    if ( ! isSyncInfo )
+    {
+        return true;
+    }
+
+    // syncInfoValue ::= CHOICE { newcookie [0], refreshDelete [1],
+    //                            refreshPresent [2], syncIdSet [3] }
+    std::string info, element;
+    std::string::size_type pos = 0;
+    unsigned char tag, elementTag;
+    if ( ! berGetElement( value, pos, tag, info ) )
+    {
+        return false;
+    }
+    if ( tag == 0x80 )
+    {
+        sync.cookie = info;
+        return true;
+    }
+    bool flag = ( tag != 0xa3 );
+    std::vector<std::string> uuids;
+    for ( pos = 0; berGetElement( info, pos, elementTag, element ); )
+    {
+        if ( elementTag == 0x04 )
+        {
+            sync.cookie = element;
+        }
+        else if ( elementTag == 0x01 && element.size() == 1 )
+        {
+            // refreshDone, or refreshDeletes of a syncIdSet
+            flag = element[0] != 0;
+        }
+        else if ( elementTag == 0x31 )
+        {
+            std::string uuid;
+            for ( std::string::size_type p = 0; berGetElement( element, p, elementTag, uuid ); )
+            {
+                uuids.push_back( uuidString( uuid ) );
+            }
+        }
+    }
+
+    if ( tag == 0xa3 )
+    {
+        std::vector<std::string>::const_iterator i;
+        for ( i = uuids.begin(); i != uuids.end(); i++ )
+        {
+            if ( flag )
+            {
+                syncDelete( sync, handler, *i, "" );
+            }
+            else if ( sync.refreshing )
+            {
+                sync.seen.insert( *i );
+            }
+        }
+    }
+    else if ( flag && sync.refreshing )
+    {
+        if ( tag == 0xa2 )
+        {
+            // the entries not reported during a present phase are gone
+            std::vector<std::string> gone;
+            std::map<std::string, std::string>::const_iterator i;
+            for ( i = sync.dns.begin(); i != sync.dns.end(); i++ )
+            {
+                if ( sync.seen.find( i->first ) == sync.seen.end() )
+                {
+                    gone.push_back( i->first );
+                }
+            }
+            for ( unsigned int j = 0; j < gone.size(); j++ )
+            {
+                syncDelete( sync, handler, gone[j], "" );
+            }
+        }
+        log_it(SLAPD_LOG_INFO, "LDAP Sync refresh done" );
+        sync.refreshing = false;
+        sync.seen.clear();
+    }
+    return true;
+}
+
+/*
+ * The entryUUIDs of the current entries are read first, as deletes may
+ * be reported by entryUUID only. The session starts from the contextCSN
+ * read at the same time, so the refresh phase only reports what changed
+ * since (plus the entryUUIDs of the unchanged entries).
+ */
+bool OlcConfig::startSync()
+{
+    this->stopSync();
+    StringList attrs;
+    attrs.add( "entryUUID" );
+    attrs.add( "contextCSN" );
+    SyncStateReader state( m_sync.dns );
+    this->searchEntries( "cn=config", LDAPAsynConnection::SEARCH_SUB, "objectclass=*",
+                         state, attrs );
+    if ( state.getContextCsn().empty() )
+    {
+        log_it(SLAPD_LOG_INFO, "cn=config has no contextCSN, LDAP Sync is not available" );
+        m_sync = OlcSyncState();
+        return false;
+    }
+    m_sync.cookie = "rid=000,csn=" + state.getContextCsn();
+
+    // syncRequestValue ::= SEQUENCE { mode ENUMERATED { refreshAndPersist (3) },
+    //                                 cookie syncCookie OPTIONAL }
+    std::string value = berElement( 0x30, berElement( 0x0a, std::string( 1, '\3' ) ) +
+                                          berElement( 0x04, m_sync.cookie ) );
+    LDAPControl ctrl;
+    ctrl.ldctl_oid = (char*) SYNC_REQUEST_OID;
+    ctrl.ldctl_value.bv_val = (char*) value.data();
+    ctrl.ldctl_value.bv_len = value.size();
+    ctrl.ldctl_iscritical = 1;
+    LDAPControl *ctrls[] = { &ctrl, 0 };
+    char *all[] = { (char*) "*", 0 };
+
+    LDAP *ld = m_lc->getSessionHandle();
+    int rc = ldap_search_ext( ld, "cn=config", LDAP_SCOPE_SUBTREE, "(objectclass=*)",
+                              all, 0, ctrls, 0, 0, 0, &m_sync.msgId );
+    if ( rc != LDAP_SUCCESS )
+    {
+        m_sync = OlcSyncState();
+        throw LDAPException( rc, ldap_err2string( rc ) );
+    }
+    m_traffic.roundTrips++;
+    m_sync.refreshing = true;
+    log_it(SLAPD_LOG_INFO, "LDAP Sync started with cookie " + m_sync.cookie );
+    return true;
+}
+
+bool OlcConfig::pollSync( OlcSyncHandler &handler )
+{
+    if ( m_sync.msgId < 0 )
+    {
+        return false;
+    }
+    LDAP *ld = m_lc->getSessionHandle();
+    struct timeval zero = { 0, 0 };
+    LDAPMessage *msg = 0;
+    int type;
+    while ( ( type = ldap_result( ld, m_sync.msgId, LDAP_MSG_ONE, &zero, &msg ) ) > 0 )
+    {
+        bool ok;
+        if ( type == LDAP_RES_SEARCH_ENTRY )
+        {
+            ok = syncEntry( m_lc, msg, m_sync, handler, m_traffic );
+        }
+        else if ( type == LDAP_RES_INTERMEDIATE )
+        {
+            ok = syncInfo( ld, msg, m_sync, handler );
+        }
+        else
+        {
+            // a refreshAndPersist search only ends on errors, e.g. with
+            // e-syncRefreshRequired (4096) if the cookie is too old
+            int err = LDAP_OTHER;
+            char *errmsg = 0;
+            ldap_parse_result( ld, msg, &err, 0, &errmsg, 0, 0, 0 );
+            std::ostringstream s;
+            s << "LDAP Sync ended with result " << err << ": " << ( errmsg ? errmsg : "" );
+            log_it(SLAPD_LOG_INFO, s.str() );
+            ldap_memfree( errmsg );
+            m_sync.msgId = -1;
+            ok = false;
+        }
+        ldap_msgfree( msg );
+        if ( ! ok )
+        {
+            this->stopSync();
+            return false;
+        }
+    }
+    if ( type < 0 )
+    {
+        log_it(SLAPD_LOG_ERR, "LDAP Sync failed, the connection is lost" );
+        m_sync = OlcSyncState();
+        return false;
+    }
+    return true;
+}
+
+void OlcConfig::stopSync()
+{
+    if ( m_sync.msgId >= 0 )
+    {
+        LDAP *ld = m_lc->getSessionHandle();
+        ldap_abandon_ext( ld, m_sync.msgId, 0, 0 );
+    }
+    m_sync = OlcSyncState();
+}
+
+bool OlcConfig::isSyncActive() const
+{
+    return m_sync.msgId >= 0;
+}
+
+const OlcTraffic& OlcConfig::getTraffic() const
+{
+    return m_traffic;
+}
+
+const OlcStatistics& OlcConfig::getStatistics() const
+{
+    return m_stats;
+}
+
+void OlcConfig::resetStatistics()
+{
+    m_stats.clear();
+}
+
+void OlcConfig::setLogCallback( SlapdConfigLogCallback *lcb )
+{
+    OlcConfig::logCallback = lcb;
+}
+
+void OlcConfig::setLogLevel( int level )
+{
+    OlcConfig::logLevel = level;
 }
 
 
@@ -2463,4 +5195,5 @@ static void defaultLogCallback( int level, const std::string &msg,
 }
 
 SlapdConfigLogCallback *OlcConfig::logCallback = defaultLogCallback;
+int OlcConfig::logLevel = SLAPD_LOG_DEBUG;
 
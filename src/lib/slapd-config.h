@@ -11,25 +11,180 @@
 
 #ifndef BACK_CONFIG_TEST_H
 #define BACK_CONFIG_TEST_H
-#include <LDAPConnection.h>
+#include <LDAPAsynConnection.h>
 #include <LDAPResult.h>
 #include <LDAPUrl.h>
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <map>
+#include <set>
 #include <vector>
 #include <LDAPEntry.h>
 #include <LDAPAttrType.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include <cctype>
+#include <cstddef>
+#include <ctime>
+#include <new>
 
 #define SLAPD_LOG_DEBUG 3
 #define SLAPD_LOG_INFO  2
 #define SLAPD_LOG_ERR   1
 
+// Messages more verbose than SLAPD_LOG_MAX_LEVEL are not compiled into the
+// library, e.g. build with -DSLAPD_LOG_MAX_LEVEL=SLAPD_LOG_INFO to drop all
+// debug output
+#ifndef SLAPD_LOG_MAX_LEVEL
+#define SLAPD_LOG_MAX_LEVEL SLAPD_LOG_DEBUG
+#endif
+
 typedef void (SlapdConfigLogCallback) (int level, const std::string &msg, 
             const char* file=0, const int line=0, const char* function=0 );
 
+// case-insensitive hashing and comparison of attribute type names
+struct AttrNameHash
+{
+    inline std::size_t operator() ( const std::string &name ) const
+    {
+        std::size_t seed = 0;
+        std::string::const_iterator i;
+        for ( i = name.begin(); i != name.end(); i++ )
+        {
+            boost::hash_combine( seed, std::tolower( (unsigned char) *i ) );
+        }
+        return seed;
+    }
+};
+
+struct AttrNameEqual
+{
+    inline bool operator() ( const std::string &n1, const std::string &n2 ) const
+    {
+        if ( n1.size() != n2.size() )
+        {
+            return false;
+        }
+        for ( std::string::size_type i = 0; i < n1.size(); i++ )
+        {
+            if ( std::tolower( (unsigned char) n1[i] ) != std::tolower( (unsigned char) n2[i] ) )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+typedef boost::unordered_map<std::string, const LDAPAttribute*,
+                             AttrNameHash, AttrNameEqual> AttributeIndex;
+typedef boost::unordered_map<std::string, unsigned long,
+                             AttrNameHash, AttrNameEqual> AttributeVersions;
+// the attributes of a changed entry that differ from the original entry, a
+// deleted attribute is kept without values
+typedef boost::unordered_map<std::string, LDAPAttribute,
+                             AttrNameHash, AttrNameEqual> AttributeOverlay;
+
+// Monotonic memory for the objects of one loaded configuration: they are
+// placed one after the other into large blocks, which are only freed when
+// the arena is destroyed. Objects created with olcCreate() keep their arena
+// alive, so the whole model is freed in one step when its last object is
+// released.
+class OlcArena
+{
+    public:
+        OlcArena( std::size_t blockSize = 64 * 1024 );
+        ~OlcArena();
+
+        void* allocate( std::size_t size );
+
+        std::size_t getBlocks() const;
+        // the bytes handed out so far
+        std::size_t getBytes() const;
+
+    private:
+        OlcArena( const OlcArena& );
+        OlcArena& operator=( const OlcArena& );
+
+        std::size_t m_blockSize;
+        std::vector<char*> m_blocks;
+        char *m_next;
+        std::size_t m_left;
+        std::size_t m_bytes;
+};
+
+typedef boost::shared_ptr<OlcArena> OlcArenaPtr;
+
+template <class T>
+class OlcArenaAllocator
+{
+    public:
+        typedef T value_type;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef std::size_t size_type;
+        typedef std::ptrdiff_t difference_type;
+        template <class U> struct rebind { typedef OlcArenaAllocator<U> other; };
+
+        explicit OlcArenaAllocator( const OlcArenaPtr &arena ) : m_arena(arena) {}
+        template <class U>
+        OlcArenaAllocator( const OlcArenaAllocator<U> &a ) : m_arena(a.m_arena) {}
+
+        pointer address( reference r ) const { return &r; }
+        const_pointer address( const_reference r ) const { return &r; }
+        pointer allocate( size_type n, const void* = 0 )
+        {
+            return static_cast<pointer>( m_arena->allocate( n * sizeof(T) ) );
+        }
+        // the memory is given back with the arena
+        void deallocate( pointer, size_type ) {}
+        size_type max_size() const { return size_type(-1) / sizeof(T); }
+        void construct( pointer p, const T &value ) { new (p) T(value); }
+        void destroy( pointer p ) { p->~T(); }
+
+        bool operator==( const OlcArenaAllocator &a ) const { return m_arena == a.m_arena; }
+        bool operator!=( const OlcArenaAllocator &a ) const { return m_arena != a.m_arena; }
+
+        OlcArenaPtr m_arena;
+};
+
+// creates a T, inside of "arena" unless that is null
+template <class T, class A1>
+inline boost::shared_ptr<T> olcCreate( const OlcArenaPtr &arena, const A1 &a1 )
+{
+    if ( ! arena )
+    {
+        return boost::shared_ptr<T>( new T( a1 ) );
+    }
+    return boost::allocate_shared<T>( OlcArenaAllocator<T>( arena ), a1 );
+}
+
+template <class T, class A1, class A2>
+inline boost::shared_ptr<T> olcCreate( const OlcArenaPtr &arena, const A1 &a1, const A2 &a2 )
+{
+    if ( ! arena )
+    {
+        return boost::shared_ptr<T>( new T( a1, a2 ) );
+    }
+    return boost::allocate_shared<T>( OlcArenaAllocator<T>( arena ), a1, a2 );
+}
+
+template <class T, class A1, class A2, class A3, class A4>
+inline boost::shared_ptr<T> olcCreate( const OlcArenaPtr &arena, const A1 &a1, const A2 &a2,
+                                       const A3 &a3, const A4 &a4 )
+{
+    if ( ! arena )
+    {
+        return boost::shared_ptr<T>( new T( a1, a2, a3, a4 ) );
+    }
+    return boost::allocate_shared<T>( OlcArenaAllocator<T>( arena ), a1, a2, a3, a4 );
+}
+
 class OlcConfigEntry
 {
     public:
@@ -39,34 +194,62 @@ class OlcConfigEntry
         static bool isOverlayEntry( const LDAPEntry& le);
         static bool isGlobalEntry( const LDAPEntry& le);
 
-        inline OlcConfigEntry() : m_dbEntry(), m_dbEntryChanged() {}
-        inline OlcConfigEntry(const LDAPEntry& le) : m_dbEntry(le), m_dbEntryChanged(le) {}
-        inline OlcConfigEntry(const LDAPEntry& le, const LDAPEntry& le1) 
-                    : m_dbEntry(le), m_dbEntryChanged(le1) {}
+        inline OlcConfigEntry() : m_dbEntry(), m_changedEntryValid(false),
+                    m_attrIndexValid(false), m_resetVersion(++s_attrVersion) {}
+        inline OlcConfigEntry(const LDAPEntry& le) 
+                    : m_dbEntry(le), m_changedDn(le.getDN()), m_changedEntryValid(false),
+                      m_attrIndexValid(false), m_resetVersion(++s_attrVersion) {}
+        OlcConfigEntry(const LDAPEntry& le, const LDAPEntry& le1);
+        OlcConfigEntry( const OlcConfigEntry &oce );
+        OlcConfigEntry& operator=( const OlcConfigEntry &oce );
+        virtual ~OlcConfigEntry() {}
 
         inline std::string getDn() const { 
             return m_dbEntry.getDN();
         }
         inline std::string getUpdatedDn() const { 
-            return m_dbEntryChanged.getDN();
+            return m_changedDn;
         }
-        inline const LDAPEntry& getChangedEntry() const {
-            return m_dbEntryChanged;
+        // the changed entry shares the unmodified attributes with the
+        // original one, it is only put together when it is needed as a
+        // whole, as long as nothing was modified the original is returned
+        const LDAPEntry& getChangedEntry() const;
+        inline const LDAPEntry& getOrigEntry() const {
+            return m_dbEntry;
         }
 
         virtual void clearChangedEntry();     
         virtual void resetEntries( const LDAPEntry &le );
+        // makes the changed entry the current server state of this entry,
+        // "{n}" prefixes are added to unindexed X-ORDERED values
+        void applyChanges();
+        // puts back both entries, e.g. after the commit of the changes has
+        // been rolled back
+        void restoreEntries( const LDAPEntry &origEntry, const LDAPEntry &changedEntry );
+        // makes "le", the entry as changed on the server by someone else,
+        // the original entry and applies the local changes on top of it.
+        // Returns false if an attribute was changed both locally and on the
+        // server, the local values are kept for it. A new entry is left
+        // alone, "le" being added on the server as well is a conflict.
+        bool rebase( const LDAPEntry &le );
 
         bool isNewEntry() const;
         bool isDeletedEntry() const;
+        // true if the entry needs to be added, deleted or modified
+        bool hasChanges() const;
 
         LDAPModList entryDifftoMod() const;
+        // the modifications restoring the original values of all changed
+        // attributes
+        LDAPModList undoDifftoMod() const;
         
-        StringList getStringValues(const std::string &type) const;
+        // the returned references are only valid until the attribute is
+        // modified
+        const StringList& getStringValues(const std::string &type) const;
         void setStringValues(const std::string &type, const StringList &values);
 
         // shortcuts for single-valued Attributes
-        std::string getStringValue(const std::string &type) const;
+        const std::string& getStringValue(const std::string &type) const;
         void setStringValue(const std::string &type, const std::string &value);
         void addStringValue(const std::string &type, const std::string &value);
 
@@ -80,6 +263,11 @@ class OlcConfigEntry
 
         int getEntryIndex() const;
 
+        // changes whenever the attribute in the changed entry is modified,
+        // allows caching values derived from it. The versions are unique
+        // across all entries.
+        unsigned long getAttributeVersion(const std::string &type) const;
+
         virtual std::string toLdif() const;
 
     protected:
@@ -89,11 +277,45 @@ class OlcConfigEntry
             return &orderedAttrs;
         }
 
+        // indexed lookup/modification of the attributes of the changed
+        // entry, all changes to its attributes need to go through these
+        const LDAPAttribute* getAttribute(const std::string &type) const;
+        void replaceAttribute(const LDAPAttribute &attr);
+        void deleteAttribute(const std::string &type);
+        void setUpdatedDn(const std::string &dn);
+        // the original entry is only modified to follow a renumbering
+        void replaceOrigAttribute(const LDAPAttribute &attr);
+
+        LDAPModList diffEntries( const LDAPEntry &oldEntry,
+                                 const LDAPEntry &newEntry ) const;
+
         int entryIndex;
         LDAPEntry m_dbEntry;
-        LDAPEntry m_dbEntryChanged;
 
         static const std::list<std::string> orderedAttrs;
+
+    private:
+        void invalidateAttributes();
+        const LDAPAttribute* getOrigAttribute(const std::string &type) const;
+        void setChangedEntry( const LDAPEntry &le );
+        void forgetChange( const std::string &type );
+        void changedAttributes( LDAPEntry &origAttrs, LDAPEntry &changedAttrs ) const;
+
+        std::string m_changedDn;
+        // the modified ("dirty") attributes of the changed entry, all others
+        // are the ones of m_dbEntry. m_changedOrder has their names in the
+        // order of the first modification.
+        AttributeOverlay m_changedAttrs;
+        std::vector<std::string> m_changedOrder;
+        mutable LDAPEntry m_dbEntryChanged;
+        mutable bool m_changedEntryValid;
+        // the attributes of m_dbEntry
+        mutable AttributeIndex m_attrIndex;
+        mutable bool m_attrIndexValid;
+        // version of the attributes not modified since the last reset
+        unsigned long m_resetVersion;
+        AttributeVersions m_attrVersions;
+        static unsigned long s_attrVersion;
 };
 
 enum IndexType {
@@ -115,6 +337,8 @@ class OlcOverlay : public OlcConfigEntry
 {
     public:
         static OlcOverlay* createFromLdapEntry( const LDAPEntry& le);
+        static boost::shared_ptr<OlcOverlay> createFromLdapEntry( const LDAPEntry& le,
+                                                                  const OlcArenaPtr &arena );
         OlcOverlay( const LDAPEntry &le );
         OlcOverlay( const std::string &type, const std::string &parent, const std::string &oc="" );
         const std::string getType() const;
@@ -205,7 +429,7 @@ class OlcAclBy
         std::string m_control;
 };
 
-typedef std::list<boost::shared_ptr<OlcAclBy> > OlcAclByList;
+typedef std::vector<boost::shared_ptr<OlcAclBy> > OlcAclByList;
 class OlcAccess
 {
     public:
@@ -360,15 +584,40 @@ class OlcServerId
         std::string serverUri;
 };
 
-typedef std::list<boost::shared_ptr<OlcOverlay> > OlcOverlayList;
-typedef std::list<boost::shared_ptr<OlcAccess> > OlcAccessList;
-typedef std::list<boost::shared_ptr<OlcLimits> > OlcLimitList;
-typedef std::list<boost::shared_ptr<OlcSyncRepl> > OlcSyncReplList;
+// Hands out the lowest unused id of the range [minId, maxId), e.g. for
+// syncrepl rids or serverIds. An id can be in use more than once.
+class OlcIdAllocator
+{
+    public:
+        OlcIdAllocator( int minId = 1, int maxId = 999 );
+
+        void clear();
+        void markUsed( int id );
+        void release( int id );
+        bool isUsed( int id ) const;
+        // returns 0 if all ids are in use
+        int getFreeId() const;
+
+    private:
+        int m_minId;
+        std::vector<int> m_useCount;
+        // no id below this one is free
+        mutable int m_firstFree;
+};
+
+typedef std::vector<boost::shared_ptr<OlcOverlay> > OlcOverlayList;
+typedef std::vector<boost::shared_ptr<OlcAccess> > OlcAccessList;
+typedef std::vector<boost::shared_ptr<OlcLimits> > OlcLimitList;
+typedef std::vector<boost::shared_ptr<OlcSyncRepl> > OlcSyncReplList;
 
 class OlcDatabase : public OlcConfigEntry
 {
     public :
         static OlcDatabase* createFromLdapEntry( const LDAPEntry& le );
+        // the database is created in "arena" while a configuration is
+        // loaded, the values parsed from it later on are not
+        static boost::shared_ptr<OlcDatabase> createFromLdapEntry( const LDAPEntry& le,
+                                                                   const OlcArenaPtr &arena );
         
         OlcDatabase( const LDAPEntry &le );
         OlcDatabase( const std::string& type );
@@ -399,6 +648,17 @@ class OlcDatabase : public OlcConfigEntry
         void addOverlay(boost::shared_ptr<OlcOverlay> overlay);
         OlcOverlayList& getOverlays() ;
 
+        // moves the databases in [first, last) and their overlays by
+        // "offset" indexes, e.g. after a database before them was added or
+        // deleted. slapd renumbers the existing entries itself, so their
+        // original entries are renamed as well and no modification is sent
+        // for the new index. A deleted database stays deleted, only the DN
+        // its delete is sent with moves, as the changes are made in the
+        // order of the list.
+        static void renumber( std::vector<boost::shared_ptr<OlcDatabase> >::iterator first,
+                              std::vector<boost::shared_ptr<OlcDatabase> >::iterator last,
+                              int offset );
+
     protected:
         virtual void resetMemberAttrs();
         virtual void updateEntryDn( bool origEntry = false );
@@ -409,6 +669,20 @@ class OlcDatabase : public OlcConfigEntry
         OlcOverlayList m_overlays;
 
         static const std::list<std::string> orderedAttrs;
+
+    private:
+        OlcSyncReplList parseSyncRepl() const;
+
+        // the parsed values of olcAccess, olcLimits and olcSyncrepl, valid
+        // as long as the version of their attribute is unchanged
+        mutable unsigned long m_aclVersion;
+        mutable OlcAccessList m_aclCache;
+        mutable bool m_aclParsed;
+        mutable unsigned long m_limitsVersion;
+        mutable OlcLimitList m_limitsCache;
+        mutable bool m_limitsParsed;
+        mutable unsigned long m_syncReplVersion;
+        mutable OlcSyncReplList m_syncReplCache;
 };
 
 class OlcBdbDatabase : public  OlcDatabase 
@@ -509,34 +783,292 @@ class OlcTlsSettings {
         std::string m_crlFile;
 };
 
-typedef std::list<boost::shared_ptr<OlcDatabase> > OlcDatabaseList;
-typedef std::list<boost::shared_ptr<OlcSchemaConfig> > OlcSchemaList;
+typedef std::vector<boost::shared_ptr<OlcDatabase> > OlcDatabaseList;
+typedef std::vector<boost::shared_ptr<OlcSchemaConfig> > OlcSchemaList;
+// entries to be written by OlcConfig::updateEntries(), not owned by the list
+typedef std::list<OlcConfigEntry*> OlcConfigEntryList;
+
+class OlcEntryHandler
+{
+    public:
+        virtual ~OlcEntryHandler() {}
+        // return false to stop the search
+        virtual bool handleEntry( const LDAPEntry &entry ) = 0;
+};
+
+// Receives the changes of cn=config reported by OlcConfig::pollSync()
+class OlcSyncHandler
+{
+    public:
+        virtual ~OlcSyncHandler() {}
+        // an entry was added or modified. When an entry was renamed (e.g.
+        // by the renumbering of its siblings) its old DN is reported as
+        // deleted first.
+        virtual void entryChanged( const LDAPEntry &entry ) = 0;
+        virtual void entryDeleted( const std::string &dn ) = 0;
+};
+
+// State of the LDAP Sync session of an OlcConfig object
+struct OlcSyncState
+{
+    OlcSyncState() : msgId(-1), refreshing(false) {}
+    int msgId;
+    // true until the refresh phase of the session is done
+    bool refreshing;
+    std::string cookie;
+    // the DNs of the entries by entryUUID
+    std::map<std::string, std::string> dns;
+    // the entryUUIDs reported during the refresh phase
+    std::set<std::string> seen;
+};
+
+// Orders the pending changes of a set of entries by their dependencies:
+//  - new entries are added after their parent, deleted entries are removed
+//    after their children
+//  - schema changes happen before the databases and overlays are changed
+//  - adds and deletes renumber their indexed siblings, so they stay in the
+//    given order relative to all other changes below the same parent. The
+//    DN of each entry is the one it has once the changes in front of it
+//    have been made, see OlcDatabase::renumber().
+// The changes are grouped into waves. The changes of one wave only depend on
+// changes of earlier waves and can be sent at once.
+class OlcCommitPlan {
+    public:
+        enum Operation { ADD, MODIFY, DELETE };
+        struct Step {
+            OlcConfigEntry *entry;
+            Operation op;
+            std::string dn;
+            // the modifications of a MODIFY step, computed once when planning
+            LDAPModList mods;
+        };
+        typedef std::vector<Step> Wave;
+
+        // entries without changes are not part of the plan
+        OlcCommitPlan( const OlcConfigEntryList &entries );
+
+        const std::vector<Wave>& getWaves() const;
+        // one line per wave, e.g. for previewing a commit
+        std::string toString() const;
+
+    private:
+        std::vector<Wave> m_waves;
+};
+
+// The LDAP traffic caused by an OlcConfig object. "bytes" counts the DNs,
+// attribute names and values of the entries read or added, not the size of
+// the encoded messages.
+struct OlcTraffic
+{
+    OlcTraffic() : roundTrips(0), entries(0), bytes(0) {}
+    unsigned long roundTrips;
+    unsigned long entries;
+    unsigned long bytes;
+};
+
+// Count and latency of one kind of LDAP operation. The histogram counts the
+// operations by latency, bucket i holds the operations faster than
+// histogramBounds[i] microseconds, the last bucket all slower ones.
+struct OlcOperationStats
+{
+    static const int HISTOGRAM_BUCKETS = 16;
+    static const long long histogramBounds[HISTOGRAM_BUCKETS - 1];
+
+    OlcOperationStats();
+    void add( long long micros, bool success );
+
+    unsigned long count;
+    unsigned long failed;
+    long long totalMicros;
+    long long maxMicros;
+    unsigned long histogram[HISTOGRAM_BUCKETS];
+};
+
+// Statistics of the LDAP operations of an OlcConfig object by operation and
+// by the class of the target DN (or the search base of a base search)
+class OlcStatistics
+{
+    public:
+        enum Operation { SEARCH, ADD, MODIFY, DELETE, EXTENDED, OPERATIONS };
+        enum DnClass { GLOBAL, DATABASE, OVERLAY, SCHEMA, OTHER, DN_CLASSES };
+
+        static DnClass dnClass( const std::string &dn );
+        static const char* operationName( Operation op );
+        static const char* dnClassName( DnClass dnClass );
+
+        void record( Operation op, DnClass dnClass, long long micros, bool success );
+        const OlcOperationStats& get( Operation op, DnClass dnClass ) const;
+        void clear();
+
+    private:
+        OlcOperationStats m_stats[OPERATIONS][DN_CLASSES];
+};
+
+// Keeps connections to LDAP servers open for reuse, e.g. for the repeated
+// checks of a syncrepl provider while its settings are entered, which would
+// otherwise do a TLS handshake and a bind each time. The connections are
+// keyed by URL, TLS settings and bind DN. The ones idle for longer than the
+// timeout are closed the next time the pool is used.
+class OlcConnectionPool
+{
+    public:
+        struct Key
+        {
+            Key( const std::string &url, bool startTls = false,
+                 const std::string &caCert = "" );
+            bool operator<( const Key &key ) const;
+
+            std::string url;
+            bool startTls;
+            std::string caCert;
+        };
+        // what remains to be done on an acquired connection. Credentials
+        // are not kept, a connection always has to be bound again.
+        enum State { NEW,       // StartTLS (if requested) and bind
+                     BIND };    // bind, StartTLS was done already
+
+        OlcConnectionPool( int idleTimeout = 120 );
+        ~OlcConnectionPool();
+
+        // Hands out an idle connection for the key or opens a new one. The
+        // connection belongs to the caller until it is released or
+        // discarded.
+        LDAPAsynConnection* acquire( const Key &key, State &state );
+        // puts a connection back, only after StartTLS (if requested)
+        // succeeded on it
+        void release( LDAPAsynConnection *lc );
+        // closes a connection that failed
+        void discard( LDAPAsynConnection *lc );
+
+        void expire();
+        unsigned int idleConnections() const;
+
+    private:
+        struct Connection
+        {
+            LDAPAsynConnection *lc;
+            time_t lastUsed;
+        };
+        OlcConnectionPool( const OlcConnectionPool& );
+        OlcConnectionPool& operator=( const OlcConnectionPool& );
+
+        int m_idleTimeout;
+        std::multimap<Key, Connection> m_idle;
+        std::map<LDAPAsynConnection*, std::pair<Key, Connection> > m_inUse;
+};
 
 class OlcConfig {
 
     public:
-        OlcConfig(LDAPConnection *lc=0 );
+        // The asynchronous interface of the connection is used to process
+        // search results as they arrive and to send several updates at once
+        OlcConfig(LDAPAsynConnection *lc=0 );
 
         bool hasConnection() const;
-        inline LDAPConnection* getLdapConnection()
+        inline LDAPAsynConnection* getLdapConnection()
         {
             return m_lc;
         }
 
+        // waits for the result of an operation sent through the
+        // asynchronous interface (skipping the entries of a search), the
+        // queue is deleted. Throws an LDAPException if the operation failed.
+        static void waitForResult( LDAPMessageQueue *queue );
+
         boost::shared_ptr<OlcGlobalConfig> getGlobals();
         OlcDatabaseList getDatabases();
         OlcSchemaList getSchemaNames();
+        void getConfig( boost::shared_ptr<OlcGlobalConfig> &globals,
+                        OlcDatabaseList &databases,
+                        OlcSchemaList &schema );
+
+        void searchEntries( const std::string &base, int scope,
+                            const std::string &filter,
+                            OlcEntryHandler &handler,
+                            const StringList &attrs = StringList(),
+                            int pageSize = 0 );
 
         void setGlobals( OlcGlobalConfig &olcg);
         void updateEntry( OlcConfigEntry &oce );
+        // Writes the changes of all entries according to their OlcCommitPlan.
+        // If the server supports LDAP Transactions (RFC 5805) all changes
+        // are sent within a single transaction, a failed operation aborts it
+        // and is thrown. If the server refuses transactions for cn=config
+        // they aren't used anymore. Otherwise the changes of a
+        // wave are sent without waiting for the results of each other. If
+        // one of the operations fails, no further waves are sent, the
+        // changes already applied are undone and an LDAPException is thrown.
+        void updateEntries( const OlcConfigEntryList &entries );
+        void updateEntries( const OlcCommitPlan &plan );
+
+        // If set, getConfig() keeps a copy of the cn=config tree in this
+        // file. On the next call a single search for the entryCSN (or
+        // modifyTimestamp) of all entries tells which entries changed, only
+        // those are read again. The file is created with mode 0600. The
+        // attributes holding credentials (olcRootPW, olcSyncrepl, ...) are
+        // left out of it, they are read from the server every time.
+        void setCacheFile( const std::string &path );
+
+        // If enabled, updateEntry() doesn't re-read modified entries from
+        // the server but applies the changes locally. Values normalized by
+        // slapd (e.g. the whitespace of olcAccess) keep the form they were
+        // written with. New entries are always re-read.
+        void setLocalUpdates( bool enable );
+
+        // If not 0, each read of the configuration allocates the objects of
+        // the returned model from an OlcArena of its own with blocks of this
+        // size. The default is 0, every object is allocated separately.
+        void setArenaBlockSize( std::size_t size );
+
+        // Starts an LDAP Sync (RFC 4533) refreshAndPersist search on
+        // cn=config, which reports the changes made by other clients from
+        // now on. Requires the syncprov overlay on the config database,
+        // returns false if cn=config has no contextCSN.
+        bool startSync();
+        // Passes the changes received since the last call to the handler,
+        // without waiting for further ones. Returns false when the session
+        // has ended, the configuration has to be read again then.
+        bool pollSync( OlcSyncHandler &handler );
+        void stopSync();
+        bool isSyncActive() const;
 
         void waitForBackgroundTasks();
 
+        const OlcTraffic& getTraffic() const;
+        const OlcStatistics& getStatistics() const;
+        void resetStatistics();
+
         static SlapdConfigLogCallback *logCallback;
         static void setLogCallback( SlapdConfigLogCallback *lcb );
 
+        // Messages more verbose than the log level are dropped before
+        // their text is built. By default everything is logged.
+        static int logLevel;
+        static void setLogLevel( int level );
+        static inline bool logEnabled( int level )
+        {
+            return level <= SLAPD_LOG_MAX_LEVEL && level <= logLevel;
+        }
+
     private:
-        LDAPConnection *m_lc;
+        void readConfigTree( const std::string &filter,
+                             boost::shared_ptr<OlcGlobalConfig> &globals,
+                             OlcDatabaseList &databases,
+                             OlcSchemaList &schema );
+        void readSnapshot( OlcEntryHandler &handler );
+        OlcArenaPtr newArena() const;
+        bool supportsTransactions();
+        bool updateInTransaction( const OlcCommitPlan &plan );
+
+        LDAPAsynConnection *m_lc;
+        std::string m_cacheFile;
+        std::size_t m_arenaBlockSize;
+        OlcSyncState m_sync;
+        bool m_localUpdates;
+        bool m_txnChecked;
+        bool m_txnSupported;
+        OlcTraffic m_traffic;
+        OlcStatistics m_stats;
 };
 
 